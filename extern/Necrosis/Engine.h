@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Window.h"
+#include "tasks/TaskScheduler.h"
 
 namespace Necrosis {
 
@@ -25,6 +26,10 @@ public:
 
     void swapBuffers() { _mainWindow->swapBuffers(); }
     Window* getMainWindow() const { return _mainWindow; }
+    /**
+     * @brief Runs all the parallel and background work of the application
+     */
+    TaskScheduler& getTaskScheduler() { return _taskScheduler; }
 
     void startGuiFrame();
     void endGuiFrame();
@@ -34,6 +39,7 @@ protected:
 
     // TODO: I must change the window management system
     Window *_mainWindow = nullptr;
+    TaskScheduler _taskScheduler;
 };
 
 }
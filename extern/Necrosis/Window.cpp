@@ -1,6 +1,7 @@
 #include "Window.h"
 
 #include <iostream>
+#include <iterator>
 #include <cassert>
 
 #include <glad/glad.h>
@@ -151,6 +152,19 @@ void Window::showWarningMessageBox(const std::string &message, const std::string
 void Window::showErrorMessageBox(const std::string &message, const std::string &title) {
     SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, title.c_str(), message.c_str(), nullptr);
 }
+bool Window::showConfirmMessageBox(const std::string &message, const std::string &title) {
+    const SDL_MessageBoxButtonData buttons[] = {
+        { SDL_MESSAGEBOX_BUTTON_ESCAPEKEY_DEFAULT, 0, "No" },
+        { SDL_MESSAGEBOX_BUTTON_RETURNKEY_DEFAULT, 1, "Yes" },
+    };
+    const SDL_MessageBoxData data = {
+        SDL_MESSAGEBOX_WARNING, nullptr, title.c_str(), message.c_str(),
+        static_cast<int>(std::size(buttons)), buttons, nullptr
+    };
+    int buttonId = 0;
+    // a box that couldn't be shown counts as a no
+    return SDL_ShowMessageBox(&data, &buttonId) && buttonId == 1;
+}
 
 void Window::openFileDialog(
         std::function<void(std::string)> callback,
@@ -17,6 +17,11 @@ public:
     static void showInfoMessageBox(const std::string &message, const std::string &title = "Information");
     static void showWarningMessageBox(const std::string &message, const std::string &title = "Warning");
     static void showErrorMessageBox(const std::string &message, const std::string &title = "Error");
+    /**
+     * @brief Asks a yes or no question, blocking until it is answered
+     * @return true if the user answered yes
+     */
+    static bool showConfirmMessageBox(const std::string &message, const std::string &title = "Confirmation");
     static void openFileDialog(
         std::function<void(std::string)> callback,
         const std::vector<FileFilter> &filters = std::vector<FileFilter>(0),
@@ -37,6 +37,11 @@ void VertexBuffer::setData(const void* data, u32 size) {
     // unbind();
 }
 
+void VertexBuffer::updateData(const void* data, u32 offset, u32 size) {
+    bind();
+    glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+}
+
 u32 VertexBuffer::count() const {
     return _count;
 }
@@ -21,6 +21,10 @@ public:
     void bind() const;
     void unbind() const;
     void setData(const void* data, u32 size);
+    /**
+     * @brief Overwrites `size` bytes of the buffer starting at `offset` without reallocating it
+     */
+    void updateData(const void* data, u32 offset, u32 size);
 
     u32 count() const;
 
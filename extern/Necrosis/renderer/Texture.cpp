@@ -66,6 +66,31 @@ void Texture::updateTexture(const u8 *data, int width, int height, PixelFormat p
     unbind();
 }
 
+void Texture::updateRegion(const u8 *data, int x, int y, int width, int height, PixelFormat pixelFormat) {
+    if (!data) { return; }
+
+    u32 format = 0;
+    switch (pixelFormat) {
+    case PixelFormat::RGBA:
+        format = GL_RGBA;
+        break;
+    case PixelFormat::RGB:
+        format = GL_RGB;
+        break;
+    case PixelFormat::Luminance:
+        format = GL_RED;
+        break;
+    default:
+        slog::warning("Invalid pixel format specified");
+        return;
+    }
+    bind();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, width, height, format, GL_UNSIGNED_BYTE, data);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    unbind();
+}
+
 TextureManager TextureManager::instance;
 
 TextureManager::~TextureManager() {
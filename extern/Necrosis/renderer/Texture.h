@@ -53,6 +53,14 @@ public:
     void updateTexture(
         const u8 *data, int width, int height, PixelFormat pixelFormat = PixelFormat::RGBA
     );
+    /**
+     * @brief Replaces the pixels of a rectangle, the size and the format of the texture don't change
+     *
+     * @param data Pixels of the rectangle, row by row
+     */
+    void updateRegion(
+        const u8 *data, int x, int y, int width, int height, PixelFormat pixelFormat = PixelFormat::RGBA
+    );
 
     int getWidth() const { return _width; }
     int getHeight() const { return _height; }
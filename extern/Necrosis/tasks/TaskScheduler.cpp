@@ -0,0 +1,293 @@
+#include "TaskScheduler.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace Necrosis {
+
+namespace {
+// the scheduler of the worker running on this thread, if it is one
+thread_local TaskScheduler *currentScheduler = nullptr;
+thread_local u32 currentWorkerIndex = 0;
+}
+
+TaskScheduler::TaskScheduler(u32 numThreads) {
+    if (numThreads == 0) {
+        numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    const u32 numWorkers = std::max(1u, numThreads - 1);
+    _numThreads = numWorkers + 1;
+    _workers.reserve(numWorkers);
+    for (u32 i = 0; i < numWorkers; i++) {
+        _workers.push_back(std::make_unique<Worker>());
+    }
+    // started once every queue exists, they steal from each other
+    for (u32 i = 0; i < numWorkers; i++) {
+        _workers[i]->thread = std::thread([this, i]() { _workerLoop(i); });
+    }
+}
+
+TaskScheduler::~TaskScheduler() {
+    {
+        std::lock_guard lock(_sleepMutex);
+        _isStopping = true;
+    }
+    _wakeUp.notify_all();
+
+    for (auto &worker : _workers) {
+        worker->thread.join();
+    }
+}
+
+void TaskScheduler::_push(Job job) {
+    if (currentScheduler == this) {
+        Worker &worker = *_workers[currentWorkerIndex];
+        std::lock_guard lock(worker.mutex);
+        worker.jobs.push_back(std::move(job));
+    }
+    else {
+        std::lock_guard lock(_sharedMutex);
+        _sharedJobs.push_back(std::move(job));
+    }
+
+    _numQueuedJobs.fetch_add(1, std::memory_order_release);
+    // a worker checks the count under the lock before sleeping, so it can't miss this one
+    { std::lock_guard lock(_sleepMutex); }
+    _wakeUp.notify_one();
+}
+
+bool TaskScheduler::_tryPop(u32 workerIndex, Job &job) {
+    auto popped = [&]() {
+        _numQueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    };
+
+    // the latest job of its own is the most likely to be in the cache
+    {
+        Worker &worker = *_workers[workerIndex];
+        std::lock_guard lock(worker.mutex);
+        if (!worker.jobs.empty()) {
+            job = std::move(worker.jobs.back());
+            worker.jobs.pop_back();
+            return popped();
+        }
+    }
+    {
+        std::lock_guard lock(_sharedMutex);
+        if (!_sharedJobs.empty()) {
+            job = std::move(_sharedJobs.front());
+            _sharedJobs.pop_front();
+            return popped();
+        }
+    }
+    // steals the oldest job of another worker, the biggest part of its work left
+    for (u32 offset = 1; offset < _workers.size(); offset++) {
+        Worker &victim = *_workers[(workerIndex + offset) % _workers.size()];
+        std::lock_guard lock(victim.mutex);
+        if (!victim.jobs.empty()) {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            return popped();
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::_workerLoop(u32 workerIndex) {
+    currentScheduler = this;
+    currentWorkerIndex = workerIndex;
+
+    Job job;
+    while (true) {
+        // a loop has a caller waiting for it, it goes before the queued jobs
+        if (_numJoinableLoops.load(std::memory_order_acquire) > 0 && _tryHelpLoop()) {
+            continue;
+        }
+        if (_tryPop(workerIndex, job)) {
+            job();
+            job = nullptr;
+            continue;
+        }
+
+        std::unique_lock lock(_sleepMutex);
+        _wakeUp.wait(lock, [this]() {
+            return _numQueuedJobs.load(std::memory_order_acquire) > 0 || _numJoinableLoops.load(std::memory_order_acquire) > 0
+                || _isStopping;
+        });
+        // the queues are drained before stopping
+        if (_isStopping && _numQueuedJobs.load(std::memory_order_acquire) == 0) {
+            return;
+        }
+    }
+}
+
+void TaskScheduler::_parallelFor(u32 count, void (*invoke)(void*, u32), void *context, std::stop_token stopToken) {
+    if (count == 0) { return; }
+
+    Loop loop;
+    loop.invoke = invoke;
+    loop.context = context;
+    loop.count = count;
+    loop.maxHelpers = std::min(count - 1, static_cast<u32>(_workers.size()));
+    loop.stopToken = std::move(stopToken);
+
+    // a single index isn't worth waking up the workers
+    if (loop.maxHelpers > 0 && _openLoop(loop)) {
+        // a worker checks the count under the lock before sleeping, so it can't miss the loop
+        { std::lock_guard lock(_sleepMutex); }
+        for (u32 i = 0; i < loop.maxHelpers; i++) {
+            _wakeUp.notify_one();
+        }
+    }
+
+    _runLoop(loop);
+
+    // the helpers may still be running the indices they claimed, the loop lives until they leave
+    {
+        std::unique_lock lock(_loopMutex);
+        _closeLoop(loop);
+        loop.helpersLeft.wait(lock, [&loop]() { return loop.numHelpers == 0; });
+    }
+
+    if (loop.exception) {
+        std::rethrow_exception(loop.exception);
+    }
+}
+
+bool TaskScheduler::_openLoop(Loop &loop) {
+    std::lock_guard lock(_loopMutex);
+    for (u32 slot = 0; slot < MAX_OPEN_LOOPS; slot++) {
+        if (!_openLoops[slot]) {
+            _openLoops[slot] = &loop;
+            loop.slot = slot;
+            loop.isOpen = true;
+            _numJoinableLoops.fetch_add(1, std::memory_order_release);
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskScheduler::_closeLoop(Loop &loop) {
+    if (!loop.isOpen) { return; }
+
+    if (loop.numHelpers < loop.maxHelpers) {
+        _numJoinableLoops.fetch_sub(1, std::memory_order_relaxed);
+    }
+    _openLoops[loop.slot] = nullptr;
+    loop.isOpen = false;
+}
+
+bool TaskScheduler::_tryHelpLoop() {
+    Loop *loop = nullptr;
+    {
+        std::lock_guard lock(_loopMutex);
+        for (Loop *openLoop : _openLoops) {
+            if (openLoop && openLoop->numHelpers < openLoop->maxHelpers) {
+                loop = openLoop;
+                break;
+            }
+        }
+        if (!loop) { return false; }
+
+        if (++loop->numHelpers == loop->maxHelpers) {
+            _numJoinableLoops.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    _runLoop(*loop);
+
+    // notified under the lock, so the caller can't return and destroy the loop in between
+    std::lock_guard lock(_loopMutex);
+    _closeLoop(*loop);
+    if (--loop->numHelpers == 0) {
+        loop->helpersLeft.notify_all();
+    }
+    return true;
+}
+
+void TaskScheduler::_runLoop(Loop &loop) {
+    for (u32 i = loop.nextIndex.fetch_add(1, std::memory_order_relaxed); i < loop.count;
+         i = loop.nextIndex.fetch_add(1, std::memory_order_relaxed)) {
+        if (loop.stopToken.stop_requested() || loop.hasFailed.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        try {
+            loop.invoke(loop.context, i);
+        }
+        catch (...) {
+            std::lock_guard lock(_loopMutex);
+            if (!loop.exception) {
+                loop.exception = std::current_exception();
+            }
+            loop.hasFailed.store(true, std::memory_order_relaxed);
+        }
+    }
+}
+
+TaskGroup::TaskGroup(TaskScheduler &scheduler, std::stop_token stopToken)
+    : _scheduler(scheduler), _stopToken(std::move(stopToken)) {}
+
+TaskGroup::~TaskGroup() {
+    try {
+        wait();
+    }
+    catch (...) {}
+}
+
+void TaskGroup::_run(TaskScheduler::Job job) {
+    auto entry = std::make_shared<Entry>();
+    entry->job = std::move(job);
+    _entries.push_back(entry);
+    _numPendingJobs.fetch_add(1, std::memory_order_relaxed);
+
+    // the group is only alive until its jobs are claimed and done, the entry until the queue drops it
+    _scheduler._push([this, entry]() {
+        if (!entry->isClaimed.exchange(true, std::memory_order_acq_rel)) {
+            _runEntry(*entry);
+        }
+    });
+}
+
+void TaskGroup::_runEntry(Entry &entry) {
+    if (!_stopToken.stop_requested()) {
+        try {
+            entry.job();
+        }
+        catch (...) {
+            std::lock_guard lock(_mutex);
+            if (!_exception) {
+                _exception = std::current_exception();
+            }
+        }
+    }
+    entry.job = nullptr;
+
+    // notified under the lock, so `wait` can't return and destroy the group in between
+    std::lock_guard lock(_mutex);
+    if (_numPendingJobs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        _done.notify_all();
+    }
+}
+
+void TaskGroup::wait() {
+    // runs the jobs no worker started yet instead of waiting for one to be free
+    for (auto &entry : _entries) {
+        if (!entry->isClaimed.exchange(true, std::memory_order_acq_rel)) {
+            _runEntry(*entry);
+        }
+    }
+
+    {
+        std::unique_lock lock(_mutex);
+        _done.wait(lock, [this]() { return _numPendingJobs.load(std::memory_order_acquire) == 0; });
+    }
+    _entries.clear();
+
+    if (_exception) {
+        std::rethrow_exception(std::exchange(_exception, nullptr));
+    }
+}
+
+}
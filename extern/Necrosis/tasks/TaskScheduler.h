@@ -0,0 +1,238 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "../Common.h"
+
+namespace Necrosis {
+
+/**
+ * @brief Work-stealing scheduler shared by everything that runs in parallel, so the cores
+ * are never oversubscribed
+ *
+ * Every worker has its own queue of jobs: it pushes and pops the jobs it spawns at the back,
+ * and steals from the front of the queues of the others when its own is empty. The jobs
+ * submitted by the other threads go to a shared queue.
+ *
+ * The parallel loops don't go through the queues: the state of a loop stays on the stack of
+ * its caller and is published in a fixed table the idle workers join from, so starting
+ * a loop doesn't allocate.
+ *
+ * Cancellation goes through `std::stop_token`: the loops and the groups stop starting work
+ * once their token is stopped, and the jobs are expected to check their own token.
+ */
+class TaskScheduler {
+public:
+    /**
+     * @param numThreads Number of threads working on a loop started by a thread outside
+     * the scheduler, which takes part in it. 0 uses the number of hardware threads.
+     * There is always at least one worker to run the submitted jobs.
+     */
+    explicit TaskScheduler(u32 numThreads = 0);
+    /**
+     * @brief Runs the jobs left in the queues, then joins the workers
+     */
+    ~TaskScheduler();
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+    /**
+     * @brief Runs `function()` on a worker
+     *
+     * @return The result of the call, or the exception it threw
+     */
+    template <typename Function>
+    auto submit(Function &&function) -> std::future<std::invoke_result_t<std::decay_t<Function>>> {
+        using Result = std::invoke_result_t<std::decay_t<Function>>;
+        std::packaged_task<Result()> task(std::forward<Function>(function));
+        auto future = task.get_future();
+        _push(std::move(task));
+        return future;
+    }
+    /**
+     * @brief Runs `function()` on a thread of its own, for the jobs running until they are
+     * cancelled, which would hold a worker and starve the queued jobs
+     *
+     * @return The result of the call, or the exception it threw. Its destructor waits for the thread
+     */
+    template <typename Function>
+    auto submitDedicated(Function &&function) -> std::future<std::invoke_result_t<std::decay_t<Function>>> {
+        return std::async(std::launch::async, std::forward<Function>(function));
+    }
+
+    /**
+     * @brief Calls `task(i)` for every i in [0, count) across the threads of the scheduler
+     * and returns once all the calls are done.
+     *
+     * The order in which the indices are processed is unspecified. The calling thread takes
+     * part in the loop, so it can be called from a job, or from another loop. The task is
+     * only referenced, never copied, and nothing is allocated. Once `stopToken` is stopped,
+     * the indices not started yet are skipped.
+     *
+     * If a call throws, the indices not started yet are skipped and the first exception is
+     * rethrown once the calls already started are done.
+     */
+    template <typename Task>
+    void parallelFor(u32 count, Task &&task, std::stop_token stopToken = {}) {
+        using Function = std::remove_cvref_t<Task>;
+        _parallelFor(
+            count, [](void *context, u32 i) { (*static_cast<Function*>(context))(i); }, const_cast<Function*>(&task),
+            std::move(stopToken)
+        );
+    }
+
+    /**
+     * @brief Number of threads working on a loop started outside the scheduler
+     */
+    u32 getThreadCount() const { return _numThreads; }
+    u32 getWorkerCount() const { return static_cast<u32>(_workers.size()); }
+
+private:
+    friend class TaskGroup;
+
+    using Job = std::move_only_function<void()>;
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+        std::thread thread;
+    };
+
+    /**
+     * @brief State of a loop, on the stack of its caller which waits for its helpers to leave
+     */
+    struct Loop {
+        void (*invoke)(void *context, u32 i); ///< @brief Calls the task stored in `context`
+        void *context;
+        u32 count;
+        u32 maxHelpers; ///< @brief Workers that can help at the same time
+        std::stop_token stopToken;
+        std::atomic<u32> nextIndex = 0;
+        std::atomic<bool> hasFailed = false;
+
+        // guarded by _loopMutex
+        u32 slot = 0; ///< @brief In `_openLoops`
+        bool isOpen = false;
+        u32 numHelpers = 0;
+        std::exception_ptr exception; ///< @brief First one thrown by a call
+        std::condition_variable helpersLeft;
+    };
+
+    static constexpr u32 MAX_OPEN_LOOPS = 64; ///< @brief The loops started past it run on their caller alone
+
+    u32 _numThreads;
+    std::vector<std::unique_ptr<Worker>> _workers;
+
+    std::mutex _sharedMutex;
+    std::deque<Job> _sharedJobs; ///< @brief Jobs pushed by the threads outside the scheduler
+
+    std::mutex _loopMutex;
+    std::array<Loop*, MAX_OPEN_LOOPS> _openLoops{}; ///< @brief Loops with indices left, null for a free slot
+    /**
+     * @brief Open loops with fewer helpers than their maximum, read by the workers before sleeping
+     */
+    std::atomic<u32> _numJoinableLoops = 0;
+
+    std::mutex _sleepMutex;
+    std::condition_variable _wakeUp;
+    std::atomic<u32> _numQueuedJobs = 0;
+    bool _isStopping = false;
+
+    /**
+     * @brief Queues a job, at the back of the queue of the calling worker if it is one
+     */
+    void _push(Job job);
+    /**
+     * @brief Pops a job from the queue of the worker, the shared queue or another worker
+     */
+    bool _tryPop(u32 workerIndex, Job &job);
+    void _workerLoop(u32 workerIndex);
+    void _parallelFor(u32 count, void (*invoke)(void*, u32), void *context, std::stop_token stopToken);
+    /**
+     * @brief Publishes the loop for the workers to join
+     * @return false if the table is full
+     */
+    bool _openLoop(Loop &loop);
+    /**
+     * @brief Removes the loop from the table, no worker joins it afterwards. Called with `_loopMutex` held
+     */
+    void _closeLoop(Loop &loop);
+    /**
+     * @brief Helps with one of the open loops until it has no index left
+     * @return false if no loop could be joined
+     */
+    bool _tryHelpLoop();
+    /**
+     * @brief Claims and runs indices of the loop until there are none left
+     */
+    void _runLoop(Loop &loop);
+};
+
+/**
+ * @brief Set of jobs waited for together
+ *
+ * `wait` runs the jobs of the group no worker started yet on the calling thread, so a job
+ * may wait for a group it spawned without blocking a worker on queued work.
+ */
+class TaskGroup {
+public:
+    /**
+     * @param stopToken Once stopped, the jobs of the group not started yet are skipped
+     */
+    explicit TaskGroup(TaskScheduler &scheduler, std::stop_token stopToken = {});
+    /**
+     * @brief Waits for the jobs of the group, the exceptions they threw are dropped
+     */
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    template <typename Function>
+    void run(Function &&function) {
+        _run(TaskScheduler::Job(std::forward<Function>(function)));
+    }
+
+    /**
+     * @brief Returns once all the jobs of the group are done, and rethrows the first exception
+     * one of them threw
+     */
+    void wait();
+
+    const std::stop_token& getStopToken() const { return _stopToken; }
+
+private:
+    /**
+     * @brief Job of the group, run by whichever thread claims it first
+     */
+    struct Entry {
+        TaskScheduler::Job job;
+        std::atomic<bool> isClaimed = false;
+    };
+
+    TaskScheduler &_scheduler;
+    std::stop_token _stopToken;
+    std::vector<std::shared_ptr<Entry>> _entries;
+    std::atomic<u32> _numPendingJobs = 0;
+    std::mutex _mutex;
+    std::condition_variable _done;
+    std::exception_ptr _exception; ///< @brief First one thrown by a job
+
+    void _run(TaskScheduler::Job job);
+    void _runEntry(Entry &entry);
+};
+
+}
@@ -1,9 +1,42 @@
 #pragma vertex
 
 layout (location = 0) in vec3 a_pos;
+layout (location = 4) in uvec3 a_patch;
+layout (location = 5) in vec2 a_morphRange;
+
+// heightfield mode, see terrain.glsl
+uniform bool u_isHeightfield;
+uniform sampler2D u_heightmap;
+uniform int u_mapWidth;
+uniform int u_mapDepth;
+uniform int u_patchSize;
+uniform float u_mapScale;
+uniform vec3 u_lodCameraPosition;
+
+vec3 cellPosition(vec2 cell, float height) {
+    vec2 uv = cell / vec2(u_mapWidth, u_mapDepth);
+    return vec3((uv.x * 2.f - 1.f) * u_mapScale, height, (uv.y * 2.f - 1.f) * u_mapScale);
+}
 
 void main() {
-    gl_Position = u_projection * u_view * u_model * vec4(a_pos, 1.0f);
+    vec3 position = a_pos;
+
+    if (u_isHeightfield) {
+        // same morphing as terrain.glsl, so the shadows are cast by the drawn geometry
+        ivec2 local = ivec2(gl_VertexID % (u_patchSize + 1), gl_VertexID / (u_patchSize + 1));
+        int spacing = 1 << a_patch.z;
+        ivec2 lastCell = ivec2(u_mapWidth - 1, u_mapDepth - 1);
+        ivec2 cell = min(ivec2(a_patch.xy) + local * spacing, lastCell);
+        ivec2 coarseCell = min(ivec2(a_patch.xy) + (local & ~1) * spacing, lastCell);
+        float height = texelFetch(u_heightmap, cell, 0).r;
+
+        float distance = length(vec3(u_model * vec4(cellPosition(vec2(cell), height), 1.f)) - u_lodCameraPosition);
+        float morph = clamp((distance - a_morphRange.x) / max(a_morphRange.y - a_morphRange.x, 1e-6f), 0.f, 1.f);
+
+        position = cellPosition(mix(vec2(cell), vec2(coarseCell), morph), mix(height, texelFetch(u_heightmap, coarseCell, 0).r, morph));
+    }
+
+    gl_Position = u_projection * u_view * u_model * vec4(position, 1.0f);
 }
 
 #pragma fragment
@@ -4,6 +4,9 @@ layout (location = 0) in vec3 a_pos;
 layout (location = 1) in vec3 a_normal;
 layout (location = 2) in vec2 a_texCoord;
 layout (location = 3) in vec3 a_tangent;
+// heightfield modes: first cell and level of the patch, and distances over which it morphs into the next level
+layout (location = 4) in uvec3 a_patch;
+layout (location = 5) in vec2 a_morphRange;
 
 
 out Varyings {
@@ -16,20 +19,97 @@ out Varyings {
 
 uniform mat4 u_lightSpaceMatrix;
 
+// heightfield mode: the vertices have no attributes and are rebuilt from the height texture
+uniform bool u_isHeightfield;
+uniform sampler2D u_heightmap;
+uniform int u_mapWidth;
+uniform int u_mapDepth;
+uniform int u_patchSize;
+uniform float u_mapScale;
+uniform float u_textureScale;
+uniform int u_normalMode; // 0: 6 neighbours, 1: central difference
+uniform vec3 u_lodCameraPosition;
+
+float heightAt(int x, int z) {
+    return texelFetch(u_heightmap, ivec2(clamp(x, 0, u_mapWidth - 1), clamp(z, 0, u_mapDepth - 1)), 0).r;
+}
+
+vec3 cellPosition(vec2 cell, float height) {
+    vec2 uv = cell / vec2(u_mapWidth, u_mapDepth);
+    return vec3((uv.x * 2.f - 1.f) * u_mapScale, height, (uv.y * 2.f - 1.f) * u_mapScale);
+}
+
+/**
+    Finds the cells in the heightmap of the current vertex of the grid patch of the instance.
+    The odd vertices slide onto their even neighbour as the distance to the camera goes
+    through the morph range, so the patch matches the next level where they meet
+    @param cell receives the cell of the vertex at the level of the patch
+    @param coarseCell receives the cell of the vertex at the next level
+    @return 0: vertex at the level of the patch, 1: vertex at the next level
+*/
+float heightfieldCells(out ivec2 cell, out ivec2 coarseCell) {
+    ivec2 local = ivec2(gl_VertexID % (u_patchSize + 1), gl_VertexID / (u_patchSize + 1));
+    int spacing = 1 << a_patch.z;
+    // the vertices past the end of the map collapse on the border into empty triangles
+    ivec2 lastCell = ivec2(u_mapWidth - 1, u_mapDepth - 1);
+    cell = min(ivec2(a_patch.xy) + local * spacing, lastCell);
+    coarseCell = min(ivec2(a_patch.xy) + (local & ~1) * spacing, lastCell);
+
+    vec3 worldPosition = vec3(u_model * vec4(cellPosition(vec2(cell), heightAt(cell.x, cell.y)), 1.f));
+    float distance = length(worldPosition - u_lodCameraPosition);
+    return clamp((distance - a_morphRange.x) / max(a_morphRange.y - a_morphRange.x, 1e-6f), 0.f, 1.f);
+}
+
+/**
+    Same normals as TerrainRenderer
+*/
+vec3 heightfieldNormal(ivec2 cell) {
+    int x = cell.x;
+    int z = cell.y;
+    if (u_normalMode == 1) {
+        return normalize(vec3(heightAt(x - 1, z) - heightAt(x + 1, z), 2.f, heightAt(x, z - 1) - heightAt(x, z + 1)));
+    }
+
+    float hR = heightAt(x + 1, z);
+    float hUR = heightAt(x + 1, z + 1);
+    float hU = heightAt(x, z - 1);
+    float hL = heightAt(x - 1, z);
+    float hDL = heightAt(x - 1, z - 1);
+    float hD = heightAt(x, z + 1);
+    return normalize(vec3(hDL + hD - hUR - hU, 2.f, hUR - hR + 2.f * hU + hL - hDL - 2.f * hD));
+}
+
 void main() {
-    vary.fragPos = vec3(u_model * vec4(a_pos, 1.f));
-    vary.normal = mat3(transpose(inverse(u_model))) * a_normal;
-    vary.uvCoord = a_texCoord;
+    vec3 position = a_pos;
+    vec3 normal = a_normal;
+    vec2 texCoord = a_texCoord;
+    vec3 tangent = a_tangent;
+
+    if (u_isHeightfield) {
+        ivec2 cell;
+        ivec2 coarseCell;
+        float morph = heightfieldCells(cell, coarseCell);
+        vec2 morphedCell = mix(vec2(cell), vec2(coarseCell), morph);
+
+        position = cellPosition(morphedCell, mix(heightAt(cell.x, cell.y), heightAt(coarseCell.x, coarseCell.y), morph));
+        normal = normalize(mix(heightfieldNormal(cell), heightfieldNormal(coarseCell), morph));
+        texCoord = u_textureScale * morphedCell / vec2(u_mapWidth, u_mapDepth);
+        tangent = vec3(1.f, cell.x >= u_mapWidth - 1 ? 0.f : heightAt(cell.x + 1, cell.y), 0.f);
+    }
+
+    vary.fragPos = vec3(u_model * vec4(position, 1.f));
+    vary.normal = mat3(transpose(inverse(u_model))) * normal;
+    vary.uvCoord = texCoord;
     vary.fragPosLightSpace = u_lightSpaceMatrix * vec4(vary.fragPos, 1.f);
 
-    vec3 N = normalize(mat3(u_model) * a_normal);
-    vec3 T = normalize(mat3(u_model) * a_tangent);
+    vec3 N = normalize(mat3(u_model) * normal);
+    vec3 T = normalize(mat3(u_model) * tangent);
     T = normalize(T - dot(T, N) * N);
     vec3 B = normalize(cross(N, T));
     vary.TBN = mat3(T, B, N);
 
 
-    gl_Position = u_projection * u_view * u_model * vec4(a_pos, 1.0f);
+    gl_Position = u_projection * u_view * u_model * vec4(position, 1.0f);
 }
 
 // ================================
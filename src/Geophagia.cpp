@@ -20,6 +20,16 @@ void Geophagia::uiRender() {
     ImGui::Begin("Renderer");
 
         ImGui::Text("last frame: %.3f ms, fps: %.3f", 1000.f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+        ImGui::Text(
+            "terrain chunks: %u drawn, %u culled, %.2fM triangles",
+            _terrainCulling.drawn, _terrainCulling.culled, static_cast<f32>(_terrainCulling.triangles) * 1e-6f
+        );
+        if (_isShadowEnabled) {
+            ImGui::Text(
+                "shadow map chunks: %u drawn, %u culled, %.2fM triangles",
+                _shadowCulling.drawn, _shadowCulling.culled, static_cast<f32>(_shadowCulling.triangles) * 1e-6f
+            );
+        }
         ImGui::Separator();
 
         ImGui::Text("OpenGL info:");
@@ -72,12 +82,24 @@ void Geophagia::renderDockSpace() {
                     if (ImGui::MenuItem("Raw Heightmap")) {
                         Necrosis::Window::saveFileDialog([this](std::string path) {
                             if (path == "") { return; }
-                            if (!_terrain.saveAsRaw(path)) {
+                            _terrain.requestRawSave(path);
+                        }, {{"Raw Heightmap", ".raw"}});
+                    }
+                    if (ImGui::MenuItem("Tiled Heightmap")) {
+                        Necrosis::Window::saveFileDialog([this](std::string path) {
+                            if (path == "") { return; }
+                            _terrain.requestTiledSave(path);
+                        }, {{"Tiled Heightmap", ".gthm"}});
+                    }
+                    if (ImGui::MenuItem("PFM")) {
+                        Necrosis::Window::saveFileDialog([this](std::string path) {
+                            if (path == "") { return; }
+                            if (!_terrain.saveAsPfm(path)) {
                                 std::string msg = std::format("Failed to write to file '{}'", path);
                                 slog::warning(msg);
                                 Necrosis::Window::showWarningMessageBox(msg);
                             }
-                        }, {{"Raw Heightmap", ".raw"}});
+                        }, {{"Portable Float Map", ".pfm"}});
                     }
                     ImGui::EndMenu();
                 }
@@ -102,7 +124,8 @@ void Geophagia::renderDockSpace() {
 Geophagia::Geophagia()
         : Necrosis::Engine({ .windowTitle = "Geophagia", .windowWidth = 1600, .windowHeight = 900 })
         , _camera(glm::vec3(10.f, 50.f, 25.f)), _lightPosition(0.4f, 0.4f, 0.5f)
-        ,_isFramebufferHovered(false) , _isShadowEnabled(true), _isBoxMappingEnabled(false) {
+        ,_isFramebufferHovered(false) , _isShadowEnabled(true), _isBoxMappingEnabled(false)
+        , _terrain(getTaskScheduler()) {
 
     _camera.movementSpeed = 0.05f;
     _camera.near = 1.f;
@@ -155,9 +178,9 @@ Geophagia::Geophagia()
 
     // _terrain.setTexture(texture);
 
-    _voronoiGenerator = std::make_unique<VoronoiGenerator>(&_terrain);
-    _fractalGenerator = std::make_unique<FractalGenerator>(&_terrain);
-    _erosionGenerator = std::make_unique<ErosionGenerator>(&_terrain);
+    _voronoiGenerator = std::make_unique<VoronoiGenerator>(&_terrain, getTaskScheduler());
+    _fractalGenerator = std::make_unique<FractalGenerator>(&_terrain, getTaskScheduler());
+    _erosionGenerator = std::make_unique<ErosionGenerator>(&_terrain, getTaskScheduler());
 }
 
 void Geophagia::run() {
@@ -166,6 +189,11 @@ void Geophagia::run() {
 
         startGuiFrame();
 
+        // the detail levels are chosen from the camera for both passes
+        _terrain.setLodCamera(
+            _camera.position, _camera.getProjMatrix()[1][1] * 0.5f * static_cast<f32>(_framebuffer->getHeight())
+        );
+
         if (_isShadowEnabled)
             _shadowMapPass();
 
@@ -233,8 +261,9 @@ void Geophagia::_shadowMapPass() {
     _shadowMapShader->setUniform("u_projection", proj);
     _shadowMapShader->setUniform("u_view", view);
     _shadowMapShader->setUniform("u_model", _terrain.getModelMatrix());
+    _terrain.setShaderUniforms(*_shadowMapShader);
 
-    _terrain.render();
+    _shadowCulling = _terrain.render(proj * view * _terrain.getModelMatrix());
 
     _shadowMapFramebuffer->unbind();
 }
@@ -266,6 +295,7 @@ void Geophagia::_terrainPass() {
     _terrainShader->setUniform("u_isShadowEnabled", _isShadowEnabled);
     _terrainShader->setUniform("u_isBoxMappingEnabled", _isBoxMappingEnabled);
     _terrainShader->setUniform("u_verticalScale", _terrain.getVerticalScale());
+    _terrain.setShaderUniforms(*_terrainShader);
 
     _terrainShader->setUniform("u_grass", 0);
     _terrainShader->setUniform("u_rock", 1);
@@ -278,7 +308,7 @@ void Geophagia::_terrainPass() {
     _terrainShader->setUniform("u_shadowMap", 6);
     _shadowMapFramebuffer->bindTexture(6);
 
-    _terrain.render();
+    _terrainCulling = _terrain.render(_camera.getProjMatrix() * _camera.getViewMatrix() * _terrain.getModelMatrix());
     _framebuffer->unbind();
 }
 
@@ -303,7 +333,9 @@ void Geophagia::_guiPass() {
     _terrain.uiRender();
 
     _voronoiGenerator->uiRender();
+    _voronoiGenerator->update();
     _fractalGenerator->uiRender();
+    _fractalGenerator->update();
     _erosionGenerator->uiRender();
     _erosionGenerator->update();
 }
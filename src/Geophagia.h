@@ -42,6 +42,8 @@ private:
     std::unique_ptr<Necrosis::Framebuffer> _shadowMapFramebuffer;
 
     Terrain _terrain;
+    TerrainRenderer::CullingStats _terrainCulling; ///< @brief Chunks drawn by the last terrain pass
+    TerrainRenderer::CullingStats _shadowCulling; ///< @brief Chunks drawn by the last shadow map pass
     std::unique_ptr<VoronoiGenerator> _voronoiGenerator;
     std::unique_ptr<FractalGenerator> _fractalGenerator;
     std::unique_ptr<ErosionGenerator> _erosionGenerator;
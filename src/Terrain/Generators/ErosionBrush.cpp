@@ -0,0 +1,97 @@
+#include "ErosionBrush.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Geophagia {
+
+void ErosionBrush::build(u32 width, u32 depth, i32 radius) {
+    expect(radius > 0, "The erosion radius must be positive");
+
+    _width = width;
+    _depth = depth;
+    _radius = static_cast<u32>(radius);
+
+    _offsets.clear();
+    _weights.clear();
+    _rowSlots.assign(depth, 0);
+    _borderStart.clear();
+    _borderIndices.clear();
+    _borderWeights.clear();
+
+    // neighbours of the cell (cx, cy) inside the disk and the map, with their unnormalized weights
+    std::vector<i32> xOffsets;
+    std::vector<i32> yOffsets;
+    std::vector<f32> weights;
+    auto gather = [&](u32 cx, u32 cy, u32 mapWidth, u32 mapDepth) -> f32 {
+        xOffsets.clear();
+        yOffsets.clear();
+        weights.clear();
+        f32 weightSum = 0.f;
+
+        // for all the cell in the square 2radius * 2radius
+        for (i32 y = -radius; y <= radius; y++) {
+            for (i32 x = -radius; x <= radius; x++) {
+                const i32 sqDist = x*x + y*y;
+
+                // if in the circle
+                if (sqDist < radius * radius) {
+                    const u32 weightXPos = cx + x;
+                    const u32 weightYPos = cy + y;
+
+                    // negative positions wrap around and are rejected too
+                    if (weightXPos < mapWidth && weightYPos < mapDepth) {
+                        const f32 weight = std::max(0.f, radius - std::sqrt(static_cast<f32>(sqDist)));
+                        weightSum += weight;
+                        weights.push_back(weight);
+                        xOffsets.push_back(x);
+                        yOffsets.push_back(y);
+                    }
+                }
+            }
+        }
+        return weightSum;
+    };
+
+    // interior stencil, computed on a map just large enough for the disk to fit
+    {
+        const f32 weightSum = gather(_radius, _radius, 2 * _radius + 1, 2 * _radius + 1);
+        for (size_t j = 0; j < weights.size(); j++) {
+            _offsets.push_back(yOffsets[j] * static_cast<i32>(width) + xOffsets[j]);
+            _weights.push_back(weights[j] / weightSum);
+        }
+    }
+
+    // border cells, stored row after row from left to right
+    _borderStart.push_back(0);
+    for (u32 cy = 0; cy < depth; cy++) {
+        _rowSlots[cy] = static_cast<u32>(_borderStart.size() - 1);
+
+        for (u32 cx = 0; cx < width; cx++) {
+            if (!_isBorder(cx, cy)) {
+                continue;
+            }
+
+            const f32 weightSum = gather(cx, cy, width, depth);
+            for (size_t j = 0; j < weights.size(); j++) {
+                _borderIndices.push_back((yOffsets[j] + cy) * width + xOffsets[j] + cx);
+                _borderWeights.push_back(weights[j] / weightSum);
+            }
+            _borderStart.push_back(static_cast<u32>(_borderIndices.size()));
+        }
+    }
+
+    for (const f32 weight : _weights) {
+        expect(weight > 0.f && weight <= 1.f);
+    }
+    for (const f32 weight : _borderWeights) {
+        expect(weight > 0.f && weight <= 1.f);
+    }
+}
+
+size_t ErosionBrush::getMemoryUsage() const {
+    return _offsets.size() * sizeof(i32) + _weights.size() * sizeof(f32)
+        + (_rowSlots.size() + _borderStart.size() + _borderIndices.size()) * sizeof(u32)
+        + _borderWeights.size() * sizeof(f32);
+}
+}
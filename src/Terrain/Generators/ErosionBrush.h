@@ -0,0 +1,88 @@
+#pragma once
+
+#include <Common.h>
+
+#include <vector>
+
+namespace Geophagia {
+/**
+ * @brief Cells eroded by a droplet and how much each of them gives
+ *
+ * Every cell far enough from the border of the map shares the same disk shaped stencil,
+ * stored once as index offsets and weights. Only the cells closer than the radius to the
+ * border have their own clipped and renormalized brush, stored in a compressed sparse row table.
+ */
+class ErosionBrush {
+public:
+    ErosionBrush() = default;
+
+    /**
+     * @brief Builds the brushes of a `width` x `depth` map
+     * @param radius Radius of the disk. Only the cells strictly inside it are eroded
+     */
+    void build(u32 width, u32 depth, i32 radius);
+
+    /**
+     * @brief Calls `function(index, weight)` for every cell eroded from (x, y),
+     * in the same order for the interior and the border cells
+     */
+    template <typename Function>
+    void forEach(u32 x, u32 y, Function &&function) const {
+        const u32 cell = y * _width + x;
+
+        if (!_isBorder(x, y)) {
+            for (size_t i = 0; i < _offsets.size(); i++) {
+                function(static_cast<u32>(static_cast<i64>(cell) + _offsets[i]), _weights[i]);
+            }
+            return;
+        }
+
+        const u32 slot = _borderSlot(x, y);
+        for (u32 i = _borderStart[slot]; i < _borderStart[slot + 1]; i++) {
+            function(_borderIndices[i], _borderWeights[i]);
+        }
+    }
+
+    /**
+     * @brief Memory used by the brushes in bytes
+     */
+    [[nodiscard]]
+    size_t getMemoryUsage() const;
+
+private:
+    u32 _width = 0;
+    u32 _depth = 0;
+    u32 _radius = 0;
+
+    // interior stencil
+    std::vector<i32> _offsets; ///< @brief Offsets from the index of the droplet's cell
+    std::vector<f32> _weights;
+
+    // border cells
+    /**
+     * @brief Slot of the first border cell of every row. Rows closer than the radius to the
+     * top or bottom are entirely made of border cells, the others only have `radius` cells on each side
+     */
+    std::vector<u32> _rowSlots;
+    std::vector<u32> _borderStart; ///< @brief Range of every slot in the flat arrays, with one extra end entry
+    std::vector<u32> _borderIndices;
+    std::vector<f32> _borderWeights;
+
+    [[nodiscard]]
+    bool _isFullBorderRow(u32 y) const {
+        return y < _radius || y + _radius > _depth - 1 || 2 * _radius >= _width;
+    }
+    [[nodiscard]]
+    bool _isBorder(u32 x, u32 y) const {
+        return x < _radius || x + _radius > _width - 1 || _isFullBorderRow(y);
+    }
+    [[nodiscard]]
+    u32 _borderSlot(u32 x, u32 y) const {
+        if (_isFullBorderRow(y) || x < _radius) {
+            return _rowSlots[y] + x;
+        }
+        // right side of the row, after the `radius` cells of the left side
+        return _rowSlots[y] + _radius + (x - (_width - _radius));
+    }
+};
+}
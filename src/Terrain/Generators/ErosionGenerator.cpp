@@ -1,86 +1,245 @@
 #include "ErosionGenerator.h"
 
+#include <algorithm>
 #include <random>
 
 #include <imgui/imgui.h>
 
+#include "../../Utils/AllocationCounter.h"
+
 namespace Geophagia {
 
 using namespace std::chrono_literals;
 
-ErosionGenerator::ErosionGenerator(Terrain *terrain) : HeightmapGenerator(terrain), _isSimulationRunning(false), _updateFlag(false) {
+ErosionGenerator::ErosionGenerator(Terrain *terrain, Necrosis::TaskScheduler &taskScheduler)
+    : HeightmapGenerator(terrain, taskScheduler) {
     _init();
 }
 
+ErosionGenerator::~ErosionGenerator() {
+    // the simulation uses the generator
+    _simulationJob.cancel();
+    _simulationJob.wait();
+}
+
 void ErosionGenerator::uiRender() {
     ImGui::Begin("Erosion Simulator");
+        // the parameters are read by the simulation running in the background
+        const bool isProcessing = _simulationJob.isRunning();
+        ImGui::BeginDisabled(isProcessing);
         ImGui::InputScalar("Seed", ImGuiDataType_U64, &_seed);
-        // ImGui::SliderFloat("Time step", &_deltaTime, 0.0001f, 0.01f);
-        // ImGui::SliderFloat("Rain intensity", &_rainIntensity, 0.001f, 0.5f);
+
+        const char *erosionModes[] = { "Droplets", "Hydraulic (pipe model)" };
+        int erosionMode = static_cast<int>(_erosionMode);
+        if (ImGui::Combo("Erosion mode", &erosionMode, erosionModes, IM_ARRAYSIZE(erosionModes))) {
+            _erosionMode = static_cast<ErosionMode>(erosionMode);
+        }
+
+        if (_erosionMode == ErosionMode::Hydraulic) {
+            ImGui::SliderFloat("Time step", &_deltaTime, 0.0001f, 0.01f);
+            // ImGui::SliderFloat("Rain intensity", &_rainIntensity, 0.001f, 0.5f);
+        }
         ImGui::SliderFloat("Sediment capacity", &_sedimentCapacity, 0.1f, 3.f);
         ImGui::SliderFloat("Erosion constant", &_erosionConstant, 0.1f, 1.f);
         ImGui::SliderFloat("Deposition constant", &_depositionConstant, 0.1f, 1.f);
         ImGui::SliderFloat("Evaporation constant", &_evaporationConstant, 0.001f, 0.5f);
         ImGui::SliderFloat("Flow inertia", &_flowInertia, 0.001f, 1.f);
-        ImGui::SliderInt("Erosion radius", &_erosionRadius, 1, 20);
 
-        bool isProcessing = _isSimulationRunning;
-        if (isProcessing) {
-            ImGui::BeginDisabled();
+        if (_erosionMode == ErosionMode::Droplets) {
+            ImGui::SliderInt("Erosion radius", &_erosionRadius, 1, 20);
+            ImGui::InputScalar("Droplets", ImGuiDataType_U32, &_numDroplets);
+
+            const char *modes[] = { "Serial", "Parallel" };
+            int mode = static_cast<int>(_dropletMode);
+            if (ImGui::Combo("Droplet mode", &mode, modes, IM_ARRAYSIZE(modes))) {
+                _dropletMode = static_cast<DropletMode>(mode);
+            }
         }
+
+        ImGui::SliderFloat("Preview interval (ms)", &_previewInterval, 16.f, 2000.f);
+
         if (ImGui::Button("Run The Simulation")) {
             generateHeightmap();
         }
-        if (isProcessing) {
-            ImGui::EndDisabled();
-        }
+        ImGui::EndDisabled();
 
         ImGui::SameLine();
 
-        if (!isProcessing) {
-            ImGui::BeginDisabled();
-        }
+        ImGui::BeginDisabled(!isProcessing || _simulationJob.isCancelling());
         if (ImGui::Button("End The Simulation")) {
-            _isSimulationRunning = false;
+            _simulationJob.cancel();
+        }
+        ImGui::EndDisabled();
+
+        ImGui::BeginDisabled(isProcessing);
+        if (ImGui::Button("Benchmark droplets")) {
+            _init();
+            _isBenchmarkJob = true;
+            _simulationJob.start(*_taskScheduler, 2 * static_cast<u64>(_numDroplets), [this](JobContext &context) {
+                _runBenchmark(context);
+            });
+        }
+        ImGui::EndDisabled();
+        if (isProcessing && _uiJobProgress(_simulationJob.getProgress(), _simulationJob.isCancelling())) {
+            _simulationJob.cancel();
+        }
+
+        ImGui::Separator();
+        if (_erosionMode == ErosionMode::Hydraulic) {
+            // the heightmap is given to the terrain at the end, the state keeps the size
+            const f32 cells = static_cast<f32>(_state.water.size());
+            ImGui::Text("Simulation: %.1f steps/s", _stepsPerSecond.load());
+            ImGui::Text(
+                "Flow:      %7.3f ms/step  %5.1f GB/s", _stepTimings.flow.load(),
+                _stepTimings.bandwidth(StepTimings::FLOW_BYTES_PER_CELL * cells, _stepTimings.flow)
+            );
+            ImGui::Text(
+                "Erosion:   %7.3f ms/step  %5.1f GB/s", _stepTimings.erosion.load(),
+                _stepTimings.bandwidth(StepTimings::EROSION_BYTES_PER_CELL * cells, _stepTimings.erosion)
+            );
+            ImGui::Text(
+                "Transport: %7.3f ms/step  %5.1f GB/s", _stepTimings.transport.load(),
+                _stepTimings.bandwidth(StepTimings::TRANSPORT_BYTES_PER_CELL * cells, _stepTimings.transport)
+            );
+            if constexpr (AllocationCounter::isEnabled()) {
+                ImGui::Text("Allocations: %llu per step", static_cast<unsigned long long>(_stepAllocations.load()));
+            }
         }
-        if (!isProcessing) {
-            ImGui::EndDisabled();
+        else {
+            ImGui::Text("Last simulation: %.0f droplets/s", _dropletsPerSecond.load());
+        }
+        if (_serialBenchmark > 0.f) {
+            ImGui::Text(
+                "Benchmark: serial %.0f droplets/s | parallel %.0f droplets/s (%u threads)",
+                _serialBenchmark.load(), _parallelBenchmark.load(), _taskScheduler->getThreadCount()
+            );
         }
 
     ImGui::End();
 }
 
-void ErosionGenerator::_applyRainfall(float dt) {
+/**
+ * @brief Elapsed milliseconds since `start`. `start` is reset to now
+ */
+inline f32 lapMilliseconds(std::chrono::steady_clock::time_point &start) {
+    const auto now = std::chrono::steady_clock::now();
+    const std::chrono::duration<f32, std::milli> elapsed = now - start;
+    start = now;
+    return elapsed.count();
+}
+
+/**
+ * @brief Exponential moving average used to smooth the timings shown in the ui
+ */
+inline void accumulateTiming(std::atomic<f32> &average, f32 sample) {
+    average = average.load(std::memory_order_relaxed) * 0.9f + sample * 0.1f;
+}
+
+void ErosionGenerator::_simulationStep(float dt, const std::stop_token &stopToken) {
+    const u32 width = _terrain->getWidth();
+    const u32 depth = _terrain->getDepth();
+
+    // the map is split in bands of consecutive rows, a few per thread to balance the load
+    const u32 numBands = std::min(depth, 4 * _taskScheduler->getThreadCount());
+    auto bandBegin = [&](u32 band) { return static_cast<u32>(static_cast<u64>(band) * depth / numBands); };
+
+    auto timer = std::chrono::steady_clock::now();
+
+    // pass 1: flux and water update fused.
+    // The water of a row needs the flux of the rows around it, so it is updated one row
+    // behind the flux. The first and last rows of a band need the flux of the neighbouring
+    // bands and the flux of these bands needs their old water level, so they are done
+    // once all the fluxes are known.
+    _taskScheduler->parallelFor(numBands, [&](u32 band) {
+        const u32 begin = bandBegin(band);
+        const u32 end = bandBegin(band + 1);
+        for (u32 y = begin; y < end; y++) {
+            _computeFlux(dt, y);
+            if (y >= begin + 2) {
+                _computeWater(dt, y - 1);
+            }
+        }
+    }, stopToken);
+    _taskScheduler->parallelFor(numBands, [&](u32 band) {
+        const u32 begin = bandBegin(band);
+        const u32 end = bandBegin(band + 1);
+        _computeWater(dt, begin);
+        if (end - 1 > begin) {
+            _computeWater(dt, end - 1);
+        }
+    }, stopToken);
+    // these passes only changed the state, the heights stay those of the last whole step
+    if (stopToken.stop_requested()) { return; }
+    accumulateTiming(_stepTimings.flow, lapMilliseconds(timer));
+
+    // pass 2: erosion and deposition.
+    // The slope reads the heights around the cell, so the new heights are applied in the next pass
+    _taskScheduler->parallelFor(numBands, [&](u32 band) {
+        for (u32 y = bandBegin(band); y < bandBegin(band + 1); y++) {
+            _computeErosionDeposition(y);
+        }
+    }, stopToken);
+    if (stopToken.stop_requested()) { return; }
+    accumulateTiming(_stepTimings.erosion, lapMilliseconds(timer));
+
+    // pass 3: new heights, sediment transport, evaporation and the rain of the next step.
+    // These only write to the cell they process
+    _taskScheduler->parallelFor(numBands, [&](u32 band) {
+        for (u32 y = bandBegin(band); y < bandBegin(band + 1); y++) {
+            f32 *__restrict height = _heightmap.data() + y * width;
+            const f32 *__restrict delta = _state.heightDelta.data() + y * width;
+            for (u32 x = 0; x < width; x++) {
+                height[x] += delta[x];
+            }
+            _transportSediment(dt, y);
+            _applyEvaporation(dt, y);
+            _applyRainfall(dt, y);
+        }
+    });
+
+    // Update the sediment buffer
+    _state.swapSediment();
+    accumulateTiming(_stepTimings.transport, lapMilliseconds(timer));
+}
+
+void ErosionGenerator::_applyRainfall(float dt, u32 y) {
     // float rainIntensity = 1.f; // param
-    std::mt19937 mt(_seed);
-    std::normal_distribution<float> dist(0.02f, .01f);
-    auto rng = std::bind(dist, mt);
+    // std::mt19937 mt(_seed);
+    // std::normal_distribution<float> dist(0.02f, .01f);
+    // auto rng = std::bind(dist, mt);
 
     // rain
-    // for (size_t i = 0; i < _waterHeight.size(); i++) {
+    // for (size_t i = 0; i < _state.water.size(); i++) {
     //     float rt = std::max(0.f, rng());
     //
-    //     _waterHeight[i] += dt * rt * _rainIntensity;
+    //     _state.water[i] += dt * rt * _rainIntensity;
     // }
 
-    auto distance = [this](float x, float y) {
+    auto distance = [](float x, float y) {
         return std::sqrt((100-x)*(100-x) + (100-y)*(100-y));
     };
 
+    const u32 width = _terrain->getWidth();
+    const u32 depth = _terrain->getDepth();
+    if (y < 50 || y + 50 >= depth || width <= 100) {
+        return;
+    }
+
     // constant water source
-    for (int y = 50; y < _terrain->getDepth() - 50; y++) {
-        for (int x = 50; x < _terrain->getWidth() - 50; x++) {
-            if (distance(x, y) < 15.f) {
-                // if (distance(x, y) > 0.001f)
-                //     _waterHeight[y * _terrain->getWidth() + x] += dt * 1.f / distance(x, y);
-                // else
-                    _waterHeight[y * _terrain->getWidth() + x] = dt * 1.f;
-            }
+    for (u32 x = 50; x < width - 50; x++) {
+        if (distance(x, y) < 15.f) {
+            // if (distance(x, y) > 0.001f)
+            //     _state.water[y * width + x] += dt * 1.f / distance(x, y);
+            // else
+                _state.water[y * width + x] = dt * 1.f;
         }
     }
 }
 
-void ErosionGenerator::_computeFlow(float dt) {
+// The kernels below handle the cells on the border of the map separately so
+// the loops over the inner cells are branch free and can be vectorized
+
+void ErosionGenerator::_computeFlux(float dt, u32 y) {
     const float PIPE_AREA = 1.f;
     const float GRAVITY = 9.81f;
     const float PIPE_LENGTH = 1.f;
@@ -89,139 +248,169 @@ void ErosionGenerator::_computeFlow(float dt) {
     const u32 width = _terrain->getWidth();
     const u32 depth = _terrain->getDepth();
 
-    for (u32 y = 0; y < depth; y++) {
+    const f32 *__restrict height = _heightmap.data();
+    const f32 *__restrict water = _state.water.data();
+    f32 *__restrict fluxL = _state.fluxLeft.data();
+    f32 *__restrict fluxR = _state.fluxRight.data();
+    f32 *__restrict fluxT = _state.fluxTop.data();
+    f32 *__restrict fluxB = _state.fluxBottom.data();
+
+    auto H = [=](u32 j) { return height[j] + water[j]; };
+
+    auto update = [=](u32 i, f32 hL, f32 hR, f32 hT, f32 hB) {
+        // Δh of neighbour = h of current vertex - h of neighbour
+        const f32 currentH = H(i);
+
+        // update Fluxes
+        const f32 l = std::max(0.f, fluxL[i] + factor * (currentH - hL));
+        const f32 r = std::max(0.f, fluxR[i] + factor * (currentH - hR));
+        const f32 t = std::max(0.f, fluxT[i] + factor * (currentH - hT));
+        const f32 b = std::max(0.f, fluxB[i] + factor * (currentH - hB));
+
+        // scaling factor (K) to prevent over-draining.
+        // When the sum is 0 all the fluxes are 0 too, so K can be applied anyway
+        const f32 sumFlux = l + r + t + b;
+        const f32 K = std::min(1.f, water[i] / std::max(sumFlux * dt, std::numeric_limits<f32>::min()));
+
+        fluxL[i] = l * K;
+        fluxR[i] = r * K;
+        fluxT[i] = t * K;
+        fluxB[i] = b * K;
+    };
+    // h for neighbours
+    // if neighbour on the edge, drain the water
+    auto updateBorder = [&](u32 x) {
+        const u32 i = y * width + x;
+        update(i,
+            (x > 0) ? H(i - 1) : 0.f,
+            (x < width - 1) ? H(i + 1) : 0.f,
+            (y < depth - 1) ? H(i + width) : 0.f,
+            (y > 0) ? H(i - width) : 0.f
+        );
+    };
+
+    if (y == 0 || y == depth - 1 || width < 3) {
         for (u32 x = 0; x < width; x++) {
-            const u32 i = y * width + x;
-            // Δh of neighbour = h of current vertex - h of neighbour
-            const float currentH = _heightmap[i] + _waterHeight[i];
-
-            // h for neighbours
-            // if neighbour on the edge, drain the water
-            // else, calculate like previously
-            const float hL = (x > 0) ? (_heightmap[i - 1] + _waterHeight[i - 1]) : 0.f;
-            const float hR = (x < width - 1) ? (_heightmap[i + 1] + _waterHeight[i + 1]) : 0.f;
-            const float hT = (y < depth - 1) ? (_heightmap[i + width] + _waterHeight[i + width]) : 0.f;
-            const float hB = (y > 0) ? (_heightmap[i - width] + _waterHeight[i - width]) : 0.f;
-
-            // update Fluxes
-            _outflowFlux[i].x = std::max(0.f, _outflowFlux[i].x + factor * (currentH - hL));
-            _outflowFlux[i].y = std::max(0.f, _outflowFlux[i].y + factor * (currentH - hR));
-            _outflowFlux[i].z = std::max(0.f, _outflowFlux[i].z + factor * (currentH - hT));
-            _outflowFlux[i].w = std::max(0.f, _outflowFlux[i].w + factor * (currentH - hB));
-
-            // scaling factor (K) to prevent over-draining
-            const float sumFlux = _outflowFlux[i].x + _outflowFlux[i].y + _outflowFlux[i].z + _outflowFlux[i].w;
-            if (sumFlux > 0) {
-                const float K = std::min(1.f, _waterHeight[i] / (sumFlux * dt));
-                _outflowFlux[i] *= K;
-            }
+            updateBorder(x);
         }
+        return;
     }
 
-    // calculate the new water levels
-    for (u32 y = 0; y < depth; y++) {
-        for (u32 x = 0; x < width; x++) {
-            const u32 i = y * width + x;
-
-            const float flowL = (x > 0) ? _outflowFlux[i - 1].y : 0.f;
-            const float flowR = (x < width - 1) ? _outflowFlux[i + 1].x : 0.f;
-            const float flowT = (y < depth - 1) ? _outflowFlux[i + width].w : 0.f;
-            const float flowB = (y > 0) ? _outflowFlux[i - width].z : 0.f;
-
-            const float newWaterHeight = _waterHeight[i] + dt * (
-                flowL + flowR + flowT + flowB -
-                (_outflowFlux[i].x + _outflowFlux[i].y + _outflowFlux[i].z + _outflowFlux[i].w)
-            ) / (PIPE_LENGTH * PIPE_LENGTH);
-
-            const float deltaX = ((flowL - _outflowFlux[i].x) + (_outflowFlux[i].y - flowR)) * 0.5f;
-            const float deltaY = ((flowB - _outflowFlux[i].w) + (_outflowFlux[i].z - flowT)) * 0.5f;
-
-            const float avgWater = (_waterHeight[i] + newWaterHeight) * 0.5f;
-
-            _velocity[i].x = deltaX / (PIPE_LENGTH * (avgWater + 0.001f));
-            _velocity[i].y = deltaY / (PIPE_LENGTH * (avgWater + 0.001f));
-
-            _waterHeight[i] = newWaterHeight;
-        }
+    updateBorder(0);
+    GEOPHAGIA_IVDEP
+    for (u32 i = y * width + 1; i < (y + 1) * width - 1; i++) {
+        update(i, H(i - 1), H(i + 1), H(i + width), H(i - width));
     }
+    updateBorder(width - 1);
 }
 
-void ErosionGenerator::_computeErosionDeposition(float dt) {
+void ErosionGenerator::_computeWater(float dt, u32 y) {
+    const float PIPE_LENGTH = 1.f;
+
     const u32 width = _terrain->getWidth();
     const u32 depth = _terrain->getDepth();
-    const float PIPE_LENGTH = 1.f;
 
-    std::vector<float> heightDelta(_heightmap.size(), 0.0f);
-    std::vector<float> sedimentDelta(_heightmap.size(), 0.0f);
+    f32 *__restrict water = _state.water.data();
+    const f32 *__restrict fluxL = _state.fluxLeft.data();
+    const f32 *__restrict fluxR = _state.fluxRight.data();
+    const f32 *__restrict fluxT = _state.fluxTop.data();
+    const f32 *__restrict fluxB = _state.fluxBottom.data();
+    f32 *__restrict velocityX = _state.velocityX.data();
+    f32 *__restrict velocityY = _state.velocityY.data();
 
-    auto H = [&](int j) {
-        return _heightmap[j] + _waterHeight[j];
-    };
+    // calculate the new water levels from the flows coming from the neighbours
+    auto update = [=](u32 i, f32 flowL, f32 flowR, f32 flowT, f32 flowB) {
+        const f32 newWaterHeight = water[i] + dt * (
+            flowL + flowR + flowT + flowB -
+            (fluxL[i] + fluxR[i] + fluxT[i] + fluxB[i])
+        ) / (PIPE_LENGTH * PIPE_LENGTH);
 
-    for (u32 y = 1; y < depth - 1; y++) {
-        for (u32 x = 1; x < width - 1; x++) {
-            u32 i = y * width + x;
-
-            // calculate local slope (alpha)
-            // we use the central difference to find the gradient
-            float dhdx = (H(i+1) - H(i-1)) / (2.0f * PIPE_LENGTH);
-            float dhdy = (H(i+width) - H(i-width)) / (2.0f * PIPE_LENGTH);
-
-            // sin(alpha) is related to the magnitude of the gradient
-            // float sinAlpha = std::min(0.05f, std::sqrt(dhdx*dhdx + dhdy*dhdy));
-            float grad = std::sqrt(dhdx*dhdx + dhdy*dhdy);
-            float sinAlpha = grad / std::sqrt(1.f + grad * grad);
-            if (sinAlpha < 1e-4f) {
-                continue; // don't erode on flat terrain
-            }
+        const f32 deltaX = ((flowL - fluxL[i]) + (fluxR[i] - flowR)) * 0.5f;
+        const f32 deltaY = ((flowB - fluxB[i]) + (fluxT[i] - flowT)) * 0.5f;
 
-            // calculate transport capacity (C)
-            float velocityMag = glm::length(_velocity[i]);
-            if (velocityMag < 1e-5f) {
-                continue;
-            }
+        const f32 avgWater = (water[i] + newWaterHeight) * 0.5f;
 
-            float C = _sedimentCapacity * sinAlpha * velocityMag * _waterHeight[i];
+        velocityX[i] = deltaX / (PIPE_LENGTH * (avgWater + 0.001f));
+        velocityY[i] = deltaY / (PIPE_LENGTH * (avgWater + 0.001f));
 
-            float capacityDiff = C - _suspendedSedimentAmount[i];
-            float water = _waterHeight[i];
+        water[i] = newWaterHeight;
+    };
+    auto updateBorder = [&](u32 x) {
+        const u32 i = y * width + x;
+        update(i,
+            (x > 0) ? fluxR[i - 1] : 0.f,
+            (x < width - 1) ? fluxL[i + 1] : 0.f,
+            (y < depth - 1) ? fluxB[i + width] : 0.f,
+            (y > 0) ? fluxT[i - width] : 0.f
+        );
+    };
 
-            float amount = capacityDiff * water;// * dt;
+    if (y == 0 || y == depth - 1 || width < 3) {
+        for (u32 x = 0; x < width; x++) {
+            updateBorder(x);
+        }
+        return;
+    }
 
-            if (capacityDiff > 0.0f) {
-                // erosion
-                amount *= _erosionConstant;
-                amount = std::min(amount, _heightmap[i]);
-                heightDelta[i] -= amount;
-                sedimentDelta[i] += amount;
-            }
-            else {
-                // deposition
-                amount *= _depositionConstant;
-                amount = std::min(-amount, _suspendedSedimentAmount[i]);
-                heightDelta[i] += amount;
-                sedimentDelta[i] -= amount;
-            }
+    updateBorder(0);
+    GEOPHAGIA_IVDEP
+    for (u32 i = y * width + 1; i < (y + 1) * width - 1; i++) {
+        update(i, fluxR[i - 1], fluxL[i + 1], fluxB[i + width], fluxT[i - width]);
+    }
+    updateBorder(width - 1);
+}
 
-            // if (C > _suspendedSedimentAmount[i]) {
-            //     // erode terrain
-            //     float amount = _erosionConstant * (C - _suspendedSedimentAmount[i]);
-            //     amount = std::min(amount, _heightmap[i]);
-            //     _heightmap[i] = std::max(0.f, _heightmap[i] - amount);
-            //     _suspendedSedimentAmount[i] += amount;
-            // } else {
-            //     // deposit sediment
-            //     float amount = _depositionConstant * (_suspendedSedimentAmount[i] - C);
-            //     amount = std::min(amount, _suspendedSedimentAmount[i]);
-            //     _heightmap[i] += amount;
-            //     _suspendedSedimentAmount[i] -= amount;
-            // }
-        }
+void ErosionGenerator::_computeErosionDeposition(u32 y) {
+    const u32 width = _terrain->getWidth();
+    const u32 depth = _terrain->getDepth();
+    const float PIPE_LENGTH = 1.f;
+
+    if (y < 1 || y >= depth - 1) {
+        return;
     }
 
-    for (size_t i = 0; i < _heightmap.size(); i++) {
-        _heightmap[i] = _heightmap[i] + heightDelta[i];
-        _suspendedSedimentAmount[i] = _suspendedSedimentAmount[i] + sedimentDelta[i];
+    const f32 *__restrict height = _heightmap.data();
+    const f32 *__restrict water = _state.water.data();
+    const f32 *__restrict velocityX = _state.velocityX.data();
+    const f32 *__restrict velocityY = _state.velocityY.data();
+    f32 *__restrict sediment = _state.sediment.data();
+    f32 *__restrict delta = _state.heightDelta.data();
+
+    // members are copied in locals so they aren't reloaded after every store
+    const f32 sedimentCapacity = _sedimentCapacity;
+    const f32 erosionConstant = _erosionConstant;
+    const f32 depositionConstant = _depositionConstant;
+
+    auto H = [=](u32 j) { return height[j] + water[j]; };
+
+    GEOPHAGIA_IVDEP
+    for (u32 i = y * width + 1; i < (y + 1) * width - 1; i++) {
+        // calculate local slope (alpha)
+        // we use the central difference to find the gradient
+        const f32 dhdx = (H(i+1) - H(i-1)) / (2.0f * PIPE_LENGTH);
+        const f32 dhdy = (H(i+width) - H(i-width)) / (2.0f * PIPE_LENGTH);
+
+        // sin(alpha) is related to the magnitude of the gradient
+        const f32 grad = std::sqrt(dhdx*dhdx + dhdy*dhdy);
+        const f32 sinAlpha = grad / std::sqrt(1.f + grad * grad);
+
+        // calculate transport capacity (C)
+        const f32 velocityMag = std::sqrt(velocityX[i] * velocityX[i] + velocityY[i] * velocityY[i]);
+        const f32 C = sedimentCapacity * sinAlpha * velocityMag * water[i];
+
+        const f32 capacityDiff = C - sediment[i];
+        const f32 amount = capacityDiff * water[i];// * dt;
+
+        const f32 erosion = std::min(amount * erosionConstant, height[i]);
+        const f32 deposition = std::min(-(amount * depositionConstant), sediment[i]);
+
+        // don't erode on flat terrain or when the water doesn't move
+        const bool isActive = sinAlpha >= 1e-4f && velocityMag >= 1e-5f;
+        // the sediment of a cell is only read by the cell itself,
+        // so it can be updated in place
+        const f32 change = capacityDiff > 0.f ? -erosion : deposition;
+        delta[i] = isActive ? change : 0.f;
+        sediment[i] = isActive ? sediment[i] - change : sediment[i];
     }
 }
 
@@ -244,10 +433,10 @@ float ErosionGenerator::_sampleSediment(float x, float y) const {
     float dx = x - x0;
     float dy = y - y0;
 
-    float s00 = _suspendedSedimentAmount[y0 * width + x0];
-    float s10 = _suspendedSedimentAmount[y0 * width + x1];
-    float s01 = _suspendedSedimentAmount[y1 * width + x0];
-    float s11 = _suspendedSedimentAmount[y1 * width + x1];
+    float s00 = _state.sediment[y0 * width + x0];
+    float s10 = _state.sediment[y0 * width + x1];
+    float s01 = _state.sediment[y1 * width + x0];
+    float s11 = _state.sediment[y1 * width + x1];
 
     // Bilinear interpolation
     float row0 = lerp(s00, s10, dx);
@@ -256,43 +445,53 @@ float ErosionGenerator::_sampleSediment(float x, float y) const {
     return lerp(row0, row1, dy);
 }
 
-void ErosionGenerator::_transportSediment(float dt) {
+void ErosionGenerator::_transportSediment(float dt, u32 y) {
     const u32 width = _terrain->getWidth();
-    const u32 depth = _terrain->getDepth();
 
-    // We need a temporary buffer because advection is a global operation
-    std::vector<float> nextSediment(_suspendedSedimentAmount.size());
-
-    for (u32 y = 0; y < depth; y++) {
-        for (u32 x = 0; x < width; x++) {
-            u32 i = y * width + x;
+    const f32 *__restrict velocityX = _state.velocityX.data() + y * width;
+    const f32 *__restrict velocityY = _state.velocityY.data() + y * width;
+    f32 *__restrict next = _state.nextSediment.data() + y * width;
 
-            // Look back along the velocity vector
-            float srcX = (float)x - _velocity[i].x * dt;
-            float srcY = (float)y - _velocity[i].y * dt;
+    for (u32 x = 0; x < width; x++) {
+        // Look back along the velocity vector
+        const f32 srcX = static_cast<f32>(x) - velocityX[x] * dt;
+        const f32 srcY = static_cast<f32>(y) - velocityY[x] * dt;
 
-            // Sample the sediment amount at the source position
-            nextSediment[i] = _sampleSediment(srcX, srcY);
-        }
+        // Sample the sediment amount at the source position
+        next[x] = _sampleSediment(srcX, srcY);
     }
-
-    // Update the sediment buffer
-    _suspendedSedimentAmount = std::move(nextSediment);
 }
 
-void ErosionGenerator::_applyEvaporation(float dt) {
+void ErosionGenerator::_applyEvaporation(float dt, u32 y) {
     const u32 width = _terrain->getWidth();
-    const u32 depth = _terrain->getDepth();
-
-    for (u32 i = 0; i < width * depth; i++) {
+    const u32 begin = y * width;
+
+    f32 *__restrict water = _state.water.data() + begin;
+    f32 *__restrict fluxL = _state.fluxLeft.data() + begin;
+    f32 *__restrict fluxR = _state.fluxRight.data() + begin;
+    f32 *__restrict fluxT = _state.fluxTop.data() + begin;
+    f32 *__restrict fluxB = _state.fluxBottom.data() + begin;
+    f32 *__restrict velocityX = _state.velocityX.data() + begin;
+    f32 *__restrict velocityY = _state.velocityY.data() + begin;
+
+    // members are copied in locals, otherwise the compiler reloads them
+    // every iteration in case the stores alias them
+    const f32 evaporation = 1.f - _evaporationConstant * dt;
+
+    GEOPHAGIA_IVDEP
+    for (u32 x = 0; x < width; x++) {
         // Reduce the water height
-        _waterHeight[i] *= (1.f - _evaporationConstant * dt);
-
-        if (_waterHeight[i] < 0.0001f) {
-            _waterHeight[i] = 0.f;
-            _outflowFlux[i] = glm::vec4(0.f);
-            _velocity[i] = glm::vec2(0.f);
-        }
+        const f32 w = water[x] * evaporation;
+
+        // dry cells stop flowing
+        const bool isDry = w < 0.0001f;
+        water[x] = isDry ? 0.f : w;
+        fluxL[x] = isDry ? 0.f : fluxL[x];
+        fluxR[x] = isDry ? 0.f : fluxR[x];
+        fluxT[x] = isDry ? 0.f : fluxT[x];
+        fluxB[x] = isDry ? 0.f : fluxB[x];
+        velocityX[x] = isDry ? 0.f : velocityX[x];
+        velocityY[x] = isDry ? 0.f : velocityY[x];
     }
 }
 
@@ -355,250 +554,379 @@ void smoothPatch(std::vector<f32> &_heightmap, const u32 width, const u32 depth,
 }
 
 
+/**
+ * @brief Number of steps a droplet lives for. A droplet moves by at most one cell per step
+ */
+constexpr int DROPLET_LIFETIME = 30;
+/**
+ * @brief Number of droplets bucketed and run together by the parallel path.
+ * The preview can only be updated between two rounds
+ */
+constexpr u32 DROPLETS_PER_ROUND = 10'000;
+
+/**
+ * @brief splitmix64 finalizer. Used to give every droplet an independent random stream
+ */
+inline u64 mixBits(u64 x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @brief Starting position of the droplet `droplet` in the parallel mode.
+ * It only depends on the seed and the index of the droplet.
+ */
+glm::vec2 dropletStartPosition(u64 seed, u64 droplet, u32 width, u32 depth) {
+    const u64 bits = mixBits(mixBits(seed) ^ droplet);
+    // take 24 bits for each coordinate to get floats in [0, 1)
+    const f32 u = static_cast<f32>(bits >> 40) * 0x1.0p-24f;
+    const f32 v = static_cast<f32>((bits >> 16) & 0xffffff) * 0x1.0p-24f;
+
+    return glm::vec2(u * (static_cast<f32>(width) - 1), v * (static_cast<f32>(depth) - 1));
+}
+
 void ErosionGenerator::generateHeightmap() {
-    _isSimulationRunning = true;
+    if (_simulationJob.isRunning()) { return; }
     _init();
+    _isBenchmarkJob = false;
 
-    _simulationTask = std::async(std::launch::async, [this]() {
-        // u64 i = 0;
-        // while (_isSimulationRunning) {
-        //     _applyRainfall(_deltaTime);
-        //     _computeFlow(_deltaTime);
-        //     _computeErosionDeposition(_deltaTime);
-        //     _transportSediment(_deltaTime);
-        //     _applyEvaporation(_deltaTime);
-        //
-        //     if (i % 10 == 0) {
-        //         _heightmapB = _heightmap;
-        //         _updateFlag.store(true, std::memory_order_release);
-        //     }
-        //
-        //     i++;
-        // }
-
-        u32 numDroplets = 200'000;
-        const u32 width = _terrain->getWidth();
-        const u32 depth = _terrain->getDepth();
-        const float gravity = 9.81f;
-
-        std::mt19937 mt(_seed);
-        std::uniform_real_distribution<float> distx(0.f, static_cast<f32>(width) - 1);
-        std::uniform_real_distribution<float> distz(0.f, static_cast<f32>(depth) - 1);
-        auto rngx = [&]() { return distx(mt); };
-        auto rngz = [&]() { return distz(mt); };
-
-        for (u32 droplet = 0; droplet < numDroplets; droplet++) {
-            auto position = glm::vec2(rngx(), rngz());
-            auto direction = glm::vec2(0.f, 0.f);
-            float velocity = 1.f;
-            float water = 1.f;
-            float sediment = 0.f;
-
-            for (int lifetime = 0; lifetime < 30; lifetime++) {
-                u32 iposX = static_cast<u32>(std::floor(position.x));
-                u32 iposY = static_cast<u32>(std::floor(position.y));
-                float fracPosX = position.x - iposX;
-                float fracPosY = position.y - iposY;
-
-                auto height = calculateHeight(_heightmap, width, depth, position);
-                auto grad = calculateGradient(_heightmap, width, depth, position);
-
-                // change the drop direction using the gradient of the surface
-                direction = direction * _flowInertia - grad * (1.f - _flowInertia);
-
-                if (glm::length(direction) > 1e-6f) {
-                    direction = glm::normalize(direction);
-                }
+    // the hydraulic simulation has no end, its progress bar only shows the time elapsed
+    const u64 totalWork = _erosionMode == ErosionMode::Hydraulic ? 0 : _numDroplets;
+    _simulationJob.start(*_taskScheduler, totalWork, [this](JobContext &context) {
+        if (_erosionMode == ErosionMode::Hydraulic) {
+            _runHydraulic(context);
+        }
+        else {
+            _runDroplets(_dropletMode, _numDroplets, context);
+            // a cancel is expected to take effect right away, the noise is left
+            if (!context.isCancelled()) {
+                _smoothHeightmap();
+            }
+        }
+    });
+}
 
-                position += direction;
+void ErosionGenerator::_runHydraulic(JobContext &context) {
+    const u32 depth = _terrain->getDepth();
 
-                if (
-                    (position.x < 0.f || position.x >= width - 1 || position.y < 0.f || position.y >= depth - 1)
-                    || (direction.x < 1e-4f && direction.y < 1e-4f)
-                ) {
-                    // if the drop stops moving or goes outside the terrain, it's dead
-                    break;
-                }
+    // the rain of the following steps is applied at the end of the previous one
+    for (u32 y = 0; y < depth; y++) {
+        _applyRainfall(_deltaTime, y);
+    }
 
-                auto newHeight = calculateHeight(_heightmap, width, depth, position);
-                auto deltaHeight = newHeight - height;
+    auto start = std::chrono::steady_clock::now();
+    for (u64 step = 1; !context.isCancelled(); step++) {
+        // the kernels run on the workers, the allocations of every thread are counted
+        const u64 allocations = AllocationCounter::getAllocations();
+        _simulationStep(_deltaTime, context.getStopToken());
+        _stepAllocations = AllocationCounter::getAllocations() - allocations;
+
+        _publishPreview();
+        if (step % 10 == 0) {
+            const auto now = std::chrono::steady_clock::now();
+            const std::chrono::duration<f32> elapsed = now - start;
+            _stepsPerSecond = 10.f / std::max(elapsed.count(), 1e-6f);
+            start = now;
+        }
+    }
 
-                float capacity = std::max(-deltaHeight, 0.01f) * velocity * water * _sedimentCapacity;
+    const f32 cells = static_cast<f32>(_heightmap.size());
+    slog::info(
+        "Hydraulic step on {}x{}: flow {:.3f}ms ({:.1f}GB/s), erosion {:.3f}ms ({:.1f}GB/s), transport {:.3f}ms ({:.1f}GB/s)",
+        _terrain->getWidth(), _terrain->getDepth(),
+        _stepTimings.flow.load(), _stepTimings.bandwidth(StepTimings::FLOW_BYTES_PER_CELL * cells, _stepTimings.flow),
+        _stepTimings.erosion.load(), _stepTimings.bandwidth(StepTimings::EROSION_BYTES_PER_CELL * cells, _stepTimings.erosion),
+        _stepTimings.transport.load(), _stepTimings.bandwidth(StepTimings::TRANSPORT_BYTES_PER_CELL * cells, _stepTimings.transport)
+    );
+    if (_stepAllocations > 0) {
+        slog::warning("The last hydraulic step made {} allocations", _stepAllocations.load());
+    }
+}
 
-                if (sediment > capacity || deltaHeight > 0.f) {
-                    // deposit
-                    // float depositAmount = deltaHeight > 0.f ? sediment : (sediment - capacity) * _depositionConstant;
-                    float depositAmount;
-                    if (deltaHeight > 0.f)
-                        depositAmount = std::min(deltaHeight, sediment);
-                    else
-                        depositAmount = (sediment - capacity) * _depositionConstant;
+void ErosionGenerator::_runDroplets(DropletMode mode, u32 numDroplets, JobContext &context) {
+    const auto start = std::chrono::steady_clock::now();
 
-                    sediment -= depositAmount;
+    if (mode == DropletMode::Parallel) {
+        _runDropletsParallel(numDroplets, context);
+    }
+    else {
+        _runDropletsSerial(numDroplets, context);
+    }
+    // the throughput of a part of the droplets isn't comparable
+    if (context.isCancelled()) { return; }
+
+    const std::chrono::duration<f32> elapsed = std::chrono::steady_clock::now() - start;
+    _dropletsPerSecond = static_cast<f32>(numDroplets) / std::max(elapsed.count(), 1e-6f);
+    slog::info(
+        "{} droplets in {:.3f}s ({:.0f} droplets/s, {} mode)", numDroplets, elapsed.count(),
+        _dropletsPerSecond.load(), mode == DropletMode::Parallel ? "parallel" : "serial"
+    );
+}
 
-                    // spread the amount to be deposited on the corners of the cell bilinearly
-                    _heightmap[iposY * width + iposX] += depositAmount * (1.f - fracPosX) * (1.f - fracPosY);    // BL
-                    _heightmap[iposY * width + iposX + 1] += depositAmount * fracPosX * (1.f - fracPosY);        // BR
-                    _heightmap[(iposY + 1) * width + iposX] += depositAmount * (1.f - fracPosX) * fracPosY;      // TL
-                    _heightmap[(iposY + 1) * width + iposX + 1] += depositAmount * fracPosX * fracPosY;          // TR
+void ErosionGenerator::_runDropletsSerial(u32 numDroplets, JobContext &context) {
+    const u32 width = _terrain->getWidth();
+    const u32 depth = _terrain->getDepth();
 
-                    // smoothPatch(_heightmap, width, depth, {iposX, iposY});
-                }
-                else {
-                    // erode
-                    float erosionAmount = std::min((capacity - sediment) * _erosionConstant, -deltaHeight);
-                    // float erosionAmount = (capacity - sediment) * _erosionConstant;
-
-                    u32 dropIndex = iposY * width + iposX;
-                    for (size_t i = 0; i < _erosionIndicesCache[dropIndex].size(); i++) {
-                        u32 neighbourIndex = _erosionIndicesCache[dropIndex][i];
-                        float neighbourErosionAmount = erosionAmount * _erosionWeightCache[dropIndex][i];
-                        neighbourErosionAmount = neighbourErosionAmount > _heightmap[neighbourIndex]
-                                                     ? _heightmap[neighbourIndex] : neighbourErosionAmount;
-
-                        auto height = _heightmap[neighbourIndex];
-                        _heightmap[neighbourIndex] -= neighbourErosionAmount;
-                        auto newHeight = _heightmap[neighbourIndex];
-
-                        sediment += neighbourErosionAmount;
-                    }
-                }
+    std::mt19937 mt(_seed);
+    std::uniform_real_distribution<float> distx(0.f, static_cast<f32>(width) - 1);
+    std::uniform_real_distribution<float> distz(0.f, static_cast<f32>(depth) - 1);
+    auto rngx = [&]() { return distx(mt); };
+    auto rngz = [&]() { return distz(mt); };
 
-                velocity = std::sqrt(std::max(0.f, velocity * velocity + deltaHeight * gravity));
-                water *= (1.f - _evaporationConstant);
+    for (u32 droplet = 0; droplet < numDroplets && !context.isCancelled(); droplet++) {
+        _simulateDroplet(glm::vec2(rngx(), rngz()));
+        context.advance();
 
-                // if any of these are not valid => HELL ON EARTH
-                expect(sediment >= 0.f && sediment < 255.f, "Sediment amount is invalid");
-                expect(std::abs(deltaHeight) < 255.f, "Large spikes :(");
-                expect(water <= 1.f && water >= 0.f, "Water amount is invalid");
-            }
+        // send new heightmap to the render thread
+        _publishPreview();
+    }
+}
 
-            // send new heightmap to the render thread
-            if (droplet % 10'000 == 0) {
-                _heightmapB = _heightmap;
-                _updateFlag.store(true, std::memory_order_release);
-            }
+void ErosionGenerator::_runDropletsParallel(u32 numDroplets, JobContext &context) {
+    const u32 width = _terrain->getWidth();
+    const u32 depth = _terrain->getDepth();
+
+    // furthest cell from its starting point a droplet can read or write:
+    // its path, the erosion brush around it and the bilinear deposit
+    const u32 reach = DROPLET_LIFETIME + _erosionRadius + 1;
+    // with this size, the cells touched by two tiles of the same colour never overlap
+    const u32 tileSize = 2 * reach;
+    const u32 tilesX = (width + tileSize - 1) / tileSize;
+    const u32 tilesZ = (depth + tileSize - 1) / tileSize;
+
+    std::array<std::vector<u32>, 4> tilesPerColour;
+    for (u32 tz = 0; tz < tilesZ; tz++) {
+        for (u32 tx = 0; tx < tilesX; tx++) {
+            tilesPerColour[(tx & 1) | ((tz & 1) << 1)].push_back(tz * tilesX + tx);
         }
+    }
+
+    // starting positions of the droplets of the current round, bucketed by tile
+    std::vector<std::vector<glm::vec2>> tileDroplets(tilesX * tilesZ);
+
+    for (u32 first = 0; first < numDroplets && !context.isCancelled(); first += DROPLETS_PER_ROUND) {
+        const u32 last = std::min(numDroplets, first + DROPLETS_PER_ROUND);
 
-        // apply laplacian smoothing to get rid of the unfortunate deposition noise
-        for (int i = 0; i < 2; i++) {
-            for (int z = 0; z < depth; z++) {
-                for (int x = 0; x < width; x++) {
-                    smoothPatch(_heightmap, width, depth, {x, z}, 0.5f);
+        for (auto &droplets : tileDroplets) {
+            droplets.clear();
+        }
+        // droplets are pushed by increasing index so every tile
+        // always processes its droplets in the same order
+        for (u32 droplet = first; droplet < last; droplet++) {
+            const auto position = dropletStartPosition(_seed, droplet, width, depth);
+            const u32 tile = static_cast<u32>(position.y) / tileSize * tilesX + static_cast<u32>(position.x) / tileSize;
+            tileDroplets[tile].push_back(position);
+        }
+
+        for (const auto &tiles : tilesPerColour) {
+            _taskScheduler->parallelFor(static_cast<u32>(tiles.size()), [&](u32 i) {
+                // a round takes a while on a big map, the tiles stop between two droplets
+                u32 numSimulated = 0;
+                for (const auto position : tileDroplets[tiles[i]]) {
+                    if (context.isCancelled()) { break; }
+                    _simulateDroplet(position);
+                    numSimulated++;
                 }
+                context.advance(numSimulated);
+            }, context.getStopToken());
+        }
+
+        // send new heightmap to the render thread
+        _publishPreview();
+    }
+}
+
+void ErosionGenerator::_simulateDroplet(glm::vec2 position) {
+    const u32 width = _terrain->getWidth();
+    const u32 depth = _terrain->getDepth();
+    const float gravity = 9.81f;
+
+    auto direction = glm::vec2(0.f, 0.f);
+    float velocity = 1.f;
+    float water = 1.f;
+    float sediment = 0.f;
+
+    for (int lifetime = 0; lifetime < DROPLET_LIFETIME; lifetime++) {
+        u32 iposX = static_cast<u32>(std::floor(position.x));
+        u32 iposY = static_cast<u32>(std::floor(position.y));
+        float fracPosX = position.x - iposX;
+        float fracPosY = position.y - iposY;
+
+        auto height = calculateHeight(_heightmap, width, depth, position);
+        auto grad = calculateGradient(_heightmap, width, depth, position);
+
+        // change the drop direction using the gradient of the surface
+        direction = direction * _flowInertia - grad * (1.f - _flowInertia);
+
+        if (glm::length(direction) > 1e-6f) {
+            direction = glm::normalize(direction);
+        }
+
+        position += direction;
+
+        if (
+            (position.x < 0.f || position.x >= width - 1 || position.y < 0.f || position.y >= depth - 1)
+            || (direction.x < 1e-4f && direction.y < 1e-4f)
+        ) {
+            // if the drop stops moving or goes outside the terrain, it's dead
+            break;
+        }
+
+        auto newHeight = calculateHeight(_heightmap, width, depth, position);
+        auto deltaHeight = newHeight - height;
+
+        float capacity = std::max(-deltaHeight, 0.01f) * velocity * water * _sedimentCapacity;
+
+        if (sediment > capacity || deltaHeight > 0.f) {
+            // deposit
+            // float depositAmount = deltaHeight > 0.f ? sediment : (sediment - capacity) * _depositionConstant;
+            float depositAmount;
+            if (deltaHeight > 0.f)
+                depositAmount = std::min(deltaHeight, sediment);
+            else
+                depositAmount = (sediment - capacity) * _depositionConstant;
+
+            sediment -= depositAmount;
+
+            // spread the amount to be deposited on the corners of the cell bilinearly
+            _heightmap[iposY * width + iposX] += depositAmount * (1.f - fracPosX) * (1.f - fracPosY);    // BL
+            _heightmap[iposY * width + iposX + 1] += depositAmount * fracPosX * (1.f - fracPosY);        // BR
+            _heightmap[(iposY + 1) * width + iposX] += depositAmount * (1.f - fracPosX) * fracPosY;      // TL
+            _heightmap[(iposY + 1) * width + iposX + 1] += depositAmount * fracPosX * fracPosY;          // TR
+
+            // smoothPatch(_heightmap, width, depth, {iposX, iposY});
+        }
+        else {
+            // erode
+            float erosionAmount = std::min((capacity - sediment) * _erosionConstant, -deltaHeight);
+            // float erosionAmount = (capacity - sediment) * _erosionConstant;
+
+            _erosionBrush.forEach(iposX, iposY, [&](u32 neighbourIndex, float weight) {
+                float neighbourErosionAmount = erosionAmount * weight;
+                neighbourErosionAmount = neighbourErosionAmount > _heightmap[neighbourIndex]
+                                             ? _heightmap[neighbourIndex] : neighbourErosionAmount;
+
+                _heightmap[neighbourIndex] -= neighbourErosionAmount;
+
+                sediment += neighbourErosionAmount;
+            });
+        }
+
+        velocity = std::sqrt(std::max(0.f, velocity * velocity + deltaHeight * gravity));
+        water *= (1.f - _evaporationConstant);
+
+        // if any of these are not valid => HELL ON EARTH
+        expect(sediment >= 0.f && sediment < 255.f, "Sediment amount is invalid");
+        expect(std::abs(deltaHeight) < 255.f, "Large spikes :(");
+        expect(water <= 1.f && water >= 0.f, "Water amount is invalid");
+    }
+}
+
+void ErosionGenerator::_smoothHeightmap() {
+    const u32 width = _terrain->getWidth();
+    const u32 depth = _terrain->getDepth();
+
+    // apply laplacian smoothing to get rid of the unfortunate deposition noise
+    for (int i = 0; i < 2; i++) {
+        for (u32 z = 0; z < depth; z++) {
+            for (u32 x = 0; x < width; x++) {
+                smoothPatch(_heightmap, width, depth, glm::ivec2(x, z), 0.5f);
             }
         }
-    });
+    }
+}
+
+void ErosionGenerator::_runBenchmark(JobContext &context) {
+    const auto original = _heightmap;
+
+    // the eroded heights are thrown away, the terrain keeps showing the original ones
+    _isBenchmarking = true;
+    _runDroplets(DropletMode::Serial, _numDroplets, context);
+    _heightmap = original;
+    const f32 serialDropletsPerSecond = _dropletsPerSecond.load();
+    if (!context.isCancelled()) {
+        _runDroplets(DropletMode::Parallel, _numDroplets, context);
+        _heightmap = original;
+    }
+    _isBenchmarking = false;
+    if (context.isCancelled()) { return; }
+
+    // both are shown together, not one of them next to the one of the previous benchmark
+    _serialBenchmark = serialDropletsPerSecond;
+    _parallelBenchmark = _dropletsPerSecond.load();
+    slog::info(
+        "Droplet benchmark: serial {:.0f} droplets/s, parallel {:.0f} droplets/s on {} threads (x{:.2f})",
+        _serialBenchmark.load(), _parallelBenchmark.load(), _taskScheduler->getThreadCount(),
+        _parallelBenchmark.load() / std::max(_serialBenchmark.load(), 1e-6f)
+    );
+}
 
+void ErosionGenerator::_publishPreview(bool force) {
+    if (_isBenchmarking) { return; }
+    const auto now = std::chrono::steady_clock::now();
+    if (!force && now - _lastPreview < std::chrono::duration<f32, std::milli>(_previewInterval)) {
+        return;
+    }
+    _lastPreview = now;
 
+    // the buffers have the size of the map since _init, so this doesn't allocate
+    std::ranges::copy(_heightmap, _preview.getWriteBuffer().begin());
+    _preview.publish();
 }
 
 void ErosionGenerator::update() {
     // periodic updates to the gpu buffers
-    if (_updateFlag.exchange(false, std::memory_order_acquire)) {
-        _terrain->loadRawFromMemory(_heightmapB, _terrain->getWidth(), _terrain->getDepth());
+    if (_preview.acquire()) {
+        _terrain->loadRawFromMemory(_preview.getReadBuffer(), _terrain->getWidth(), _terrain->getDepth());
     }
     // finish simulation
-    if (_simulationTask.valid() && _simulationTask.wait_for(0s) == std::future_status::ready) {
-        _simulationTask.get();
+    if (_simulationJob.isFinished()) {
+        // the heightmap eroded until the cancel is kept
+        const std::expected<void, JobStatus> result = _simulationJob.take();
+        if (!result.has_value() && result.error() == JobStatus::Failed) {
+            return;
+        }
 
-        _terrain->loadRawFromMemory(_heightmap, _terrain->getWidth(), _terrain->getDepth());
-        _isSimulationRunning = false;
+        // drop a preview published after the check above, it's older than the final heightmap
+        _preview.acquire();
+        // the benchmark leaves the heights as they were, the terrain may have changed meanwhile
+        if (_isBenchmarkJob) { return; }
+        _terrain->loadRawFromMemory(std::move(_heightmap), _terrain->getWidth(), _terrain->getDepth());
     }
 }
 
 
 void ErosionGenerator::_init() {
     if (_terrain) {
-        _heightmap = _terrain->getHeights();
-        _waterHeight = std::vector<float>(_heightmap.size(), 0.f);
-        _suspendedSedimentAmount = std::vector<float>(_heightmap.size(), 0.f);
-        _outflowFlux = std::vector<glm::vec4>(_heightmap.size(), glm::vec4(0.f));
-        _velocity = std::vector<glm::vec2>(_heightmap.size(), glm::vec2(0.f));
-
-        _erosionIndicesCache = std::vector<std::vector<u32>>(_heightmap.size());
-        _erosionWeightCache = std::vector<std::vector<float>>(_heightmap.size());
+        // the simulation works on its own copy, the terrain is still drawn meanwhile
+        const std::span<const f32> heights = _terrain->getHeights();
+        _heightmap.assign(heights.begin(), heights.end());
+        _state.reset(_heightmap.size());
+        _preview.reset(_heightmap);
+        _lastPreview = std::chrono::steady_clock::now();
 
         _cacheInit();
     }
     else {
         _heightmap = std::vector<float>(256*256, 0.f);
-        _waterHeight = std::vector<float>(256*256, 0.f);
-        _suspendedSedimentAmount = std::vector<float>(256*256, 0.f);
-        _outflowFlux = std::vector<glm::vec4>(256*256, glm::vec4(0.f));
-        _velocity = std::vector<glm::vec2>(256*256, glm::vec2(0.f));
+        _state.reset(_heightmap.size());
+        _preview.reset(_heightmap);
 
-        _erosionIndicesCache = std::vector<std::vector<u32>>(_heightmap.size());
-        _erosionWeightCache = std::vector<std::vector<float>>(_heightmap.size());
+        _erosionBrush.build(256, 256, _erosionRadius);
     }
 }
 
 void ErosionGenerator::_cacheInit() {
-    u32 width = _terrain->getWidth();
-    u32 depth = _terrain->getDepth();
-
-
-    // these offsets will be used to calculate the coordinates of the neighbours of the cell
-    // that will be affected by the erosion
-    std::vector<int> xOffsets(_erosionRadius * _erosionRadius * 4);
-    std::vector<int> yOffsets(_erosionRadius * _erosionRadius * 4);
-    // the weight matrix of the cell. It's used to determine
-    // how much of the neighbours the water will erode
-    std::vector<float> weights(_erosionRadius * _erosionRadius * 4);
-    // sum of the weight for normalization
-    float weightSum = 0.f;
-    // number of weights of the cell
-    u32 numWeights = 0;
-
-    // for every cell (x, y)
-    for (u32 cy = 0; cy < depth; cy++) {
-        for (u32 cx = 0; cx < width; cx++) {
-            // if moving away by the radius won't throw us out of the map
-            if (   static_cast<i64>(cx) < _erosionRadius || cx + _erosionRadius > width - 1
-                || static_cast<i64>(cy) < _erosionRadius || cy + _erosionRadius > depth - 1) {
-
-                weightSum = 0.f;
-                numWeights = 0;
-
-                // for all the cell in the square 2radius * 2radius
-                for (i32 y = -_erosionRadius; y <= _erosionRadius; y++) {
-                    for (i32 x = -_erosionRadius; x <= _erosionRadius; x++) {
-                        i32 sqDist = x*x + y*y;
-
-                        // if in the circle
-                        if (sqDist < _erosionRadius * _erosionRadius) {
-                            u32 weightXPos = cx + x;
-                            u32 weightYPos = cy + y;
-
-                            // calculate the weights of the cell and its neighbours
-                            if (/*weightXPos >= 0 && */weightXPos < width && /*weightYPos >= 0 && */weightYPos < depth) {
-                                float weight = std::max(0.f, _erosionRadius - std::sqrt(static_cast<f32>(sqDist)));
-                                // float weight = 1.f - std::sqrt(sqDist) / _erosionRadius;
-                                weightSum += weight;
-                                weights[numWeights] = weight;
-                                xOffsets[numWeights] = x;
-                                yOffsets[numWeights] = y;
-                                numWeights++;
-                            }
-                        }
-                    }
-                }
-            }
-            size_t i = cy * width + cx;
-            _erosionIndicesCache[i] = std::vector<u32>(numWeights);
-            _erosionWeightCache[i] = std::vector<float>(numWeights);
-            // for specific cell (x, y) = i, write the indices and weights of neighbours j
-            for (size_t j = 0; j < numWeights; j++) {
-                _erosionIndicesCache[i][j] = (yOffsets[j] + cy) * width + xOffsets[j] + cx;
-                _erosionWeightCache[i][j] = weights[j] / weightSum;
-            }
-        }
-    }
+    const auto start = std::chrono::steady_clock::now();
 
-    for (size_t i = 0; i < _erosionWeightCache.size(); i++) {
-        for (size_t j = 0; j < _erosionWeightCache[i].size(); j++) {
-            expect(_erosionWeightCache[i][j] > 0.f && _erosionWeightCache[i][j] < 1.f);
-        }
-    }
+    _erosionBrush.build(_terrain->getWidth(), _terrain->getDepth(), _erosionRadius);
+
+    const std::chrono::duration<f32, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    slog::info(
+        "Erosion brush of radius {} built in {:.3f}ms ({:.1f}KiB)", _erosionRadius, elapsed.count(),
+        static_cast<f32>(_erosionBrush.getMemoryUsage()) / 1024.f
+    );
 }
 }
@@ -1,16 +1,37 @@
 #pragma once
 
-#include <future>
+#include <chrono>
 
 #include "HeightmapGenerator.h"
+#include "ErosionBrush.h"
+#include "HydraulicState.h"
+#include "../../Utils/TripleBuffer.h"
 
 namespace Geophagia {
 
 class ErosionGenerator : public HeightmapGenerator {
 public:
+    /**
+     * @brief Erosion algorithm run by the simulation
+     */
+    enum class ErosionMode : int {
+        Droplets, ///< @brief Particles carrying sediment down the slopes
+        Hydraulic ///< @brief Grid based shallow water simulation (virtual pipe model). Runs until stopped
+    };
+    /**
+     * @brief How the droplets are distributed over the cpu cores
+     */
+    enum class DropletMode : int {
+        Serial,  ///< @brief One droplet after the other on a single thread
+        Parallel ///< @brief Droplets of non adjacent tiles run at the same time on all the cores
+    };
+
     ErosionGenerator() = default;
-    ErosionGenerator(Terrain *terrain);
-    virtual ~ErosionGenerator() override = default;
+    ErosionGenerator(Terrain *terrain, Necrosis::TaskScheduler &taskScheduler);
+    /**
+     * @brief Cancels the simulation running in the background and waits for it
+     */
+    virtual ~ErosionGenerator() override;
 
     void uiRender() override;
     void update();
@@ -27,37 +48,129 @@ private:
     float _evaporationConstant = 0.05f;
     float _flowInertia = 0.5f;
     int _erosionRadius = 6;
+    u32 _numDroplets = 200'000;
+    float _previewInterval = 100.f; ///< @brief Minimum time between two updates of the preview in ms
+    ErosionMode _erosionMode = ErosionMode::Droplets;
+    DropletMode _dropletMode = DropletMode::Parallel;
 
     // simulation data
     std::vector<float> _heightmap;
-    std::vector<float> _waterHeight;
-    std::vector<float> _suspendedSedimentAmount;
-    std::vector<glm::vec4> _outflowFlux;
-    std::vector<glm::vec2> _velocity;
+    HydraulicState _state;
 
-    std::vector<std::vector<u32>> _erosionIndicesCache;
-    std::vector<std::vector<float>> _erosionWeightCache;
+    ErosionBrush _erosionBrush;
 
     // multithreading data
-    std::future<void> _simulationTask;
-    std::atomic<bool> _isSimulationRunning;
     /**
-     * @brief Temporary heightmap buffer for safe communication between
-     * the working thread and the main thread that uploads the heightmap to the gpu
+     * @brief Simulation or benchmark running in the background. Once cancelled, the droplets
+     * stop where they are and the heightmap eroded so far still goes to the terrain in `update`
+     */
+    GeneratorJob<void> _simulationJob{"erosion simulation"};
+    bool _isBenchmarkJob = false; ///< @brief The job is a benchmark, the terrain isn't written at its end
+    /**
+     * @brief Snapshots of the heightmap sent by the working thread
+     * to the main thread that uploads them to the gpu
      */
-    std::vector<float> _heightmapB;
-    std::atomic<bool> _updateFlag;
+    TripleBuffer<std::vector<float>> _preview;
+    std::chrono::steady_clock::time_point _lastPreview; ///< @brief Only used by the working thread
+    bool _isBenchmarking = false; ///< @brief No preview is published. Only used by the working thread
+
+    // statistics
+    std::atomic<f32> _dropletsPerSecond = 0.f; ///< @brief Throughput of the last simulation
+    std::atomic<f32> _stepsPerSecond = 0.f; ///< @brief Throughput of the hydraulic simulation
+    /**
+     * @brief Heap allocations made by the process during the last hydraulic step, so
+     * those of the other threads running at the same time too. Only counted in debug builds
+     */
+    std::atomic<u64> _stepAllocations = 0;
+    /**
+     * @brief Average time in ms spent in each pass of a hydraulic step
+     */
+    struct StepTimings {
+        // bytes each pass has to read and write for one cell, used to estimate the bandwidth
+        static constexpr f32 FLOW_BYTES_PER_CELL = 13 * sizeof(f32);      // h, w, 4 fluxes -> 4 fluxes, w, 2 velocities
+        static constexpr f32 EROSION_BYTES_PER_CELL = 7 * sizeof(f32);    // h, w, 2 velocities, s -> s, delta
+        static constexpr f32 TRANSPORT_BYTES_PER_CELL = 20 * sizeof(f32); // h, delta, s, w, 4 fluxes, 2 velocities -> same but delta
+
+        std::atomic<f32> flow = 0.f;
+        std::atomic<f32> erosion = 0.f;
+        std::atomic<f32> transport = 0.f;
+
+        /**
+         * @return Effective bandwidth in GB/s of a pass moving `bytes` in `milliseconds`
+         */
+        static f32 bandwidth(f32 bytes, f32 milliseconds) {
+            return milliseconds > 0.f ? bytes / (milliseconds * 1e6f) : 0.f;
+        }
+    } _stepTimings;
+    std::atomic<f32> _serialBenchmark = 0.f; ///< @brief Droplets per second of the serial path
+    std::atomic<f32> _parallelBenchmark = 0.f; ///< @brief Droplets per second of the parallel path
 
     // simulation step methods
-    void _applyRainfall(float dt);
-    void _computeFlow(float dt);
-    void _computeErosionDeposition(float dt);
-    void _transportSediment(float dt);
-    void _applyEvaporation(float dt);
+    /**
+     * @brief Runs hydraulic simulation steps until the job is cancelled
+     */
+    void _runHydraulic(JobContext &context);
+    /**
+     * @brief Advances the hydraulic simulation by one time step
+     *
+     * The map is processed in bands of rows across the task scheduler. The per row kernels
+     * below are grouped in as few passes over the map as their stencils allow.
+     * Once `stopToken` is stopped, the step is dropped before the heights are changed.
+     */
+    void _simulationStep(float dt, const std::stop_token &stopToken);
+    void _applyRainfall(float dt, u32 y);
+    void _computeFlux(float dt, u32 y);
+    void _computeWater(float dt, u32 y);
+    void _computeErosionDeposition(u32 y);
+    void _transportSediment(float dt, u32 y);
+    void _applyEvaporation(float dt, u32 y);
+
+    // droplet methods
+    /**
+     * @brief Runs `numDroplets` droplets on `_heightmap` with the selected mode
+     * and records the throughput in `_dropletsPerSecond`, unless the job is cancelled
+     *
+     * Reports a unit of work per droplet, the cancellation is checked between two droplets.
+     */
+    void _runDroplets(DropletMode mode, u32 numDroplets, JobContext &context);
+    void _runDropletsSerial(u32 numDroplets, JobContext &context);
+    /**
+     * @brief Runs the droplets in parallel
+     *
+     * The map is cut into tiles big enough for a droplet to never reach past
+     * its neighbouring tiles. The tiles are coloured like a 2x2 checkerboard
+     * and all the tiles of one colour are processed at the same time. Each droplet
+     * gets its own rng seeded from `_seed` and its index, so the result only depends on
+     * the seed and not on the number of threads.
+     */
+    void _runDropletsParallel(u32 numDroplets, JobContext &context);
+    /**
+     * @brief Moves a single droplet over `_heightmap` until it evaporates or leaves the map
+     * @param position Starting position of the droplet
+     */
+    void _simulateDroplet(glm::vec2 position);
+    /**
+     * @brief Applies laplacian smoothing to get rid of the deposition noise
+     */
+    void _smoothHeightmap();
+    /**
+     * @brief Runs the same amount of droplets with the serial and parallel paths
+     * on the current terrain and stores their throughput. The terrain is left untouched,
+     * no preview of the eroded heights is published.
+     */
+    void _runBenchmark(JobContext &context);
+    /**
+     * @brief Sends a copy of `_heightmap` to the main thread if the last one
+     * is older than the preview interval, or if `force` is set. Nothing is sent during a benchmark
+     */
+    void _publishPreview(bool force = false);
 
     [[nodiscard]]
     float _sampleSediment(float x, float y) const;
     void _init();
+    /**
+     * @brief Builds the erosion brush for the current radius and map size
+     */
     void _cacheInit();
 };
 }
@@ -1,175 +1,420 @@
 #include "FractalGenerator.h"
 
-#include <random>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <type_traits>
 
 #include <imgui/imgui.h>
 
 namespace Geophagia {
-FractalGenerator::FractalGenerator(Terrain *terrain) : HeightmapGenerator(terrain), _numOctaves(3), _powerScaler(1.f)
-    , _persistence(0.5f), _lacunarity(2.f) {}
+FractalGenerator::FractalGenerator(Terrain *terrain, Necrosis::TaskScheduler &taskScheduler)
+    : HeightmapGenerator(terrain, taskScheduler), _numOctaves(3), _powerScaler(1.f), _persistence(0.5f), _lacunarity(2.f) {}
+
+FractalGenerator::~FractalGenerator() {
+    // the jobs use the generator
+    _generationJob.cancel();
+    _pagedGenerationJob.cancel();
+    _generationJob.wait();
+    _pagedGenerationJob.wait();
+}
 
 void FractalGenerator::uiRender() {
     ImGui::Begin("Fractal Generator");
+        // the parameters are read by the generation running in the background
+        const bool isProcessing = _generationJob.isRunning() || _pagedGenerationJob.isRunning();
+        ImGui::BeginDisabled(isProcessing);
         ImGui::InputScalar("Seed", ImGuiDataType_U64, &_seed);
-        ImGui::InputInt("Number of octaves", &_numOctaves);
+        // clamp number of octaves for UX reasons ;)
+        if (ImGui::InputInt("Number of octaves", &_numOctaves)) {
+            _numOctaves = std::clamp(_numOctaves, 1, 8);
+        }
         ImGui::SliderFloat("Power scale", &_powerScaler, 0.1f, 3.f);
         ImGui::SliderFloat("Persistence", &_persistence, 0.01f, 1.f);
         ImGui::SliderFloat("Lacunarity", &_lacunarity, 1.5f, 4.f);
-        if (ImGui::Button("Generate fractal brownian motion")) {
-            _generateHeightmap(0);
+
+        const char *bases[] = { "Perlin", "Simplex", "Value", "Worley" };
+        int basis = static_cast<int>(_basis);
+        if (ImGui::Combo("Noise", &basis, bases, IM_ARRAYSIZE(bases))) {
+            _basis = static_cast<Basis>(basis);
+        }
+        const char *fractals[] = { "Fractal brownian motion", "Ridged multi-fractal", "Billow", "Hybrid multi-fractal" };
+        int fractal = static_cast<int>(_fractal);
+        if (ImGui::Combo("Fractal", &fractal, fractals, IM_ARRAYSIZE(fractals))) {
+            _fractal = static_cast<Fractal>(fractal);
+        }
+        ImGui::Checkbox("Domain warp", &_isWarpEnabled);
+        if (_isWarpEnabled) {
+            ImGui::SliderFloat("Warp strength (cells)", &_warpStrength, 1.f, 200.f);
+        }
+
+        ImGui::InputScalarN("World origin", ImGuiDataType_S64, _worldOrigin, 2);
+        ImGui::Checkbox("Normalize to the heightmap", &_isNormalizedToHeightmap);
+        if (ImGui::IsItemHovered()) {
+            ImGui::SetTooltip("Unchecked, the heights are mapped as in the world chunks and match them");
+        }
+
+        if (ImGui::Button("Generate")) {
+            _generateHeightmap();
+        }
+        if (_terrain && _terrain->getPagedHeightmap().isOpen()) {
+            ImGui::SameLine();
+            if (ImGui::Button("Generate the paged heightmap")) {
+                _generatePagedHeightmap();
+            }
         }
-        if (ImGui::Button("Generate ridged multi-fractal")) {
-            _generateHeightmap(1);
+        if (ImGui::Button("Benchmark noise")) {
+            _runBenchmark();
+        }
+        ImGui::EndDisabled();
+        if (_generationJob.isRunning() && _uiJobProgress(_generationJob.getProgress(), _generationJob.isCancelling())) {
+            _generationJob.cancel();
+        }
+        if (_pagedGenerationJob.isRunning() && _uiJobProgress(_pagedGenerationJob.getProgress(), _pagedGenerationJob.isCancelling())) {
+            _pagedGenerationJob.cancel();
+        }
+        if (!isProcessing && _generationMilliseconds > 0.f) {
+            ImGui::Text("Last generation: %.1f ms (%u threads)", _generationMilliseconds, _taskScheduler->getThreadCount());
+        }
+        const auto &perBasis = _benchmark.basisSamplesPerSecond;
+        if (perBasis[0] > 0.f) {
+            ImGui::Text(
+                "perlin: %.1fM | simplex: %.1fM | value: %.1fM | worley: %.1fM samples/s",
+                perBasis[0] * 1e-6f, perBasis[1] * 1e-6f, perBasis[2] * 1e-6f, perBasis[3] * 1e-6f
+            );
         }
     ImGui::End();
 }
 
-int FractalGenerator::_hash(const int x, const int y) const {
-    return _permutationTable[_permutationTable[(x & 0xff)] + (y & 0xff)];
+void FractalGenerator::generateChunk(
+    i64 originX, i64 originZ, u32 width, u32 depth, std::span<f32> heights, u32 stride
+) const {
+    if (width == 0 || depth == 0) { return; }
+    expect(
+        stride >= width && heights.size() >= static_cast<size_t>(depth - 1) * stride + width,
+        "The heights are too small for the chunk"
+    );
+
+    _visitNoise([&](const auto &graph) {
+        _sampleChunk(graph, originX, originZ, width, depth, heights.data(), stride);
+    });
+    const auto [minValue, maxValue] = _getFixedRange();
+    _mapHeights(heights.data(), width, depth, stride, minValue, maxValue);
 }
 
-void FractalGenerator::_generateHeightmap(int algo) {
+void FractalGenerator::_generateHeightmap() {
     if (!_terrain) {
         slog::warning("No terrain was assigned to this heightmap generator");
         return;
     }
+    if (_generationJob.isRunning() || _pagedGenerationJob.isRunning()) { return; }
+
+    // the parameters are read by the job, the UI is disabled until it's done
+    const u32 width = _terrain->getWidth();
+    const u32 depth = _terrain->getDepth();
+    _generationJob.start(*_taskScheduler, depth, [this, width, depth](JobContext &context) {
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<f32> heights = _computeHeightmap(width, depth, context);
+        _generationMilliseconds = std::chrono::duration<f32, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return heights;
+    });
+}
 
-    // clamp number of octaves for UX reasons ;)
-    if (_numOctaves < 1) _numOctaves = 1;
-    else if (_numOctaves > 8) _numOctaves = 8;
-
-    // initialise perlin noise generator
-    std::mt19937 mt(_seed);
-    std::uniform_real_distribution<float> distf;
-    std::uniform_int_distribution<int> disti(0, 255);
-    auto rng = std::bind(distf, mt);
-    auto rngi = std::bind(disti, mt);
-
-    for (auto &g : _gradients) {
-        float r = rng() * 2.f * std::numbers::pi_v<float>;
-        g = glm::vec2(std::cos(r), std::sin(r));
-    }
-
-    for (u32 i = 0; i < 256; i++) {
-        _permutationTable[i] = i;
+void FractalGenerator::_generatePagedHeightmap() {
+    if (!_terrain) {
+        slog::warning("No terrain was assigned to this heightmap generator");
+        return;
     }
-    for (u32 i = 0; i < 256; i++) {
-        u32 j = rngi();
-        std::swap(_permutationTable[i], _permutationTable[j]);
-        _permutationTable[i + 256] = _permutationTable[i];
+    PagedHeightmap &pagedHeightmap = _terrain->getPagedHeightmap();
+    if (!pagedHeightmap.isOpen()) {
+        slog::warning("No paged heightmap is open");
+        return;
     }
+    if (_generationJob.isRunning() || _pagedGenerationJob.isRunning()) { return; }
+
+    // every tile is a chunk of the world, generated on its own.
+    // The paged heightmap can't be closed or replaced until the job is done with it
+    const u32 numTiles = pagedHeightmap.getTilesX() * pagedHeightmap.getTilesZ();
+    _pagedGenerationJob.start(*_taskScheduler, numTiles, [this, &pagedHeightmap, numTiles, guard = pagedHeightmap.beginJob()](JobContext &context) {
+        const auto start = std::chrono::steady_clock::now();
+        const u32 tilesX = pagedHeightmap.getTilesX();
+        std::atomic<bool> isGenerated = true;
+        _taskScheduler->parallelFor(numTiles, [&](u32 tile) {
+            PagedHeightmap::TileHandle handle = pagedHeightmap.acquireTile(tile % tilesX, tile / tilesX, true);
+            if (!handle.isValid()) {
+                isGenerated = false;
+                return;
+            }
+            const HeightmapRegion &region = handle.getRegion();
+            generateChunk(
+                _worldOrigin[0] + region.x, _worldOrigin[1] + region.z, region.width, region.depth,
+                handle.getMutableHeights(), handle.getStride()
+            );
+            context.advance();
+        }, context.getStopToken());
+        // the tiles written before a cancel are still flushed, they are valid chunks of the world
+        const bool isWritten = pagedHeightmap.flush() && isGenerated;
+        _generationMilliseconds = std::chrono::duration<f32, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return isWritten;
+    });
+}
 
+Noise::FractalParameters FractalGenerator::_getFractalParameters() const {
+    return { _numOctaves, 0.005, _persistence, _lacunarity };
+}
 
-    u32 width = _terrain->getWidth();
-    u32 depth = _terrain->getDepth();
-
-    std::vector<f32> heights(width * depth);
+u32 FractalGenerator::_getNoiseSeed() const {
+    return static_cast<u32>(_seed ^ (_seed >> 32));
+}
 
-    float minVal = 1000.f;
-    float maxVal = -1000.f;
+std::pair<f32, f32> FractalGenerator::_getFixedRange() const {
+    // sum of the amplitudes of the octaves
+    f32 amplitudes = 0.f, amplitude = 1.f;
+    for (int octave = 0; octave < _numOctaves; octave++) {
+        amplitudes += amplitude;
+        amplitude *= _persistence;
+    }
 
-    if (algo == 0) {
-        for (u32 z = 0; z < depth; z++) {
-            for (u32 x = 0; x < width; x++) {
-                float frequency = 0.005f;
-                float amplitude = 1.f;
+    // the octaves are in [0, 1] but for the hybrid, where they are in [-0.3, 1.7]
+    // and weighted by at most 1. The few values out, such as the far corners of worley, are clamped
+    switch (_fractal) {
+    case Fractal::Fbm:
+    case Fractal::Ridged:
+    case Fractal::Billow:
+        break;
+    case Fractal::Hybrid:
+        return { -0.3f * amplitudes, 1.7f * amplitudes };
+    }
+    return { 0.f, amplitudes };
+}
 
-                heights[z * width + x] = 0.f;
+template <typename Visit>
+void FractalGenerator::_visitNoise(Visit &&visit) const {
+    const u32 seed = _getNoiseSeed();
+    const Noise::FractalParameters parameters = _getFractalParameters();
 
-                for (int oct = 0; oct < _numOctaves; oct++) {
-                    heights[z * width + x] += amplitude * ((_sample(glm::vec2(x, z) * frequency) + 1.f) * 0.5f);
-                    amplitude *= _persistence;
-                    frequency *= _lacunarity;
-                }
+    auto withBasis = [&](const auto &basis) {
+        using BasisNoise = std::decay_t<decltype(basis)>;
 
-                // search for the min and max values in the heightmap
-                float noiseSum = heights[z * width + x];
-                if (noiseSum < minVal) minVal = noiseSum;
-                if (noiseSum > maxVal) maxVal = noiseSum;
+        auto withWarp = [&](const auto &fractal) {
+            if (!_isWarpEnabled) {
+                visit(fractal);
+                return;
             }
+            // the warp has the scale of the first octave, with a seed of its own
+            const Noise::Simplex warp{ seed ^ 0x9E3779B9u };
+            visit(Noise::DomainWarp<Noise::Simplex, std::decay_t<decltype(fractal)>>{
+                warp, fractal, parameters.frequency, _warpStrength
+            });
+        };
+
+        switch (_fractal) {
+        case Fractal::Fbm:
+            withWarp(Noise::Fbm<BasisNoise>{ basis, parameters });
+            break;
+        case Fractal::Ridged:
+            withWarp(Noise::Ridged<BasisNoise>{ basis, parameters });
+            break;
+        case Fractal::Billow:
+            withWarp(Noise::Billow<BasisNoise>{ basis, parameters });
+            break;
+        case Fractal::Hybrid:
+            withWarp(Noise::Hybrid<BasisNoise>{ basis, parameters });
+            break;
         }
+    };
+
+    switch (_basis) {
+    case Basis::Perlin:
+        withBasis(Noise::Perlin{ seed });
+        break;
+    case Basis::Simplex:
+        withBasis(Noise::Simplex{ seed });
+        break;
+    case Basis::Value:
+        withBasis(Noise::Value{ seed });
+        break;
+    case Basis::Worley:
+        withBasis(Noise::Worley{ seed });
+        break;
     }
-    else if (algo == 1) {
-        for (u32 z = 0; z < depth; z++) {
-            for (u32 x = 0; x < width; x++) {
-                float frequency = 0.005f;
-                float amplitude = 1.f;
-                float noiseSum = 0.f;
-                float weight = 1.f;
-
-                for (int oct = 0; oct < _numOctaves; oct++) {
-                    // n between [-1.f, 1.f]
-                    float n = _sample(glm::vec2(x, z) * frequency);
-                    float ridge = 1.f - std::abs(n);
-
-                    ridge *= weight;
-                    weight = std::clamp(ridge, 0.f, 1.f);
-
-                    noiseSum += ridge * amplitude;
-
-                    amplitude *= _persistence;
-                    frequency *= _lacunarity;
-                }
-
-                heights[z * width + x] = noiseSum;
+}
 
-                if (noiseSum < minVal) minVal = noiseSum;
-                if (noiseSum > maxVal) maxVal = noiseSum;
+template <typename Graph>
+void FractalGenerator::_sampleChunk(
+    const Graph &graph, i64 originX, i64 originZ, u32 width, u32 depth, f32 *heights, u32 stride
+) {
+    // the points are the world cells, converted the same way whatever the chunk
+    f64 xs[Noise::BATCH_SIZE];
+    f64 zs[Noise::BATCH_SIZE];
+    for (u32 z = 0; z < depth; z++) {
+        f32 *row = heights + static_cast<size_t>(z) * stride;
+        std::ranges::fill(zs, static_cast<f64>(originZ + z));
+        for (u32 x = 0; x < width; x += Noise::BATCH_SIZE) {
+            const u32 count = std::min(Noise::BATCH_SIZE, width - x);
+            for (u32 i = 0; i < count; i++) {
+                xs[i] = static_cast<f64>(originX + x + i);
             }
+            Noise::sampleBatch(graph, xs, zs, count, row + x);
         }
     }
-
-    float range = maxVal - minVal;
-
-    for (u32 i = 0; i < width * depth; i++) {
-        // normalize between the lowest and highest value
-        float normalized = (heights[i] - minVal) / range;
-
-        float shaped = std::pow(normalized, _powerScaler);
-
-        heights[i] = shaped * 255.f;
-    }
-
-    _terrain->loadRawFromMemory(heights, width, depth);
 }
 
-inline float fade(const float t) {
-    return t * t * t * (t * (t * 6 - 15) + 10); // 6t^5 - 15t^4 + 10t^3
+void FractalGenerator::_mapHeights(f32 *heights, u32 width, u32 depth, u32 stride, f32 minValue, f32 maxValue) const {
+    // a flat heightmap, such as a single octave of billow at a zero, stays at 0
+    const f32 range = std::max(maxValue - minValue, std::numeric_limits<f32>::min());
+    for (u32 z = 0; z < depth; z++) {
+        f32 *__restrict row = heights + static_cast<size_t>(z) * stride;
+        if (_powerScaler == 1.f) {
+            for (u32 x = 0; x < width; x++) {
+                row[x] = std::clamp((row[x] - minValue) / range, 0.f, 1.f) * 255.f;
+            }
+            continue;
+        }
+        for (u32 x = 0; x < width; x++) {
+            row[x] = std::pow(std::clamp((row[x] - minValue) / range, 0.f, 1.f), _powerScaler) * 255.f;
+        }
+    }
 }
-inline float lerp(const float p, const float q, const float t) { return p * (1 - t) + q * t; }
-
-float FractalGenerator::_sample(glm::vec2 point) const {
-    // coordinates on the grid
-    int x0 = static_cast<int>(std::floor(point.x)) & 0xff;
-    int y0 = static_cast<int>(std::floor(point.y)) & 0xff;
-
-    int x1 = (x0 + 1) & 0xff;
-    int y1 = (y0 + 1) & 0xff;
 
-    float u = point.x - std::floor(point.x);
-    float v = point.y - std::floor(point.y);
+std::vector<f32> FractalGenerator::_computeHeightmap(u32 width, u32 depth, JobContext &context) {
+    std::vector<f32> heights(static_cast<size_t>(width) * depth);
+
+    // a few bands per thread balance the load, each band keeps its own min and max
+    const u32 numBands = std::min(depth, 4 * _taskScheduler->getThreadCount());
+    std::vector<f32> bandMin(numBands, std::numeric_limits<f32>::max());
+    std::vector<f32> bandMax(numBands, std::numeric_limits<f32>::lowest());
+    auto bandRows = [&](u32 band) {
+        return std::pair<u32, u32>(band * depth / numBands, (band + 1) * depth / numBands);
+    };
+
+    _visitNoise([&](const auto &graph) {
+        _taskScheduler->parallelFor(numBands, [&](u32 band) {
+            float minVal = bandMin[band];
+            float maxVal = bandMax[band];
+
+            const auto [beginZ, endZ] = bandRows(band);
+            for (u32 z = beginZ; z < endZ && !context.isCancelled(); z++) {
+                f32 *row = heights.data() + static_cast<size_t>(z) * width;
+                _sampleChunk(graph, _worldOrigin[0], _worldOrigin[1] + z, width, 1, row, width);
+
+                // search for the min and max values in the band
+                for (u32 x = 0; x < width; x++) {
+                    minVal = std::min(minVal, row[x]);
+                    maxVal = std::max(maxVal, row[x]);
+                }
+                context.advance();
+            }
+            bandMin[band] = minVal;
+            bandMax[band] = maxVal;
+        }, context.getStopToken());
+    });
+    if (context.isCancelled()) {
+        return {};
+    }
 
-    // corner gradients
-    const glm::vec2 grad00 = _gradients[_hash(x0, y0)];
-    const glm::vec2 grad01 = _gradients[_hash(x1, y0)];
-    const glm::vec2 grad10 = _gradients[_hash(x0, y1)];
-    const glm::vec2 grad11 = _gradients[_hash(x1, y1)];
+    auto [minVal, maxVal] = _getFixedRange();
+    if (_isNormalizedToHeightmap) {
+        minVal = *std::ranges::min_element(bandMin);
+        maxVal = *std::ranges::max_element(bandMax);
+    }
 
-    // vectors from corners to points
-    const glm::vec2 p00 = glm::vec2(u, v);
-    const glm::vec2 p01 = glm::vec2(u-1, v);
-    const glm::vec2 p10 = glm::vec2(u, v-1);
-    const glm::vec2 p11 = glm::vec2(u-1, v-1);
+    // normalize between the lowest and highest value and shape, in a single pass
+    _taskScheduler->parallelFor(numBands, [&](u32 band) {
+        const auto [beginZ, endZ] = bandRows(band);
+        _mapHeights(heights.data() + static_cast<size_t>(beginZ) * width, width, endZ - beginZ, width, minVal, maxVal);
+    }, context.getStopToken());
 
-    u = fade(u);
-    v = fade(v);
+    return heights;
+}
 
-    float a = lerp(dot(grad00, p00), dot(grad01, p01), u);
-    float b = lerp(dot(grad10, p10), dot(grad11, p11), u);
+void FractalGenerator::update() {
+    if (_pagedGenerationJob.isFinished()) {
+        PagedHeightmap &pagedHeightmap = _terrain->getPagedHeightmap();
+        const std::expected<bool, JobStatus> isWritten = _pagedGenerationJob.take();
+        if (!isWritten.has_value()) {
+            // the overview shows the tiles generated before the cancel
+            if (isWritten.error() == JobStatus::Cancelled) {
+                _terrain->loadPagedOverview(2048);
+            }
+            return;
+        }
+        if (!*isWritten) {
+            slog::warning("Failed to write the generated tiles in the paged heightmap");
+            return;
+        }
+        slog::info(
+            "Generated the {}x{} paged heightmap in {:.1f} ms on {} threads",
+            pagedHeightmap.getWidth(), pagedHeightmap.getDepth(), _generationMilliseconds, _taskScheduler->getThreadCount()
+        );
+        _terrain->loadPagedOverview(2048);
+        return;
+    }
+    if (!_generationJob.isFinished()) {
+        return;
+    }
 
-    return lerp(a, b, v);
+    std::expected<std::vector<f32>, JobStatus> result = _generationJob.take();
+    if (!result.has_value()) {
+        return;
+    }
+    std::vector<f32> heights = std::move(*result);
+    const u32 width = _terrain->getWidth();
+    const u32 depth = _terrain->getDepth();
+    if (heights.size() != static_cast<size_t>(width) * depth) {
+        slog::warning("The terrain was resized during the generation, the heightmap is dropped");
+        return;
+    }
+    _terrain->loadRawFromMemory(std::move(heights), width, depth);
+    slog::info(
+        "Generated a {}x{} fractal heightmap in {:.1f} ms on {} threads",
+        width, depth, _generationMilliseconds, _taskScheduler->getThreadCount()
+    );
 }
 
+void FractalGenerator::_runBenchmark() {
+    if (!_terrain) {
+        slog::warning("No terrain was assigned to this heightmap generator");
+        return;
+    }
 
+    const u32 width = _terrain->getWidth();
+    const u32 depth = _terrain->getDepth();
+    const f64 frequency = 0.005 * _lacunarity;
+    std::vector<f64> xs(width);
+    std::vector<f32> samples(width);
+    for (u32 x = 0; x < width; x++) {
+        xs[x] = static_cast<f64>(x) * frequency;
+    }
 
-} // Geophagia
\ No newline at end of file
+    // in batches over a row, like the octaves of the fractals sample them
+    f32 checksum = 0.f;
+    f64 zs[Noise::BATCH_SIZE];
+    auto measureBasis = [&](const auto &basis) {
+        const auto start = std::chrono::steady_clock::now();
+        for (u32 z = 0; z < depth; z++) {
+            std::ranges::fill(zs, static_cast<f64>(z) * frequency);
+            for (u32 x = 0; x < width; x += Noise::BATCH_SIZE) {
+                const u32 count = std::min(Noise::BATCH_SIZE, width - x);
+                Noise::sampleBatch(basis, xs.data() + x, zs, count, samples.data() + x);
+            }
+            // keeps the rows from being optimized away
+            checksum += samples[z % width];
+        }
+        const f32 seconds = std::chrono::duration<f32>(std::chrono::steady_clock::now() - start).count();
+        return static_cast<f32>(width) * depth / std::max(seconds, 1e-9f);
+    };
+
+    const u32 seed = _getNoiseSeed();
+    _benchmark.basisSamplesPerSecond = {
+        measureBasis(Noise::Perlin{ seed }), measureBasis(Noise::Simplex{ seed }),
+        measureBasis(Noise::Value{ seed }), measureBasis(Noise::Worley{ seed }),
+    };
+    const auto &perBasis = _benchmark.basisSamplesPerSecond;
+    slog::info(
+        "Noise benchmark on {}x{}: perlin {:.1f}M, simplex {:.1f}M, value {:.1f}M, worley {:.1f}M samples/s (checksum {})",
+        width, depth, perBasis[0] * 1e-6f, perBasis[1] * 1e-6f, perBasis[2] * 1e-6f, perBasis[3] * 1e-6f, checksum
+    );
+}
+} // Geophagia
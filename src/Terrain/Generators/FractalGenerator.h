@@ -1,41 +1,148 @@
 #pragma once
 
+#include <span>
+
 #include "HeightmapGenerator.h"
+#include "Noise.h"
 
 namespace Geophagia {
 /**
- * @brief Generates heightmaps using Perlin noise and fractal methods.
+ * @brief Generates heightmaps by summing octaves of a noise, optionally warped by another noise.
+ *
+ * The noise is defined over an infinite world, see `Noise`. The terrain shows the cells
+ * from a world origin, and any chunk of the world can be generated on its own.
  */
 class FractalGenerator : public HeightmapGenerator {
 public:
     FractalGenerator() = default;
-    FractalGenerator(Terrain *terrain);
-    virtual ~FractalGenerator() override = default;
+    FractalGenerator(Terrain *terrain, Necrosis::TaskScheduler &taskScheduler);
+    /**
+     * @brief Cancels the generation running in the background and waits for it
+     */
+    virtual ~FractalGenerator() override;
 
     /**
      * @brief Renders the widgets to set the parameters of the generator
      * and calls the generation function
      */
     void uiRender() override;
+    /**
+     * @brief Gives the heightmap to the terrain once the generation started by the UI is done
+     */
+    void update();
+
+    /**
+     * @brief Generates the heights of the world cells [originX, originX + width) x [originZ, originZ + depth)
+     * with the current parameters, on the calling thread
+     *
+     * The heights are mapped from the fixed range of the fractal, so chunks generated
+     * separately, in any order and on any thread, match exactly at their borders.
+     *
+     * @param heights Rows of `width` heights, `stride` apart
+     */
+    void generateChunk(i64 originX, i64 originZ, u32 width, u32 depth, std::span<f32> heights, u32 stride) const;
+
+    /**
+     * @brief Noise summed by the octaves
+     */
+    enum class Basis {
+        Perlin,
+        Simplex,
+        Value,
+        Worley,
+    };
+    /**
+     * @brief How the octaves are summed
+     */
+    enum class Fractal {
+        Fbm, ///< @brief Fractal brownian motion
+        Ridged, ///< @brief Ridged multi-fractal
+        Billow,
+        Hybrid, ///< @brief Hybrid multi-fractal
+    };
+
+    /**
+     * @brief Throughput of the noise kernels
+     */
+    struct NoiseBenchmark {
+        /**
+         * @brief Of a single octave of every basis
+         */
+        std::array<f32, 4> basisSamplesPerSecond{};
+    };
 
 private:
     int _numOctaves; ///< @brief Describe the amount of details in the heightmap
     float _powerScaler; ///< @brief Used to accentuate the distance between the peaks and flats
     float _persistence; ///< @brief How much detail to keep from the higher octaves
     float _lacunarity; ///< @brief Controls the gap between the patterns
+    Basis _basis = Basis::Perlin;
+    Fractal _fractal = Fractal::Fbm;
+    bool _isWarpEnabled = false; ///< @brief Warps the points by a simplex noise before sampling
+    f32 _warpStrength = 40.f; ///< @brief Largest move of the points in cells
+    i64 _worldOrigin[2] = { 0, 0 }; ///< @brief World cell at the corner of the terrain
+    /**
+     * @brief Stretches the heights of the terrain between its lowest and highest ones,
+     * instead of mapping them from the fixed range the chunks share
+     */
+    bool _isNormalizedToHeightmap = true;
+
+    NoiseBenchmark _benchmark;
 
-    std::array<glm::vec2, 256> _gradients;
-    std::array<u8, 512> _permutationTable;
+    // multithreading data
+    /**
+     * @brief Generation running in the background, the result goes to the terrain in `update`
+     */
+    GeneratorJob<std::vector<f32>> _generationJob{"fractal generation"};
+    /**
+     * @brief Generation of the paged heightmap of the terrain running in the background
+     */
+    GeneratorJob<bool> _pagedGenerationJob{"paged heightmap generation"};
+    f32 _generationMilliseconds = 0.f; ///< @brief Duration of the last generation
 
     /**
-     * @brief Generates the height values and notifies the terrain
-     * to update its buffers.
-     * @param algo 0 for fbm, 1 for rmf
+     * @brief Starts the generation of the height values in the background.
+     * `update` notifies the terrain to update its buffers once done
+     */
+    void _generateHeightmap();
+    /**
+     * @brief Generates the height values of the terrain from the world origin,
+     * with the rows split in bands across the task scheduler
+     *
+     * Reports a unit of work per row, and returns early once the job is cancelled.
+     */
+    std::vector<f32> _computeHeightmap(u32 width, u32 depth, JobContext &context);
+    /**
+     * @brief Starts filling the whole paged heightmap of the terrain in the background,
+     * a chunk per tile, the tiles in parallel
+     */
+    void _generatePagedHeightmap();
+    /**
+     * @brief Builds the noise graph of the current basis, fractal and warp and calls `visit(graph)`
+     *
+     * The graph is chosen once here, every combination is compiled to its own kernel.
      */
-    void _generateHeightmap(int algo);
-    [[nodiscard]]
-    int _hash(const int x, const int y) const;
-    float _sample(glm::vec2 point) const;
+    template <typename Visit>
+    void _visitNoise(Visit &&visit) const;
+    /**
+     * @brief Samples `graph` at the world cells [originX, originX + width) x [originZ, originZ + depth),
+     * a batch of points at a time, into rows `stride` apart
+     */
+    template <typename Graph>
+    static void _sampleChunk(const Graph &graph, i64 originX, i64 originZ, u32 width, u32 depth, f32 *heights, u32 stride);
+    /**
+     * @brief Maps the height values from [minValue, maxValue] to [0, 255], shaped by the power scale
+     */
+    void _mapHeights(f32 *heights, u32 width, u32 depth, u32 stride, f32 minValue, f32 maxValue) const;
+    /**
+     * @brief Range of the values of the current fractal, the few out of it are clamped
+     */
+    std::pair<f32, f32> _getFixedRange() const;
+    Noise::FractalParameters _getFractalParameters() const;
+    u32 _getNoiseSeed() const;
+    /**
+     * @brief Measures the samples per second of every basis on the size of the terrain
+     */
+    void _runBenchmark();
 };
 }
-
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <exception>
+#include <expected>
+#include <future>
+#include <stop_token>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include <Common.h>
+#include <slog/slog.h>
+#include <Necrosis/tasks/TaskScheduler.h>
+
+namespace Geophagia {
+
+enum class JobStatus {
+    Idle, ///< @brief Never started, or its result was taken
+    Running,
+    Succeeded,
+    Cancelled, ///< @brief Returned early at a checkpoint after a cancel
+    Failed, ///< @brief Threw an exception
+};
+
+/**
+ * @brief Work done by a job, counted by the job and read by the UI
+ */
+class JobProgress {
+public:
+    /**
+     * @param total Units of work of the job, 0 if it runs until cancelled
+     */
+    void reset(u64 total) {
+        _done.store(0, std::memory_order_relaxed);
+        _total = total;
+        _start = std::chrono::steady_clock::now();
+    }
+    void advance(u64 amount = 1) { _done.fetch_add(amount, std::memory_order_relaxed); }
+
+    u64 getDone() const { return _done.load(std::memory_order_relaxed); }
+    u64 getTotal() const { return _total; }
+    /**
+     * @return In [0, 1], or a negative value if the job has no end
+     */
+    f32 getFraction() const {
+        if (_total == 0) { return -1.f; }
+        return std::min(static_cast<f32>(getDone()) / static_cast<f32>(_total), 1.f);
+    }
+    f32 getElapsedSeconds() const {
+        return std::chrono::duration<f32>(std::chrono::steady_clock::now() - _start).count();
+    }
+    /**
+     * @brief Time left at the rate of the work done so far
+     * @return Negative until the rate is known, or if the job has no end
+     */
+    f32 getRemainingSeconds() const {
+        const u64 done = getDone();
+        if (_total == 0 || done == 0) { return -1.f; }
+        return getElapsedSeconds() * static_cast<f32>(_total - std::min(done, _total)) / static_cast<f32>(done);
+    }
+
+private:
+    std::atomic<u64> _done = 0;
+    // written before the job is submitted, read-only while it runs
+    u64 _total = 0;
+    std::chrono::steady_clock::time_point _start;
+};
+
+/**
+ * @brief What the function of a job gets to report its progress and check for a cancel
+ */
+class JobContext {
+public:
+    JobContext(std::stop_token stopToken, JobProgress &progress) : _stopToken(std::move(stopToken)), _progress(progress) {}
+
+    /**
+     * @brief Cancellation checkpoint, the job returns as soon as it can once true
+     */
+    bool isCancelled() const { return _stopToken.stop_requested(); }
+    /**
+     * @brief Given to the parallel loops of the job, they skip the work not started once cancelled
+     */
+    const std::stop_token& getStopToken() const { return _stopToken; }
+    void advance(u64 amount = 1) { _progress.advance(amount); }
+
+private:
+    std::stop_token _stopToken;
+    JobProgress &_progress;
+};
+
+/**
+ * @brief Background job of a generator, cancellable, with its progress
+ *
+ * The function runs on the task scheduler and gets a `JobContext`. The UI thread polls
+ * `isFinished` and takes the result, or the reason there is none.
+ */
+template <typename Result>
+class GeneratorJob {
+public:
+    /**
+     * @param name Used in the logs, e.g. "fractal generation"
+     */
+    explicit GeneratorJob(std::string name) : _name(std::move(name)) {}
+    /**
+     * @brief Cancels the job and waits for it. The owner should do it before the data
+     * the job uses is destroyed
+     */
+    ~GeneratorJob() {
+        cancel();
+        wait();
+    }
+
+    GeneratorJob(const GeneratorJob&) = delete;
+    GeneratorJob& operator=(const GeneratorJob&) = delete;
+
+    /**
+     * @brief Runs `function(context)` on the scheduler. The job must not be running
+     *
+     * @param totalWork Units of work the function reports through `context.advance`,
+     * 0 if it runs until cancelled. Such a job gets a thread of its own, so it doesn't hold
+     * a worker of the scheduler for as long as it runs
+     */
+    template <typename Function>
+    void start(Necrosis::TaskScheduler &scheduler, u64 totalWork, Function &&function) {
+        assert(!isRunning() && "The job is already running");
+
+        _stopSource = std::stop_source();
+        _progress.reset(totalWork);
+        _error.clear();
+        _status = JobStatus::Running;
+        auto job = [this, stopToken = _stopSource.get_token(), function = std::forward<Function>(function)]() mutable -> Result {
+            JobContext context(stopToken, _progress);
+            try {
+                if constexpr (std::is_void_v<Result>) {
+                    function(context);
+                    _finish(context);
+                }
+                else {
+                    Result result = function(context);
+                    _finish(context);
+                    return result;
+                }
+            }
+            catch (const std::exception &exception) {
+                _error = exception.what();
+                _status = JobStatus::Failed;
+                throw;
+            }
+            catch (...) {
+                _error = "unknown exception";
+                _status = JobStatus::Failed;
+                throw;
+            }
+        };
+        _future = totalWork == 0 ? scheduler.submitDedicated(std::move(job)) : scheduler.submit(std::move(job));
+    }
+
+    /**
+     * @brief Asks the job to stop at its next checkpoint
+     */
+    void cancel() { _stopSource.request_stop(); }
+    void wait() const {
+        if (_future.valid()) {
+            _future.wait();
+        }
+    }
+
+    /**
+     * @brief From the start until the result is taken
+     */
+    bool isRunning() const { return _future.valid(); }
+    bool isFinished() const {
+        return _future.valid() && _future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    }
+    bool isCancelling() const { return isRunning() && _stopSource.stop_requested(); }
+    /**
+     * @brief Only final once `isFinished`
+     */
+    JobStatus getStatus() const { return _status; }
+    const JobProgress& getProgress() const { return _progress; }
+
+    /**
+     * @brief Result of the finished job, or its status if it was cancelled or failed, which is logged.
+     * The job is idle afterwards
+     */
+    std::expected<Result, JobStatus> take() {
+        assert(isFinished() && "The job is not finished");
+
+        const JobStatus status = _status;
+        _status = JobStatus::Idle;
+        if (status == JobStatus::Failed) {
+            _future = {};
+            slog::warning("The {} failed: {}", _name, _error);
+            return std::unexpected(status);
+        }
+        if (status == JobStatus::Cancelled) {
+            _future = {};
+            slog::info("The {} was cancelled after {:.1f} s", _name, _progress.getElapsedSeconds());
+            return std::unexpected(status);
+        }
+        if constexpr (std::is_void_v<Result>) {
+            _future.get();
+            return {};
+        }
+        else {
+            return _future.get();
+        }
+    }
+
+private:
+    std::string _name;
+    std::future<Result> _future;
+    std::stop_source _stopSource;
+    JobProgress _progress;
+    std::atomic<JobStatus> _status = JobStatus::Idle;
+    std::string _error; ///< @brief Message of the exception of a failed job
+
+    void _finish(const JobContext &context) {
+        _status = context.isCancelled() ? JobStatus::Cancelled : JobStatus::Succeeded;
+    }
+};
+
+}
@@ -0,0 +1,41 @@
+#include "HeightmapGenerator.h"
+
+#include <cstdio>
+
+#include <imgui/imgui.h>
+
+namespace Geophagia {
+
+bool HeightmapGenerator::_uiJobProgress(const JobProgress &progress, bool isCancelling) {
+    const f32 fraction = progress.getFraction();
+    const f32 remaining = progress.getRemainingSeconds();
+
+    char overlay[64];
+    if (isCancelling) {
+        std::snprintf(overlay, sizeof(overlay), "cancelling...");
+    }
+    else if (fraction < 0.f) {
+        std::snprintf(overlay, sizeof(overlay), "%.1f s", progress.getElapsedSeconds());
+    }
+    else if (remaining >= 0.f) {
+        std::snprintf(overlay, sizeof(overlay), "%.0f%% - %.1f s left", fraction * 100.f, remaining);
+    }
+    else {
+        std::snprintf(overlay, sizeof(overlay), "%.0f%%", fraction * 100.f);
+    }
+
+    // a job without an end gets the animated bar
+    const f32 barFraction = fraction < 0.f ? -static_cast<f32>(ImGui::GetTime()) : fraction;
+    const f32 buttonWidth = ImGui::CalcTextSize("Cancel").x + 2.f * ImGui::GetStyle().FramePadding.x;
+    // the bars of several jobs may be in the same window
+    ImGui::PushID(&progress);
+    ImGui::ProgressBar(barFraction, ImVec2(-(buttonWidth + ImGui::GetStyle().ItemSpacing.x), 0.f), overlay);
+    ImGui::SameLine();
+    ImGui::BeginDisabled(isCancelling);
+    const bool isCancelClicked = ImGui::Button("Cancel");
+    ImGui::EndDisabled();
+    ImGui::PopID();
+    return isCancelClicked;
+}
+
+}
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <Common.h>
+#include <Necrosis/tasks/TaskScheduler.h>
 
+#include "GeneratorJob.h"
 #include "../Terrain.h"
 
 namespace Geophagia {
@@ -11,7 +13,8 @@ namespace Geophagia {
 class HeightmapGenerator {
 public:
     HeightmapGenerator() = default;
-    HeightmapGenerator(Terrain *terrain) : _terrain(terrain) {}
+    HeightmapGenerator(Terrain *terrain, Necrosis::TaskScheduler &taskScheduler)
+        : _terrain(terrain), _taskScheduler(&taskScheduler) {}
     virtual ~HeightmapGenerator() = default;
 
     /**
@@ -23,7 +26,17 @@ public:
 
 protected:
     Terrain *_terrain = nullptr;
+    /**
+     * @brief Shared by all the generators, runs their background jobs and parallel loops
+     */
+    Necrosis::TaskScheduler *_taskScheduler = nullptr;
 
     u64 _seed = 0;
+
+    /**
+     * @brief Renders the progress bar of a running job, with the time left, and a button to cancel it
+     * @return true if the cancel button was clicked
+     */
+    static bool _uiJobProgress(const JobProgress &progress, bool isCancelling);
 };
 }
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <Common.h>
+
+#include "../../Utils/AlignedAllocator.h"
+
+// The planes of the state never overlap, this tells the compiler it can vectorize
+// the kernels without emitting runtime alias checks between every pair of planes
+#if defined(__clang__)
+    #define GEOPHAGIA_IVDEP _Pragma("clang loop vectorize(assume_safety)")
+#elif defined(__GNUC__)
+    #define GEOPHAGIA_IVDEP _Pragma("GCC ivdep")
+#elif defined(_MSC_VER)
+    #define GEOPHAGIA_IVDEP __pragma(loop(ivdep))
+#else
+    #define GEOPHAGIA_IVDEP
+#endif
+
+namespace Geophagia {
+/**
+ * @brief State of the hydraulic erosion simulation stored as a structure of arrays
+ *
+ * Every quantity lives in its own cache line aligned plane of width * depth floats
+ * so the kernels stream through contiguous memory and can be vectorized.
+ * The fluxes are the outflows of a cell towards its 4 neighbours. Top is +y and bottom is -y.
+ */
+struct HydraulicState {
+    AlignedVector<f32> water;
+    AlignedVector<f32> sediment; ///< @brief Suspended sediment amount
+
+    AlignedVector<f32> fluxLeft;
+    AlignedVector<f32> fluxRight;
+    AlignedVector<f32> fluxTop;
+    AlignedVector<f32> fluxBottom;
+
+    AlignedVector<f32> velocityX;
+    AlignedVector<f32> velocityY;
+
+    // scratch planes, sized once so a step never allocates
+    /**
+     * @brief Height change computed by the erosion pass and applied in the next one.
+     * The cells on the border of the map are never written and stay at 0
+     */
+    AlignedVector<f32> heightDelta;
+    AlignedVector<f32> nextSediment; ///< @brief Back buffer of `sediment` written by the transport
+
+    /**
+     * @brief Resizes all the planes to `size` cells and sets them to 0
+     */
+    void reset(size_t size) {
+        for (auto *plane : {
+            &water, &sediment, &fluxLeft, &fluxRight, &fluxTop, &fluxBottom, &velocityX, &velocityY,
+            &heightDelta, &nextSediment
+        }) {
+            plane->assign(size, 0.f);
+        }
+    }
+
+    /**
+     * @brief Makes the sediment written by the transport the current one
+     */
+    void swapSediment() {
+        sediment.swap(nextSediment);
+    }
+};
+}
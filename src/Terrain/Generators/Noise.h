@@ -0,0 +1,536 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include <Common.h>
+
+// the bases are sampled in loops that only vectorize once the basis is inlined,
+// which the compiler can decline when a file instantiates many graphs
+#if defined(_MSC_VER)
+#define NOISE_INLINE __forceinline
+#else
+#define NOISE_INLINE [[gnu::always_inline]] inline
+#endif
+
+namespace Geophagia {
+/**
+ * @brief Noise functions that compose into a single kernel at compile time
+ *
+ * The nodes are small structs sampling batches of points with
+ * `void sampleBatch(const f64 *xs, const f64 *ys, u32 count, f32 *samples) const`.
+ * The basis nodes give values around [-1, 1], the fractal nodes sum octaves of a basis
+ * and `DomainWarp` moves the points of a source by another node. As the nodes are template
+ * parameters of each other, a whole graph is inlined in the loops that sample it, with no
+ * dispatch per sample.
+ *
+ * The points are in world space, in doubles, and the bases hash the cells of their
+ * lattice with arithmetic only: the noise doesn't repeat, and a point gives the same
+ * bits whatever the chunk it is sampled in, so the chunks of a world generated
+ * separately match at their borders. Only the position in a cell is in floats.
+ * With no table lookups, the compiler vectorizes a batch of samples.
+ */
+namespace Noise {
+    static constexpr u32 BATCH_SIZE = 64; ///< @brief Largest number of points of `sampleBatch`
+
+    /**
+     * @brief Cell of the lattice containing the coordinate `x`, exact for |x| < 2^51
+     */
+    NOISE_INLINE f64 floorCell(f64 x) {
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(__SSE4_1__) && !defined(__AVX__)
+        // std::floor is a call per point without the rounding instructions of SSE4.1: the sum
+        // rounds x to an integer in the last bits of its mantissa, stepped down when above x
+        constexpr f64 OFFSET = 0x1.8p52;
+        const f64 rounded = (x + OFFSET) - OFFSET;
+        return rounded > x ? rounded - 1.0 : rounded;
+#else
+        return std::floor(x);
+#endif
+    }
+
+    /**
+     * @brief Hashes a column or a row, as the 2 halves of the 64-bit integer of its cell, with the seed,
+     * the half of the hash of a cell shared by all the cells of the column or row, mixed by `hashCell`.
+     * `multiplier` differs for the 2 axes, so the cells (x, y) and (y, x) differ
+     */
+    NOISE_INLINE u32 hashAxis(u32 low, u32 high, u32 seed, u32 multiplier) {
+        return ((low ^ seed) * multiplier) ^ high;
+    }
+
+    /**
+     * @brief Mixes the hashes of the column and the row of a cell, giving its 32 random bits
+     */
+    NOISE_INLINE u32 hashCell(u32 column, u32 row) {
+        const u32 h = (column ^ row) * 0x2C1B3C6Du;
+        return h ^ (h >> 16);
+    }
+
+    /**
+     * @brief Hashes of the cells around a batch of points, from `FIRST` to `LAST` cells away on both axes
+     *
+     * Only the cells of the points are doubles, `set` hashes the columns and the rows around
+     * them into 32-bit integers, so the bases finish the hashes of the cells with one multiply
+     * each, vectorized over twice as many points as the doubles.
+     */
+    template <int FIRST, int LAST>
+    struct CellBatch {
+        static constexpr int SIZE = LAST - FIRST + 1;
+
+        u32 columns[SIZE][BATCH_SIZE];
+        u32 rows[SIZE][BATCH_SIZE];
+
+        /**
+         * @brief Hashes the columns and the rows around the cells (cellXs[i], cellYs[i]) of the points
+         */
+        NOISE_INLINE void set(const f64 *cellXs, const f64 *cellYs, u32 count, u32 seed) {
+            u64 farCount = 0;
+            u64 otherRowCount = 0;
+            for (u32 i = 0; i < count; i++) {
+                farCount += std::abs(cellXs[i]) >= 0x1p30 ? 1 : 0;
+                farCount += std::abs(cellYs[i]) >= 0x1p30 ? 1 : 0;
+                otherRowCount += cellYs[i] != cellYs[0] ? 1 : 0;
+            }
+            // the batches along a row of the world share the rows of their cells
+            const u32 rowCount = otherRowCount == 0 ? 1 : count;
+            if (farCount == 0) {
+                _hashNear(columns, cellXs, count, seed, 0x27D4EB2Du);
+                _hashNear(rows, cellYs, rowCount, seed, 0x165667B1u);
+            }
+            else {
+                _hashFar(columns, cellXs, count, seed, 0x27D4EB2Du);
+                _hashFar(rows, cellYs, rowCount, seed, 0x165667B1u);
+            }
+            for (int offset = 0; offset < SIZE; offset++) {
+                std::fill(rows[offset] + rowCount, rows[offset] + count, rows[offset][0]);
+            }
+        }
+
+        /**
+         * @brief Random bits of the cell (offsetX, offsetY) away from the cell of the point `i`
+         */
+        NOISE_INLINE u32 operator()(u32 i, int offsetX, int offsetY) const {
+            return hashCell(columns[offsetX - FIRST][i], rows[offsetY - FIRST][i]);
+        }
+
+    private:
+        // the cells are 64-bit integers hashed in 2 halves, converted from 32-bit integers when
+        // they all fit, else from the bits of the doubles, slower to vectorize
+
+        NOISE_INLINE static void _hashNear(u32 (&hashes)[SIZE][BATCH_SIZE], const f64 *cells, u32 count, u32 seed, u32 multiplier) {
+            for (u32 i = 0; i < count; i++) {
+                const i32 cell = static_cast<i32>(cells[i]);
+                for (int offset = FIRST; offset <= LAST; offset++) {
+                    const i32 moved = cell + offset;
+                    hashes[offset - FIRST][i] = hashAxis(static_cast<u32>(moved), static_cast<u32>(moved >> 31), seed, multiplier);
+                }
+            }
+        }
+
+        NOISE_INLINE static void _hashFar(u32 (&hashes)[SIZE][BATCH_SIZE], const f64 *cells, u32 count, u32 seed, u32 multiplier) {
+            // the integer is in the last bits of the mantissa of the sum, for |cell| < 2^51
+            for (u32 i = 0; i < count; i++) {
+                for (int offset = FIRST; offset <= LAST; offset++) {
+                    const u64 key = std::bit_cast<u64>(cells[i] + offset + 0x1.8p52);
+                    hashes[offset - FIRST][i] = hashAxis(static_cast<u32>(key), static_cast<u32>(key >> 32) - 0x43380000u, seed, multiplier);
+                }
+            }
+        }
+    };
+
+    /**
+     * @brief 16 bits of `h` as a float in [-1, 1]
+     */
+    NOISE_INLINE f32 toSignedUnit(u32 h) {
+        return static_cast<f32>(h & 0xFFFF) * (2.f / 65535.f) - 1.f;
+    }
+
+    /**
+     * @brief Dot product of (dx, dy) with the gradient of the corner of a cell, from its hash
+     */
+    NOISE_INLINE f32 gradientDot(u32 h, f32 dx, f32 dy) {
+        return toSignedUnit(h) * dx + toSignedUnit(h >> 16) * dy;
+    }
+
+    NOISE_INLINE f32 fade(f32 t) {
+        return t * t * t * (t * (t * 6.f - 15.f) + 10.f);
+    }
+
+    NOISE_INLINE f32 lerp(f32 p, f32 q, f32 t) {
+        return p * (1.f - t) + q * t;
+    }
+
+    // bases, sampled in 2 loops over the batch: the cells in doubles, then the hashes in floats and integers
+
+    /**
+     * @brief Gradient noise: random gradients on the lattice, smoothly interpolated
+     */
+    struct Perlin {
+        u32 seed;
+
+        NOISE_INLINE void sampleBatch(const f64 *xs, const f64 *ys, u32 count, f32 *samples) const {
+            CellBatch<0, 1> cells;
+            f64 cellXs[BATCH_SIZE], cellYs[BATCH_SIZE];
+            f32 us[BATCH_SIZE], vs[BATCH_SIZE];
+            for (u32 i = 0; i < count; i++) {
+                cellXs[i] = floorCell(xs[i]);
+                cellYs[i] = floorCell(ys[i]);
+                us[i] = static_cast<f32>(xs[i] - cellXs[i]);
+                vs[i] = static_cast<f32>(ys[i] - cellYs[i]);
+            }
+            cells.set(cellXs, cellYs, count, seed);
+
+            for (u32 i = 0; i < count; i++) {
+                const f32 u = us[i], v = vs[i];
+                const f32 fadeU = fade(u);
+                const f32 a = lerp(gradientDot(cells(i, 0, 0), u, v), gradientDot(cells(i, 1, 0), u - 1.f, v), fadeU);
+                const f32 b = lerp(
+                    gradientDot(cells(i, 0, 1), u, v - 1.f), gradientDot(cells(i, 1, 1), u - 1.f, v - 1.f), fadeU
+                );
+                samples[i] = lerp(a, b, fade(v));
+            }
+        }
+    };
+
+    /**
+     * @brief 2D simplex noise: gradients on the corners of a triangular lattice,
+     * which has fewer corners per point and less directional artifacts than the square one
+     */
+    struct Simplex {
+        u32 seed;
+
+        NOISE_INLINE void sampleBatch(const f64 *xs, const f64 *ys, u32 count, f32 *samples) const {
+            _sampleBatch<false>(xs, ys, count, samples, nullptr);
+        }
+
+        /**
+         * @brief Samples 2 decorrelated noises at once, `samples` as `sampleBatch` and `others`
+         * from the gradients of a second hash of the corners, sharing the cells of the points
+         */
+        NOISE_INLINE void samplePairBatch(const f64 *xs, const f64 *ys, u32 count, f32 *samples, f32 *others) const {
+            _sampleBatch<true>(xs, ys, count, samples, others);
+        }
+
+    private:
+        template <bool IS_PAIR>
+        NOISE_INLINE void _sampleBatch(const f64 *xs, const f64 *ys, u32 count, f32 *samples, f32 *others) const {
+            constexpr f64 SKEW = 0.36602540378443865; // (sqrt(3) - 1) / 2
+            constexpr f32 UNSKEW = 0.211324865405f; // (3 - sqrt(3)) / 6
+
+            CellBatch<0, 1> cells;
+            f64 cellXs[BATCH_SIZE], cellYs[BATCH_SIZE];
+            f32 x0s[BATCH_SIZE], y0s[BATCH_SIZE];
+            for (u32 i = 0; i < count; i++) {
+                // cell of the skewed lattice and position in it, unskewed from its corner
+                const f64 skew = (xs[i] + ys[i]) * SKEW;
+                const f64 skewedX = xs[i] + skew, skewedY = ys[i] + skew;
+                cellXs[i] = floorCell(skewedX);
+                cellYs[i] = floorCell(skewedY);
+                const f32 u = static_cast<f32>(skewedX - cellXs[i]), v = static_cast<f32>(skewedY - cellYs[i]);
+                const f32 unskew = (u + v) * UNSKEW;
+                x0s[i] = u - unskew;
+                y0s[i] = v - unskew;
+            }
+            cells.set(cellXs, cellYs, count, seed);
+
+            for (u32 i = 0; i < count; i++) {
+                const f32 x0 = x0s[i], y0 = y0s[i];
+                // the triangle is the lower or the upper half of the cell, its middle corner
+                // is the next column or the next row, selected before hashing it
+                const u32 lowerMask = static_cast<u32>(static_cast<i32>(std::bit_cast<u32>(y0 - x0)) >> 31);
+                const f32 stepX = std::bit_cast<f32>(lowerMask & 0x3F800000u);
+                const f32 stepY = 1.f - stepX;
+                const f32 x1 = x0 - stepX + UNSKEW, y1 = y0 - stepY + UNSKEW;
+                const f32 x2 = x0 - 1.f + 2.f * UNSKEW, y2 = y0 - 1.f + 2.f * UNSKEW;
+                const u32 first = cells(i, 0, 0);
+                const u32 middle = hashCell(
+                    (cells.columns[1][i] & lowerMask) | (cells.columns[0][i] & ~lowerMask),
+                    (cells.rows[0][i] & lowerMask) | (cells.rows[1][i] & ~lowerMask)
+                );
+                const u32 last = cells(i, 1, 1);
+
+                const f32 weight0 = _weight(x0, y0), weight1 = _weight(x1, y1), weight2 = _weight(x2, y2);
+                samples[i] = 70.f * (weight0 * gradientDot(first, x0, y0) + weight1 * gradientDot(middle, x1, y1)
+                                     + weight2 * gradientDot(last, x2, y2));
+                if constexpr (IS_PAIR) {
+                    // any constant does as the row, the hash of the corner being the column
+                    others[i] = 70.f * (weight0 * gradientDot(hashCell(first, 0x9E3779B9u), x0, y0)
+                                        + weight1 * gradientDot(hashCell(middle, 0x9E3779B9u), x1, y1)
+                                        + weight2 * gradientDot(hashCell(last, 0x9E3779B9u), x2, y2));
+                }
+            }
+        }
+
+        /**
+         * @brief Falloff of a corner at (dx, dy) from the point, 0 beyond its radius
+         */
+        NOISE_INLINE static f32 _weight(f32 dx, f32 dy) {
+            const f32 t = std::max(0.5f - dx * dx - dy * dy, 0.f);
+            return t * t * t * t;
+        }
+    };
+
+    /**
+     * @brief Random values on the lattice, smoothly interpolated
+     */
+    struct Value {
+        u32 seed;
+
+        NOISE_INLINE void sampleBatch(const f64 *xs, const f64 *ys, u32 count, f32 *samples) const {
+            CellBatch<0, 1> cells;
+            f64 cellXs[BATCH_SIZE], cellYs[BATCH_SIZE];
+            f32 us[BATCH_SIZE], vs[BATCH_SIZE];
+            for (u32 i = 0; i < count; i++) {
+                cellXs[i] = floorCell(xs[i]);
+                cellYs[i] = floorCell(ys[i]);
+                us[i] = fade(static_cast<f32>(xs[i] - cellXs[i]));
+                vs[i] = fade(static_cast<f32>(ys[i] - cellYs[i]));
+            }
+            cells.set(cellXs, cellYs, count, seed);
+
+            for (u32 i = 0; i < count; i++) {
+                const f32 a = lerp(toSignedUnit(cells(i, 0, 0)), toSignedUnit(cells(i, 1, 0)), us[i]);
+                const f32 b = lerp(toSignedUnit(cells(i, 0, 1)), toSignedUnit(cells(i, 1, 1)), us[i]);
+                samples[i] = lerp(a, b, vs[i]);
+            }
+        }
+    };
+
+    /**
+     * @brief Cellular noise: distance to the closest of the points scattered one per cell
+     *
+     * Each point is in the central half of its cell, so the closest one to a sampled
+     * point is in the 2x2 cells with the closest centers, rather than in the 3x3 cells
+     * around when the points can be anywhere in their cells.
+     */
+    struct Worley {
+        u32 seed;
+
+        NOISE_INLINE void sampleBatch(const f64 *xs, const f64 *ys, u32 count, f32 *samples) const {
+            CellBatch<0, 1> cells;
+            f64 cellXs[BATCH_SIZE], cellYs[BATCH_SIZE];
+            f32 us[BATCH_SIZE], vs[BATCH_SIZE];
+            for (u32 i = 0; i < count; i++) {
+                // the 2x2 cells with the closest centers start at the cell of the point moved by half a cell
+                const f64 x = xs[i] - 0.5, y = ys[i] - 0.5;
+                cellXs[i] = floorCell(x);
+                cellYs[i] = floorCell(y);
+                us[i] = static_cast<f32>(x - cellXs[i]);
+                vs[i] = static_cast<f32>(y - cellYs[i]);
+            }
+            cells.set(cellXs, cellYs, count, seed);
+
+            for (u32 i = 0; i < count; i++) {
+                // from the sampled point to the corners of the cells less a quarter of a cell, as
+                // the hashes give offsets in [0.5, 1) for the points in [0.25, 0.75)
+                const f32 nearX = -0.75f - us[i], farX = 0.25f - us[i];
+                const f32 nearY = -0.75f - vs[i], farY = 0.25f - vs[i];
+                f32 closest = _distance(cells(i, 0, 0), nearX, nearY);
+                closest = std::min(closest, _distance(cells(i, 1, 0), farX, nearY));
+                closest = std::min(closest, _distance(cells(i, 0, 1), nearX, farY));
+                closest = std::min(closest, _distance(cells(i, 1, 1), farX, farY));
+                // the distance is in [0, 0.75 sqrt(2)), mostly below 0.8
+                samples[i] = std::sqrt(closest) * 2.5f - 1.f;
+            }
+        }
+
+    private:
+        /**
+         * @brief Squared distance to the point of the cell of hash `h`, at offsets in [0.5, 1)
+         * from (startX, startY), relative to the sampled point
+         */
+        NOISE_INLINE static f32 _distance(u32 h, f32 startX, f32 startY) {
+            // the 2 halves of the hash as the mantissas of floats in [0.5, 1)
+            const f32 dx = startX + std::bit_cast<f32>(((h << 7) & 0x7FFF80u) | 0x3F000000u);
+            const f32 dy = startY + std::bit_cast<f32>((h >> 9) | 0x3F000000u);
+            return dx * dx + dy * dy;
+        }
+    };
+
+    // fractals
+
+    /**
+     * @brief Samples `node` at the points (xs[i], ys[i]) for i in [0, count) into `samples`,
+     * with the batched function of the node if it has one
+     */
+    template <typename Node>
+    void sampleBatch(const Node &node, const f64 *xs, const f64 *ys, u32 count, f32 *samples) {
+        if constexpr (requires { node.sampleBatch(xs, ys, count, samples); }) {
+            node.sampleBatch(xs, ys, count, samples);
+        }
+        else {
+            for (u32 i = 0; i < count; i++) {
+                samples[i] = node(xs[i], ys[i]);
+            }
+        }
+    }
+
+    struct FractalParameters {
+        int octaves = 3;
+        f64 frequency = 0.005; ///< @brief Of the first octave, in cycles per cell
+        f32 persistence = 0.5f; ///< @brief Amplitude ratio between two octaves
+        f32 lacunarity = 2.f; ///< @brief Frequency ratio between two octaves
+    };
+
+    /**
+     * @brief Calls `accumulate(i, sample, amplitude)` for every octave and every point of a batch
+     *
+     * The octaves are the outer loop, so the basis samples the whole batch at once,
+     * with nothing carried from one point to the next, which the compiler vectorizes.
+     */
+    template <typename Basis, typename Accumulate>
+    void forEachOctave(
+        const Basis &basis, const FractalParameters &parameters, const f64 *xs, const f64 *ys, u32 count,
+        Accumulate &&accumulate
+    ) {
+        f64 octaveXs[BATCH_SIZE];
+        f64 octaveYs[BATCH_SIZE];
+        f32 samples[BATCH_SIZE];
+        f64 frequency = parameters.frequency;
+        f32 amplitude = 1.f;
+        for (int octave = 0; octave < parameters.octaves; octave++) {
+            for (u32 i = 0; i < count; i++) {
+                octaveXs[i] = xs[i] * frequency;
+                octaveYs[i] = ys[i] * frequency;
+            }
+            Noise::sampleBatch(basis, octaveXs, octaveYs, count, samples);
+            for (u32 i = 0; i < count; i++) {
+                accumulate(i, samples[i], amplitude);
+            }
+            amplitude *= parameters.persistence;
+            frequency *= parameters.lacunarity;
+        }
+    }
+
+    /**
+     * @brief Fractal brownian motion: sum of the octaves mapped to [0, 1]
+     */
+    template <typename Basis>
+    struct Fbm {
+        Basis basis;
+        FractalParameters parameters;
+
+        void sampleBatch(const f64 *xs, const f64 *ys, u32 count, f32 *samples) const {
+            f32 sums[BATCH_SIZE] = {};
+            forEachOctave(basis, parameters, xs, ys, count, [&](u32 i, f32 sample, f32 amplitude) {
+                sums[i] += amplitude * ((sample + 1.f) * 0.5f);
+            });
+            std::copy_n(sums, count, samples);
+        }
+    };
+
+    /**
+     * @brief Ridged multifractal: sharp crests where the basis crosses 0, each octave
+     * weighted by the previous one so the details gather on the ridges
+     */
+    template <typename Basis>
+    struct Ridged {
+        Basis basis;
+        FractalParameters parameters;
+
+        void sampleBatch(const f64 *xs, const f64 *ys, u32 count, f32 *samples) const {
+            f32 sums[BATCH_SIZE] = {};
+            f32 weights[BATCH_SIZE];
+            std::fill_n(weights, count, 1.f);
+            forEachOctave(basis, parameters, xs, ys, count, [&](u32 i, f32 sample, f32 amplitude) {
+                const f32 ridge = (1.f - std::abs(sample)) * weights[i];
+                weights[i] = std::clamp(ridge, 0.f, 1.f);
+                sums[i] += ridge * amplitude;
+            });
+            std::copy_n(sums, count, samples);
+        }
+    };
+
+    /**
+     * @brief Sum of the absolute values of the octaves: round hills and sharp valleys
+     */
+    template <typename Basis>
+    struct Billow {
+        Basis basis;
+        FractalParameters parameters;
+
+        void sampleBatch(const f64 *xs, const f64 *ys, u32 count, f32 *samples) const {
+            f32 sums[BATCH_SIZE] = {};
+            forEachOctave(basis, parameters, xs, ys, count, [&](u32 i, f32 sample, f32 amplitude) {
+                sums[i] += amplitude * std::abs(sample);
+            });
+            std::copy_n(sums, count, samples);
+        }
+    };
+
+    /**
+     * @brief Hybrid multifractal (Musgrave): each octave is weighted by the sum so far,
+     * smooth in the valleys and rough on the heights
+     */
+    template <typename Basis>
+    struct Hybrid {
+        static constexpr f32 OFFSET = 0.7f; ///< @brief Keeps the octaves mostly positive
+
+        Basis basis;
+        FractalParameters parameters;
+
+        void sampleBatch(const f64 *xs, const f64 *ys, u32 count, f32 *samples) const {
+            // with a weight of 1, the first octave starts the sum and the weight
+            f32 sums[BATCH_SIZE] = {};
+            f32 weights[BATCH_SIZE];
+            std::fill_n(weights, count, 1.f);
+            forEachOctave(basis, parameters, xs, ys, count, [&](u32 i, f32 sample, f32 amplitude) {
+                const f32 signal = (sample + OFFSET) * amplitude;
+                const f32 weight = std::min(weights[i], 1.f);
+                sums[i] += weight * signal;
+                weights[i] = weight * signal;
+            });
+            std::copy_n(sums, count, samples);
+        }
+    };
+
+    // modifiers
+
+    /**
+     * @brief Samples `source` at points moved by `warp`, which bends its features
+     */
+    template <typename Warp, typename Source>
+    struct DomainWarp {
+        Warp warp;
+        Source source;
+        f64 frequency; ///< @brief Of the warp, in cycles per cell
+        f32 strength; ///< @brief Largest move in cells, for a warp in [-1, 1]
+
+        void sampleBatch(const f64 *xs, const f64 *ys, u32 count, f32 *samples) const {
+            f64 warpXs[BATCH_SIZE];
+            f64 warpYs[BATCH_SIZE];
+            f32 moves[BATCH_SIZE];
+            f64 movedXs[BATCH_SIZE];
+            f64 movedYs[BATCH_SIZE];
+            for (u32 i = 0; i < count; i++) {
+                warpXs[i] = xs[i] * frequency + 31.7;
+                warpYs[i] = ys[i] * frequency - 12.9;
+            }
+            // a warp sampling 2 decorrelated noises at once moves both axes from a single batch
+            if constexpr (requires { warp.samplePairBatch(warpXs, warpYs, count, moves, moves); }) {
+                f32 otherMoves[BATCH_SIZE];
+                warp.samplePairBatch(warpXs, warpYs, count, moves, otherMoves);
+                for (u32 i = 0; i < count; i++) {
+                    movedXs[i] = xs[i] + strength * moves[i];
+                    movedYs[i] = ys[i] + strength * otherMoves[i];
+                }
+                Noise::sampleBatch(source, movedXs, movedYs, count, samples);
+                return;
+            }
+
+            // else 2 decorrelated batches of the warp for the 2 axes
+            Noise::sampleBatch(warp, warpXs, warpYs, count, moves);
+            for (u32 i = 0; i < count; i++) {
+                movedXs[i] = xs[i] + strength * moves[i];
+                warpXs[i] = xs[i] * frequency - 47.3;
+                warpYs[i] = ys[i] * frequency + 83.1;
+            }
+            Noise::sampleBatch(warp, warpXs, warpYs, count, moves);
+            for (u32 i = 0; i < count; i++) {
+                movedYs[i] = ys[i] + strength * moves[i];
+            }
+            Noise::sampleBatch(source, movedXs, movedYs, count, samples);
+        }
+    };
+}
+}
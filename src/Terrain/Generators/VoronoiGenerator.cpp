@@ -1,5 +1,8 @@
 #include "VoronoiGenerator.h"
 
+#include <algorithm>
+#include <chrono>
+#include <limits>
 #include <random>
 
 #include <imgui/imgui.h>
@@ -7,22 +10,146 @@
 namespace Geophagia {
 
 VoronoiGenerator::VoronoiGenerator() : HeightmapGenerator(), _numCentroids(15) {}
-VoronoiGenerator::VoronoiGenerator(Terrain *terrain) : HeightmapGenerator(terrain), _numCentroids(15) {}
+VoronoiGenerator::VoronoiGenerator(Terrain *terrain, Necrosis::TaskScheduler &taskScheduler)
+    : HeightmapGenerator(terrain, taskScheduler), _numCentroids(15) {}
 
-VoronoiGenerator::~VoronoiGenerator() {}
+VoronoiGenerator::~VoronoiGenerator() {
+    // the job uses the generator
+    _generationJob.cancel();
+    _generationJob.wait();
+}
 
 void VoronoiGenerator::uiRender() {
     ImGui::Begin("Voronoi Generator");
-
+        // the parameters are read by the generation running in the background
+        const bool isProcessing = _generationJob.isRunning();
+        ImGui::BeginDisabled(isProcessing);
         ImGui::InputScalar("Seed", ImGuiDataType_U64, &_seed);
         ImGui::InputInt("Number of centroids", &_numCentroids);
+        const char *features[] = { "Cell elevation", "F1 distance", "F2 distance", "Edge distance (F2 - F1)", "Blended elevation" };
+        int feature = static_cast<int>(_feature);
+        if (ImGui::Combo("Feature", &feature, features, IM_ARRAYSIZE(features))) {
+            _feature = static_cast<Feature>(feature);
+        }
+        if (_feature == Feature::BlendedElevation) {
+            ImGui::SliderFloat("Smoothness", &_smoothness, 0.05f, 1.f);
+            if (ImGui::IsItemHovered()) {
+                ImGui::SetTooltip("Relative to the mean distance between the centroids");
+            }
+        }
         if (ImGui::Button("Generate")) {
             _generateHeightmap();
         }
+        ImGui::EndDisabled();
+        if (isProcessing) {
+            if (_uiJobProgress(_generationJob.getProgress(), _generationJob.isCancelling())) {
+                _generationJob.cancel();
+            }
+        }
+        else if (_generationMilliseconds > 0.f) {
+            ImGui::Text("Last generation: %.1f ms (%u threads)", _generationMilliseconds, _taskScheduler->getThreadCount());
+        }
 
     ImGui::End();
 }
 
+VoronoiGenerator::CellFeatures VoronoiGenerator::CentroidGrid::findFeatures(f32 x, f32 z, Feature feature, f32 smoothness) const {
+    // beyond it, the weights of the blend are below e^-8 of the closest one
+    constexpr f32 blendCutoff = 8.f;
+
+    const i32 cellX = std::min(static_cast<i32>(x / cellSize), static_cast<i32>(cellsX) - 1);
+    const i32 cellZ = std::min(static_cast<i32>(z / cellSize), static_cast<i32>(cellsZ) - 1);
+
+    // squared distances
+    f32 minDistance = std::numeric_limits<f32>::max();
+    f32 secondDistance = std::numeric_limits<f32>::max();
+    u32 closest = 0;
+    CellFeatures features;
+    // the weights of the blend are relative to the closest distance so far, rescaled when it changes
+    f32 blendDistance = std::numeric_limits<f32>::max();
+    f32 weightSum = 0.f;
+    f32 weightedElevationSum = 0.f;
+    auto visitCell = [&](i32 visitedX, i32 visitedZ) {
+        if (visitedX < 0 || visitedX >= static_cast<i32>(cellsX) || visitedZ < 0 || visitedZ >= static_cast<i32>(cellsZ)) {
+            return;
+        }
+        const u32 cell = static_cast<u32>(visitedZ) * cellsX + static_cast<u32>(visitedX);
+        for (u32 i = cellStarts[cell]; i < cellStarts[cell + 1]; i++) {
+            const f32 dx = xs[i] - x;
+            const f32 dz = zs[i] - z;
+            const f32 distance = dx * dx + dz * dz;
+            if (distance < minDistance || (distance == minDistance && indices[i] < closest)) {
+                secondDistance = minDistance;
+                minDistance = distance;
+                closest = indices[i];
+                features.elevation = elevations[i];
+            }
+            else if (distance < secondDistance) {
+                secondDistance = distance;
+            }
+
+            if (feature == Feature::BlendedElevation) {
+                const f32 length = std::sqrt(distance);
+                if (length > blendDistance + blendCutoff * smoothness) {
+                    continue;
+                }
+                if (length < blendDistance) {
+                    const f32 rescale = std::exp((length - blendDistance) / smoothness);
+                    weightSum *= rescale;
+                    weightedElevationSum *= rescale;
+                    blendDistance = length;
+                }
+                const f32 weight = std::exp((blendDistance - length) / smoothness);
+                weightSum += weight;
+                weightedElevationSum += weight * elevations[i];
+            }
+        }
+    };
+
+    // rings of cells around the cell of the point, until the next ring is farther than needed.
+    // The cells of ring r + 1 are at least r cells away from the point
+    const i32 maxRing = static_cast<i32>(std::max(cellsX, cellsZ));
+    for (i32 ring = 0; ring <= maxRing; ring++) {
+        if (ring == 0) {
+            visitCell(cellX, cellZ);
+        }
+        else {
+            for (i32 offset = -ring; offset <= ring; offset++) {
+                visitCell(cellX + offset, cellZ - ring);
+                visitCell(cellX + offset, cellZ + ring);
+            }
+            for (i32 offset = -ring + 1; offset < ring; offset++) {
+                visitCell(cellX - ring, cellZ + offset);
+                visitCell(cellX + ring, cellZ + offset);
+            }
+        }
+
+        const f32 ringDistance = static_cast<f32>(ring) * cellSize;
+        bool isSearched;
+        switch (feature) {
+        case Feature::Elevation:
+        case Feature::F1:
+            isSearched = minDistance < ringDistance * ringDistance;
+            break;
+        case Feature::F2:
+        case Feature::EdgeDistance:
+            isSearched = secondDistance < ringDistance * ringDistance;
+            break;
+        case Feature::BlendedElevation:
+            isSearched = blendDistance + blendCutoff * smoothness < ringDistance;
+            break;
+        }
+        if (isSearched) {
+            break;
+        }
+    }
+
+    features.f1 = std::sqrt(minDistance);
+    features.f2 = std::sqrt(secondDistance);
+    features.blendedElevation = weightSum > 0.f ? weightedElevationSum / weightSum : features.elevation;
+    return features;
+}
+
 void VoronoiGenerator::_generateHeightmap() {
     if (!_terrain) {
         slog::warning("No terrain was assigned to this heightmap generator");
@@ -33,14 +160,29 @@ void VoronoiGenerator::_generateHeightmap() {
         slog::warning("Not enough centroids to generate voronoi heightmap");
         return;
     }
+    if (_numCentroids < 2 && (_feature == Feature::F2 || _feature == Feature::EdgeDistance)) {
+        slog::warning("The distance to the second closest centroid needs at least 2 centroids");
+        return;
+    }
+    if (_generationJob.isRunning()) { return; }
 
-    u32 width = _terrain->getWidth();
-    u32 depth = _terrain->getDepth();
+    // the parameters are read by the job, the UI is disabled until it's done
+    const u32 width = _terrain->getWidth();
+    const u32 depth = _terrain->getDepth();
+    _generationJob.start(*_taskScheduler, depth, [this, width, depth](JobContext &context) {
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<f32> heights = _computeHeightmap(width, depth, context);
+        _generationMilliseconds = std::chrono::duration<f32, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return heights;
+    });
+}
 
+std::vector<f32> VoronoiGenerator::_computeHeightmap(u32 width, u32 depth, JobContext &context) {
     std::mt19937_64 generator(_seed);
     std::uniform_real_distribution<float> dist(0, 1);
 
     std::vector<glm::vec3> centroids;
+    centroids.reserve(_numCentroids);
 
     for (int i = 0; i < _numCentroids; ++i) {
         float x = dist(generator) * width;
@@ -52,25 +194,117 @@ void VoronoiGenerator::_generateHeightmap() {
         centroids.emplace_back(x, elevation, z);
     }
 
-    std::vector<f32> heights(width * depth);
-
-    for (size_t i = 0; i < heights.size(); i++) {
-        auto current = glm::vec2(i % width, i / width);
-        float minD = glm::length(glm::vec2(0, 0) - glm::vec2(centroids[0].x, centroids[0].z));
+    // bucket the centroids by cell with a counting sort, about 2 per cell
+    CentroidGrid grid;
+    grid.cellSize = std::max(std::sqrt(2.f * width * depth / static_cast<f32>(centroids.size())), 1.f);
+    grid.cellsX = static_cast<u32>(std::ceil(width / grid.cellSize));
+    grid.cellsZ = static_cast<u32>(std::ceil(depth / grid.cellSize));
+    auto cellOf = [&](const glm::vec3 &centroid) {
+        const u32 cellX = std::min(static_cast<u32>(centroid.x / grid.cellSize), grid.cellsX - 1);
+        const u32 cellZ = std::min(static_cast<u32>(centroid.z / grid.cellSize), grid.cellsZ - 1);
+        return cellZ * grid.cellsX + cellX;
+    };
 
-        for (size_t j = 1; j < centroids.size(); j++) {
-            auto c = centroids[j];
+    grid.cellStarts.assign(static_cast<size_t>(grid.cellsX) * grid.cellsZ + 1, 0);
+    for (const glm::vec3 &centroid : centroids) {
+        grid.cellStarts[cellOf(centroid) + 1]++;
+    }
+    for (size_t cell = 1; cell < grid.cellStarts.size(); cell++) {
+        grid.cellStarts[cell] += grid.cellStarts[cell - 1];
+    }
+    grid.xs.resize(centroids.size());
+    grid.zs.resize(centroids.size());
+    grid.elevations.resize(centroids.size());
+    grid.indices.resize(centroids.size());
+    std::vector<u32> cellEnds(grid.cellStarts.begin(), grid.cellStarts.end() - 1);
+    for (u32 i = 0; i < centroids.size(); i++) {
+        const u32 sorted = cellEnds[cellOf(centroids[i])]++;
+        grid.xs[sorted] = centroids[i].x;
+        grid.zs[sorted] = centroids[i].z;
+        grid.elevations[sorted] = centroids[i].y;
+        grid.indices[sorted] = i;
+    }
 
-            float d = glm::length(current - glm::vec2(c.x, c.z));
+    std::vector<f32> heights(static_cast<size_t>(width) * depth);
 
-            if (d < minD) {
-                minD = d;
-                heights[i] = c.y; // the elevation from the centroid
+    // a few bands of rows per thread balance the load
+    const u32 numBands = std::min(depth, 4 * _taskScheduler->getThreadCount());
+    const Feature feature = _feature;
+    // relative to the mean distance between the centroids, so the blend searches as many of them at any density
+    const f32 smoothness = std::max(_smoothness, 0.01f) * std::sqrt(width * depth / static_cast<f32>(centroids.size()));
+    std::vector<f32> bandMaxima(numBands, 0.f);
+    _taskScheduler->parallelFor(numBands, [&](u32 band) {
+        const u32 beginZ = band * depth / numBands;
+        const u32 endZ = (band + 1) * depth / numBands;
+        f32 maximum = 0.f;
+        for (u32 z = beginZ; z < endZ && !context.isCancelled(); z++) {
+            f32 *row = heights.data() + static_cast<size_t>(z) * width;
+            for (u32 x = 0; x < width; x++) {
+                const CellFeatures features = grid.findFeatures(static_cast<f32>(x), static_cast<f32>(z), feature, smoothness);
+                switch (feature) {
+                case Feature::Elevation:
+                    row[x] = features.elevation;
+                    break;
+                case Feature::F1:
+                    row[x] = features.f1;
+                    break;
+                case Feature::F2:
+                    row[x] = features.f2;
+                    break;
+                case Feature::EdgeDistance:
+                    row[x] = features.f2 - features.f1;
+                    break;
+                case Feature::BlendedElevation:
+                    row[x] = features.blendedElevation;
+                    break;
+                }
+                maximum = std::max(maximum, row[x]);
             }
+            context.advance();
         }
+        bandMaxima[band] = maximum;
+    }, context.getStopToken());
+    if (context.isCancelled()) {
+        return {};
     }
 
-    _terrain->loadRawFromMemory(heights, width, depth);
+    // the distances are in cells, stretch them to the range of the elevations
+    if (feature == Feature::F1 || feature == Feature::F2 || feature == Feature::EdgeDistance) {
+        const f32 maximum = *std::max_element(bandMaxima.begin(), bandMaxima.end());
+        const f32 scale = maximum > 0.f ? 255.f / maximum : 0.f;
+        _taskScheduler->parallelFor(numBands, [&](u32 band) {
+            const size_t begin = static_cast<size_t>(band * depth / numBands) * width;
+            const size_t end = static_cast<size_t>((band + 1) * depth / numBands) * width;
+            for (size_t i = begin; i < end; i++) {
+                heights[i] *= scale;
+            }
+        }, context.getStopToken());
+    }
+
+    return heights;
+}
+
+void VoronoiGenerator::update() {
+    if (!_generationJob.isFinished()) {
+        return;
+    }
+
+    std::expected<std::vector<f32>, JobStatus> result = _generationJob.take();
+    if (!result.has_value()) {
+        return;
+    }
+    std::vector<f32> heights = std::move(*result);
+    const u32 width = _terrain->getWidth();
+    const u32 depth = _terrain->getDepth();
+    if (heights.size() != static_cast<size_t>(width) * depth) {
+        slog::warning("The terrain was resized during the generation, the heightmap is dropped");
+        return;
+    }
+    _terrain->loadRawFromMemory(std::move(heights), width, depth);
+    slog::info(
+        "Generated a {}x{} voronoi heightmap of {} centroids in {:.1f} ms on {} threads",
+        width, depth, _numCentroids, _generationMilliseconds, _taskScheduler->getThreadCount()
+    );
 }
 
 
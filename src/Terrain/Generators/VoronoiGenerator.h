@@ -6,14 +6,87 @@ namespace Geophagia {
 class VoronoiGenerator : public HeightmapGenerator {
 public:
     VoronoiGenerator();
-    VoronoiGenerator(Terrain *terrain);
+    VoronoiGenerator(Terrain *terrain, Necrosis::TaskScheduler &taskScheduler);
+    /**
+     * @brief Cancels the generation running in the background and waits for it
+     */
     ~VoronoiGenerator() override;
 
     void uiRender() override;
+    /**
+     * @brief Gives the heightmap to the terrain once the generation started by the UI is done
+     */
+    void update();
+
+    /**
+     * @brief Field of the cells written to the heightmap
+     */
+    enum class Feature {
+        Elevation, ///< @brief Random elevation of the closest centroid, flat cells
+        F1, ///< @brief Distance to the closest centroid
+        F2, ///< @brief Distance to the second closest centroid
+        EdgeDistance, ///< @brief F2 - F1, zero on the edges between the cells
+        BlendedElevation, ///< @brief Elevations of the centroids blended by a smooth-min of their distances
+    };
+
+    /**
+     * @brief Fields of the cells at a point, found by a single search of the centroids
+     */
+    struct CellFeatures {
+        f32 f1 = 0.f;
+        f32 f2 = 0.f;
+        f32 elevation = 0.f; ///< @brief Of the closest centroid
+        f32 blendedElevation = 0.f; ///< @brief Only searched for `Feature::BlendedElevation`
+    };
 
 private:
+    /**
+     * @brief Centroids bucketed in a uniform grid of square cells, about 2 per cell,
+     * so the closest one to a point is searched in the cells around it only
+     */
+    struct CentroidGrid {
+        f32 cellSize = 1.f;
+        u32 cellsX = 0;
+        u32 cellsZ = 0;
+        std::vector<u32> cellStarts; ///< @brief Index of the first centroid of each cell, and the total at the end
+        // centroids sorted by cell
+        std::vector<f32> xs;
+        std::vector<f32> zs;
+        std::vector<f32> elevations;
+        std::vector<u32> indices; ///< @brief Order of generation, which breaks the ties
+
+        /**
+         * @brief Features of the cells at (x, z), the closest centroid is the first generated on a tie
+         *
+         * The search visits the centroids as far as `feature` needs: F2 needs the second closest,
+         * the blend every centroid whose weight is not negligible.
+         *
+         * @param smoothness Distance over which the weights of the blend fall by e
+         */
+        CellFeatures findFeatures(f32 x, f32 z, Feature feature, f32 smoothness) const;
+    };
+
     int _numCentroids;
+    Feature _feature = Feature::Elevation;
+    f32 _smoothness = 0.25f; ///< @brief Of the blended elevation, relative to the mean distance between the centroids
+
+    /**
+     * @brief Generation running in the background, the result goes to the terrain in `update`
+     */
+    GeneratorJob<std::vector<f32>> _generationJob{"voronoi generation"};
+    f32 _generationMilliseconds = 0.f; ///< @brief Duration of the last generation
 
+    /**
+     * @brief Starts the generation of the height values in the background.
+     * `update` notifies the terrain to update its buffers once done
+     */
     void _generateHeightmap();
+    /**
+     * @brief Draws the centroids and finds the feature of every cell, with the rows split in bands
+     * across the task scheduler
+     *
+     * Reports a unit of work per row, and returns early once the job is cancelled.
+     */
+    std::vector<f32> _computeHeightmap(u32 width, u32 depth, JobContext &context);
 };
 }
@@ -0,0 +1,280 @@
+#include "HeightmapFormats.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+
+#include <slog/slog.h>
+
+// defined with the implementation of stb_image_write, but not declared by its header
+extern "C" unsigned char* stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality);
+
+namespace Geophagia::HeightmapFormats {
+
+// The conversions are simple loops over restrict pointers so the compiler vectorizes them
+
+void toHeights(std::span<const u8> pixels, std::span<f32> heights) {
+    expect(pixels.size() == heights.size(), "The pixels and the heights must have the same size");
+    const u8 *__restrict source = pixels.data();
+    f32 *__restrict destination = heights.data();
+    for (size_t i = 0; i < heights.size(); i++) {
+        destination[i] = static_cast<f32>(source[i]);
+    }
+}
+
+void toHeights(std::span<const u16> pixels, std::span<f32> heights) {
+    expect(pixels.size() == heights.size(), "The pixels and the heights must have the same size");
+    const u16 *__restrict source = pixels.data();
+    f32 *__restrict destination = heights.data();
+    for (size_t i = 0; i < heights.size(); i++) {
+        destination[i] = static_cast<f32>(source[i]) * (1.f / 257.f);
+    }
+}
+
+void toPixels(std::span<const f32> heights, std::span<u8> pixels) {
+    expect(pixels.size() == heights.size(), "The pixels and the heights must have the same size");
+    const f32 *__restrict source = heights.data();
+    u8 *__restrict destination = pixels.data();
+    for (size_t i = 0; i < heights.size(); i++) {
+        destination[i] = static_cast<u8>(std::min(std::max(source[i], 0.f), 255.f) + 0.5f);
+    }
+}
+
+void toPixels(std::span<const f32> heights, std::span<u16> pixels) {
+    expect(pixels.size() == heights.size(), "The pixels and the heights must have the same size");
+    const f32 *__restrict source = heights.data();
+    u16 *__restrict destination = pixels.data();
+    for (size_t i = 0; i < heights.size(); i++) {
+        destination[i] = static_cast<u16>(std::min(std::max(source[i] * 257.f, 0.f), 65535.f) + 0.5f);
+    }
+}
+
+// png
+
+constexpr std::array<u32, 256> CRC_TABLE = [] {
+    std::array<u32, 256> table{};
+    for (u32 i = 0; i < 256; i++) {
+        u32 crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+        }
+        table[i] = crc;
+    }
+    return table;
+}();
+
+u32 updateCrc(u32 crc, std::span<const u8> data) {
+    for (const u8 byte : data) {
+        crc = CRC_TABLE[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+void writeBigEndian(std::ofstream &file, u32 value) {
+    const u8 bytes[4] = {
+        static_cast<u8>(value >> 24), static_cast<u8>(value >> 16), static_cast<u8>(value >> 8), static_cast<u8>(value)
+    };
+    file.write(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+}
+
+void writeChunk(std::ofstream &file, const char type[4], std::span<const u8> data) {
+    writeBigEndian(file, static_cast<u32>(data.size()));
+    file.write(type, 4);
+    file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+
+    const u32 crc = updateCrc(updateCrc(0xFFFFFFFFu, { reinterpret_cast<const u8*>(type), 4 }), data);
+    writeBigEndian(file, crc ^ 0xFFFFFFFFu);
+}
+
+u8 paethPredictor(i32 left, i32 up, i32 upLeft) {
+    const i32 estimate = left + up - upLeft;
+    const i32 distanceLeft = std::abs(estimate - left);
+    const i32 distanceUp = std::abs(estimate - up);
+    const i32 distanceUpLeft = std::abs(estimate - upLeft);
+    if (distanceLeft <= distanceUp && distanceLeft <= distanceUpLeft) { return static_cast<u8>(left); }
+    if (distanceUp <= distanceUpLeft) { return static_cast<u8>(up); }
+    return static_cast<u8>(upLeft);
+}
+
+bool writePng16(const std::filesystem::path &path, std::span<const u16> pixels, u32 width, u32 height) {
+    expect(pixels.size() == static_cast<size_t>(width) * height, "The size of the image is invalid");
+
+    const size_t rowSize = static_cast<size_t>(width) * sizeof(u16);
+    const size_t dataSize = (rowSize + 1) * height;
+    if (dataSize > INT_MAX) {
+        slog::warning("The image is too large to be written as png ({}x{})", width, height);
+        return false;
+    }
+
+    // each row starts with its filter type. The filter giving the smallest sum of the
+    // filtered bytes, seen as signed, is used as it usually compresses the best
+    std::vector<u8> data(dataSize);
+    std::vector<u8> previous(rowSize, 0);
+    std::vector<u8> current(rowSize);
+    std::array<std::vector<u8>, 5> filtered;
+    filtered.fill(std::vector<u8>(rowSize));
+
+    for (u32 y = 0; y < height; y++) {
+        // the samples are big endian
+        for (u32 x = 0; x < width; x++) {
+            const u16 value = pixels[static_cast<size_t>(y) * width + x];
+            current[2 * x] = static_cast<u8>(value >> 8);
+            current[2 * x + 1] = static_cast<u8>(value);
+        }
+
+        // the filters predict a byte from the same byte of the sample on the left and above
+        for (size_t i = 0; i < rowSize; i++) {
+            const u8 left = i >= 2 ? current[i - 2] : 0;
+            const u8 up = previous[i];
+            const u8 upLeft = i >= 2 ? previous[i - 2] : 0;
+            filtered[0][i] = current[i];
+            filtered[1][i] = static_cast<u8>(current[i] - left);
+            filtered[2][i] = static_cast<u8>(current[i] - up);
+            filtered[3][i] = static_cast<u8>(current[i] - ((left + up) >> 1));
+            filtered[4][i] = static_cast<u8>(current[i] - paethPredictor(left, up, upLeft));
+        }
+
+        u8 bestFilter = 0;
+        u64 bestScore = std::numeric_limits<u64>::max();
+        for (u8 filter = 0; filter < filtered.size(); filter++) {
+            u64 score = 0;
+            for (const u8 byte : filtered[filter]) {
+                score += static_cast<u64>(std::abs(static_cast<i32>(static_cast<i8>(byte))));
+            }
+            if (score < bestScore) {
+                bestScore = score;
+                bestFilter = filter;
+            }
+        }
+
+        u8 *row = data.data() + y * (rowSize + 1);
+        row[0] = bestFilter;
+        std::memcpy(row + 1, filtered[bestFilter].data(), rowSize);
+        std::swap(previous, current);
+    }
+
+    int compressedSize = 0;
+    u8 *compressed = stbi_zlib_compress(data.data(), static_cast<int>(data.size()), &compressedSize, 8);
+    if (!compressed) {
+        slog::warning("Failed to compress the png image '{}'", path.string());
+        return false;
+    }
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::free(compressed);
+        return false;
+    }
+
+    const u8 signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+    // width, height, 16 bits, grayscale, deflate, adaptive filtering, not interlaced
+    const u8 header[13] = {
+        static_cast<u8>(width >> 24), static_cast<u8>(width >> 16), static_cast<u8>(width >> 8), static_cast<u8>(width),
+        static_cast<u8>(height >> 24), static_cast<u8>(height >> 16), static_cast<u8>(height >> 8), static_cast<u8>(height),
+        16, 0, 0, 0, 0
+    };
+    writeChunk(file, "IHDR", header);
+    writeChunk(file, "IDAT", { compressed, static_cast<size_t>(compressedSize) });
+    writeChunk(file, "IEND", {});
+    std::free(compressed);
+
+    file.close();
+    return !file.fail();
+}
+
+// pfm
+
+bool readPfm(const std::filesystem::path &path, std::vector<f32> &heights, u32 &width, u32 &height) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        slog::warning("Failed to open the pfm image '{}'", path.string());
+        return false;
+    }
+
+    // text header: "Pf" for grayscale or "PF" for color, the dimensions and the scale,
+    // negative for little endian data. It ends with a single whitespace
+    std::string magic;
+    i64 fileWidth = 0, fileHeight = 0;
+    f32 scale = 0.f;
+    file >> magic >> fileWidth >> fileHeight >> scale;
+    file.get();
+    if (!file || (magic != "Pf" && magic != "PF") || fileWidth <= 0 || fileHeight <= 0 || scale == 0.f) {
+        slog::warning("The pfm image '{}' has an invalid header", path.string());
+        return false;
+    }
+
+    if (fileWidth > std::numeric_limits<u32>::max() || fileHeight > std::numeric_limits<u32>::max()) {
+        slog::warning("The pfm image '{}' is too large", path.string());
+        return false;
+    }
+
+    // the header comes from the file, the size it claims is checked against the data before allocating
+    const u64 channels = magic == "PF" ? 3 : 1;
+    std::error_code error;
+    const u64 fileSize = std::filesystem::file_size(path, error);
+    const std::streamoff dataStart = file.tellg();
+    const u64 dataSize = !error && dataStart >= 0 && fileSize >= static_cast<u64>(dataStart) ? fileSize - dataStart : 0;
+    const u64 rowBytes = static_cast<u64>(fileWidth) * channels * sizeof(f32);
+    if (dataSize / rowBytes < static_cast<u64>(fileHeight)) {
+        slog::warning("The pfm image '{}' is truncated", path.string());
+        return false;
+    }
+
+    const size_t rowSize = static_cast<size_t>(fileWidth * channels);
+    std::vector<f32> row(rowSize);
+    const bool isLittleEndian = scale < 0.f;
+    const bool needsSwap = isLittleEndian != (std::endian::native == std::endian::little);
+
+    width = static_cast<u32>(fileWidth);
+    height = static_cast<u32>(fileHeight);
+    heights.resize(static_cast<size_t>(width) * height);
+
+    // the rows are stored from the bottom to the top
+    for (u32 y = 0; y < height; y++) {
+        if (!file.read(reinterpret_cast<char*>(row.data()), static_cast<std::streamsize>(rowSize * sizeof(f32)))) {
+            slog::warning("The pfm image '{}' is truncated", path.string());
+            return false;
+        }
+        f32 *destination = heights.data() + static_cast<size_t>(height - 1 - y) * width;
+        for (u32 x = 0; x < width; x++) {
+            u32 bits = std::bit_cast<u32>(row[x * channels]);
+            if (needsSwap) {
+                bits = (bits >> 24) | ((bits >> 8) & 0xFF00u) | ((bits << 8) & 0xFF0000u) | (bits << 24);
+            }
+            destination[x] = std::bit_cast<f32>(bits);
+        }
+    }
+    return true;
+}
+
+bool writePfm(const std::filesystem::path &path, std::span<const f32> heights, u32 width, u32 height) {
+    expect(heights.size() == static_cast<size_t>(width) * height, "The size of the image is invalid");
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    const f32 scale = std::endian::native == std::endian::little ? -1.f : 1.f;
+    file << "Pf\n" << width << ' ' << height << '\n' << scale << '\n';
+
+    // the rows are stored from the bottom to the top
+    for (u32 y = height; y-- > 0;) {
+        file.write(
+            reinterpret_cast<const char*>(heights.data() + static_cast<size_t>(y) * width),
+            static_cast<std::streamsize>(width * sizeof(f32))
+        );
+    }
+
+    file.close();
+    return !file.fail();
+}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <filesystem>
+#include <span>
+#include <vector>
+
+#include <Common.h>
+
+namespace Geophagia {
+/**
+ * @brief Readers, writers and conversions for the image formats of the heightmaps
+ *
+ * The heights of an 8 bit image are its values. The 16 bit images cover the same
+ * [0, 255] range with 257 steps per unit, so 8 bit images convert to 16 bit exactly.
+ * Float images store the heights as they are.
+ */
+namespace HeightmapFormats {
+    /**
+     * @brief Converts 8 bit pixels to heights
+     */
+    void toHeights(std::span<const u8> pixels, std::span<f32> heights);
+    /**
+     * @brief Converts 16 bit pixels to heights
+     */
+    void toHeights(std::span<const u16> pixels, std::span<f32> heights);
+    /**
+     * @brief Converts heights to 8 bit pixels, rounded and clamped to [0, 255]
+     */
+    void toPixels(std::span<const f32> heights, std::span<u8> pixels);
+    /**
+     * @brief Converts heights to 16 bit pixels, rounded and clamped to [0, 65535]
+     */
+    void toPixels(std::span<const f32> heights, std::span<u16> pixels);
+
+    /**
+     * @brief Writes a 16 bit grayscale png, which stb_image_write doesn't support
+     * @return true on success and false on failure
+     */
+    bool writePng16(const std::filesystem::path &path, std::span<const u16> pixels, u32 width, u32 height);
+
+    /**
+     * @brief Reads a Portable Float Map. The first channel is used for color images
+     * @return true on success and false on failure
+     */
+    bool readPfm(const std::filesystem::path &path, std::vector<f32> &heights, u32 &width, u32 &height);
+    /**
+     * @brief Writes a grayscale Portable Float Map
+     * @return true on success and false on failure
+     */
+    bool writePfm(const std::filesystem::path &path, std::span<const f32> heights, u32 width, u32 height);
+}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <algorithm>
+
+#include <Common.h>
+
+namespace Geophagia {
+/**
+ * @brief Rectangle of cells of a heightmap
+ */
+struct HeightmapRegion {
+    u32 x = 0;
+    u32 z = 0;
+    u32 width = 0;
+    u32 depth = 0;
+
+    u32 getEndX() const { return x + width; } ///< @brief One past the last column
+    u32 getEndZ() const { return z + depth; } ///< @brief One past the last row
+    bool isEmpty() const { return width == 0 || depth == 0; }
+
+    /**
+     * @brief Smallest region containing both regions
+     */
+    HeightmapRegion merge(const HeightmapRegion &other) const {
+        if (isEmpty()) { return other; }
+        if (other.isEmpty()) { return *this; }
+
+        const u32 minX = std::min(x, other.x);
+        const u32 minZ = std::min(z, other.z);
+        return {
+            minX, minZ,
+            std::max(getEndX(), other.getEndX()) - minX,
+            std::max(getEndZ(), other.getEndZ()) - minZ
+        };
+    }
+};
+}
@@ -0,0 +1,446 @@
+#include "PagedHeightmap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+#include <slog/slog.h>
+
+#include "../Utils/MappedFile.h"
+
+namespace Geophagia {
+
+constexpr char PAGED_MAGIC[4] = { 'G', 'P', 'H', 'M' };
+constexpr u32 PAGED_VERSION = 1;
+constexpr size_t PAGED_HEADER_SIZE = 64; ///< @brief Keeps the tiles aligned
+
+// handle
+
+PagedHeightmap::TileHandle::~TileHandle() {
+    _release();
+}
+
+PagedHeightmap::TileHandle::TileHandle(TileHandle &&other) noexcept
+    : _owner(std::exchange(other._owner, nullptr)), _page(std::exchange(other._page, nullptr))
+    , _region(other._region), _stride(other._stride), _isWritable(other._isWritable) {}
+
+PagedHeightmap::TileHandle& PagedHeightmap::TileHandle::operator=(TileHandle &&other) noexcept {
+    if (this != &other) {
+        _release();
+        _owner = std::exchange(other._owner, nullptr);
+        _page = std::exchange(other._page, nullptr);
+        _region = other._region;
+        _stride = other._stride;
+        _isWritable = other._isWritable;
+    }
+    return *this;
+}
+
+std::span<const f32> PagedHeightmap::TileHandle::getHeights() const {
+    expect(isValid(), "The tile handle is invalid");
+    return _page->heights;
+}
+
+std::span<f32> PagedHeightmap::TileHandle::getMutableHeights() {
+    expect(isValid() && _isWritable, "The tile must be acquired as writable to be modified");
+    return _page->heights;
+}
+
+void PagedHeightmap::TileHandle::_release() {
+    if (_page) {
+        _owner->_release(_page);
+    }
+    _owner = nullptr;
+    _page = nullptr;
+}
+
+// job guard
+
+PagedHeightmap::JobGuard::~JobGuard() {
+    _release();
+}
+
+PagedHeightmap::JobGuard::JobGuard(JobGuard &&other) noexcept : _owner(std::exchange(other._owner, nullptr)) {}
+
+PagedHeightmap::JobGuard& PagedHeightmap::JobGuard::operator=(JobGuard &&other) noexcept {
+    if (this != &other) {
+        _release();
+        _owner = std::exchange(other._owner, nullptr);
+    }
+    return *this;
+}
+
+void PagedHeightmap::JobGuard::_release() {
+    if (_owner) {
+        std::lock_guard lock(_owner->_mutex);
+        _owner->_numJobs--;
+    }
+    _owner = nullptr;
+}
+
+// heightmap
+
+PagedHeightmap::~PagedHeightmap() {
+    expect(!isBusy(), "The paged heightmap is still in use while being destroyed");
+    if (!close()) {
+        slog::warning("The modified tiles of '{}' are lost", _path.string());
+    }
+}
+
+bool PagedHeightmap::isBusy() const {
+    std::lock_guard lock(_mutex);
+    return _numPinnedTiles > 0 || _numJobs > 0;
+}
+
+PagedHeightmap::JobGuard PagedHeightmap::beginJob() {
+    std::lock_guard lock(_mutex);
+    _numJobs++;
+
+    JobGuard guard;
+    guard._owner = this;
+    return guard;
+}
+
+bool PagedHeightmap::_setLayout(u32 width, u32 depth, u32 tileSize, size_t residentBytes) {
+    if (tileSize == 0 || tileSize > MAX_TILE_SIZE) { return false; }
+    // in 64 bits, the dimensions may come from a file. The tile indices are then 32 bits
+    const u64 tilesX = (static_cast<u64>(width) + tileSize - 1) / tileSize;
+    const u64 tilesZ = (static_cast<u64>(depth) + tileSize - 1) / tileSize;
+    if (tilesX * tilesZ > std::numeric_limits<u32>::max()) { return false; }
+
+    _width = width;
+    _depth = depth;
+    _tileSize = tileSize;
+    _tilesX = static_cast<u32>(tilesX);
+    _tilesZ = static_cast<u32>(tilesZ);
+    _maxResidentTiles = std::max<size_t>(1, residentBytes / _getTileBytes());
+    _stats = {};
+    return true;
+}
+
+bool PagedHeightmap::create(const std::filesystem::path &path, u32 width, u32 depth, u32 tileSize, size_t residentBytes) {
+    expect(width > 0 && depth > 0 && tileSize > 0 && tileSize <= MAX_TILE_SIZE, "The paged heightmap can't be empty");
+    // held until the new file is open, a job can't acquire a tile of a half set up layout
+    std::lock_guard lock(_mutex);
+    if (!_close()) {
+        return false;
+    }
+
+    if (!_setLayout(width, depth, tileSize, residentBytes)) {
+        slog::warning("The paged heightmap '{}' of {}x{} has too many tiles", path.string(), width, depth);
+        return false;
+    }
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            slog::warning("Failed to create the file '{}'", path.string());
+            return false;
+        }
+        char header[PAGED_HEADER_SIZE] = {};
+        const u32 values[4] = { PAGED_VERSION, width, depth, tileSize };
+        std::memcpy(header, PAGED_MAGIC, sizeof(PAGED_MAGIC));
+        std::memcpy(header + sizeof(PAGED_MAGIC), values, sizeof(values));
+        file.write(header, sizeof(header));
+        if (!file) {
+            slog::warning("Failed to write the file '{}'", path.string());
+            return false;
+        }
+    }
+
+    // the tiles are zeros until written
+    std::error_code error;
+    std::filesystem::resize_file(path, _getTileOffset(static_cast<u64>(_tilesX) * _tilesZ), error);
+    if (error) {
+        slog::warning("Failed to resize the file '{}': {}", path.string(), error.message());
+        return false;
+    }
+
+    _file.open(path, std::ios::binary | std::ios::in | std::ios::out);
+    if (!_file.is_open()) {
+        slog::warning("Failed to open the file '{}'", path.string());
+        return false;
+    }
+    _path = path;
+    return true;
+}
+
+bool PagedHeightmap::open(const std::filesystem::path &path, size_t residentBytes) {
+    std::lock_guard lock(_mutex);
+    if (!_close()) {
+        return false;
+    }
+
+    std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+    if (!file.is_open()) {
+        slog::warning("Failed to open the file '{}'", path.string());
+        return false;
+    }
+
+    char header[PAGED_HEADER_SIZE];
+    u32 values[4];
+    if (!file.read(header, sizeof(header)) || std::memcmp(header, PAGED_MAGIC, sizeof(PAGED_MAGIC)) != 0) {
+        slog::warning("The paged heightmap '{}' has an invalid header", path.string());
+        return false;
+    }
+    std::memcpy(values, header + sizeof(PAGED_MAGIC), sizeof(values));
+    if (values[0] != PAGED_VERSION || values[1] == 0 || values[2] == 0 || values[3] == 0) {
+        slog::warning("The paged heightmap '{}' has an invalid header", path.string());
+        return false;
+    }
+
+    if (!_setLayout(values[1], values[2], values[3], residentBytes)) {
+        slog::warning("The paged heightmap '{}' has an invalid tile size or too many tiles", path.string());
+        return false;
+    }
+    std::error_code error;
+    if (std::filesystem::file_size(path, error) < _getTileOffset(static_cast<u64>(_tilesX) * _tilesZ) || error) {
+        slog::warning("The paged heightmap '{}' is truncated", path.string());
+        return false;
+    }
+
+    _file = std::move(file);
+    _path = path;
+    return true;
+}
+
+bool PagedHeightmap::importRaw(const std::filesystem::path &rawPath, const std::filesystem::path &path,
+                               u32 tileSize, size_t residentBytes) {
+    MappedFile raw;
+    if (!raw.open(rawPath)) {
+        return false;
+    }
+
+    const auto data = raw.getData();
+    u32 size[2] = {};
+    if (data.size() > sizeof(size)) {
+        std::memcpy(size, data.data(), sizeof(size));
+    }
+    if (size[0] == 0 || size[1] == 0 || data.size() != sizeof(size) + static_cast<u64>(size[0]) * size[1] * sizeof(f32)) {
+        slog::warning("The raw heightmap '{}' is invalid", rawPath.string());
+        return false;
+    }
+    if (!create(path, size[0], size[1], tileSize, residentBytes)) {
+        return false;
+    }
+
+    // a band of tiles at a time, so the tiles are complete before being evicted
+    const f32 *heights = reinterpret_cast<const f32*>(data.data() + sizeof(size));
+    for (u32 z = 0; z < _depth; z += _tileSize) {
+        const HeightmapRegion band = { 0, z, _width, std::min(_tileSize, _depth - z) };
+        if (!writeRegion(band, { heights + static_cast<size_t>(z) * _width, static_cast<size_t>(band.width) * band.depth })) {
+            return false;
+        }
+    }
+    return flush();
+}
+
+bool PagedHeightmap::close() {
+    std::lock_guard lock(_mutex);
+    return _close();
+}
+
+bool PagedHeightmap::_close() {
+    if (!isOpen()) { return true; }
+    if (_numPinnedTiles > 0 || _numJobs > 0) {
+        slog::warning("The paged heightmap '{}' is in use, it can't be closed", _path.string());
+        return false;
+    }
+
+    // as when evicting, the tiles stay resident if they can't be written, to not lose the heights
+    bool isWritten = true;
+    for (auto &page : _pages) {
+        if (page.isDirty) {
+            isWritten &= _writePage(page);
+        }
+    }
+    _file.flush();
+    if (!isWritten || _file.fail()) {
+        slog::warning("Failed to write the modified tiles of '{}', it stays open", _path.string());
+        return false;
+    }
+
+    _pages.clear();
+    _residentPages.clear();
+    _file.close();
+    _path.clear();
+    return true;
+}
+
+u64 PagedHeightmap::_getTileOffset(u64 tile) const {
+    return PAGED_HEADER_SIZE + tile * _getTileBytes();
+}
+
+bool PagedHeightmap::_readPage(Page &page) {
+    page.heights.resize(static_cast<size_t>(_tileSize) * _tileSize);
+    _file.clear();
+    _file.seekg(static_cast<std::streamoff>(_getTileOffset(page.tile)));
+    if (!_file.read(reinterpret_cast<char*>(page.heights.data()), static_cast<std::streamsize>(_getTileBytes()))) {
+        slog::warning("Failed to read the tile {} of '{}'", page.tile, _path.string());
+        return false;
+    }
+    return true;
+}
+
+bool PagedHeightmap::_writePage(Page &page) {
+    _file.clear();
+    _file.seekp(static_cast<std::streamoff>(_getTileOffset(page.tile)));
+    if (!_file.write(reinterpret_cast<const char*>(page.heights.data()), static_cast<std::streamsize>(_getTileBytes()))) {
+        slog::warning("Failed to write the tile {} of '{}'", page.tile, _path.string());
+        return false;
+    }
+    page.isDirty = false;
+    _stats.writeBacks++;
+    return true;
+}
+
+std::vector<f32> PagedHeightmap::_makeRoom() {
+    std::vector<f32> buffer;
+    auto page = _pages.end();
+    while (_pages.size() >= _maxResidentTiles && page != _pages.begin()) {
+        --page;
+        if (page->pinCount > 0) { continue; }
+        if (page->isDirty && !_writePage(*page)) { continue; } // kept to not lose the heights
+
+        buffer = std::move(page->heights);
+        _residentPages.erase(page->tile);
+        page = _pages.erase(page);
+        _stats.evictions++;
+    }
+    return buffer;
+}
+
+PagedHeightmap::TileHandle PagedHeightmap::acquireTile(u32 tileX, u32 tileZ, bool isWritable) {
+    expect(isOpen(), "The paged heightmap must be opened before reading it");
+    expect(tileX < _tilesX && tileZ < _tilesZ, "The tile is out of the heightmap");
+
+    std::lock_guard lock(_mutex);
+    // the layout has at most 2^32 tiles, the index fits once computed
+    const u32 tile = static_cast<u32>(static_cast<u64>(tileZ) * _tilesX + tileX);
+
+    Page *page = nullptr;
+    if (auto resident = _residentPages.find(tile); resident != _residentPages.end()) {
+        _pages.splice(_pages.begin(), _pages, resident->second);
+        page = &*resident->second;
+        _stats.hits++;
+    }
+    else {
+        Page newPage = { _makeRoom(), tile };
+        if (!_readPage(newPage)) {
+            return {};
+        }
+        _pages.push_front(std::move(newPage));
+        _residentPages[tile] = _pages.begin();
+        page = &_pages.front();
+        _stats.misses++;
+    }
+
+    page->pinCount++;
+    page->isDirty |= isWritable;
+    _numPinnedTiles++;
+
+    TileHandle handle;
+    handle._owner = this;
+    handle._page = page;
+    handle._region = {
+        tileX * _tileSize, tileZ * _tileSize,
+        std::min(_tileSize, _width - tileX * _tileSize), std::min(_tileSize, _depth - tileZ * _tileSize)
+    };
+    handle._stride = _tileSize;
+    handle._isWritable = isWritable;
+    return handle;
+}
+
+void PagedHeightmap::_release(Page *page) {
+    std::lock_guard lock(_mutex);
+    page->pinCount--;
+    _numPinnedTiles--;
+}
+
+template <typename Copy>
+bool PagedHeightmap::_forEachTile(const HeightmapRegion &region, bool isWritable, Copy &&copy) {
+    expect(region.getEndX() <= _width && region.getEndZ() <= _depth, "The region is out of the heightmap");
+    if (region.isEmpty()) { return true; }
+
+    for (u32 tileZ = region.z / _tileSize; tileZ * _tileSize < region.getEndZ(); tileZ++) {
+        for (u32 tileX = region.x / _tileSize; tileX * _tileSize < region.getEndX(); tileX++) {
+            TileHandle handle = acquireTile(tileX, tileZ, isWritable);
+            if (!handle.isValid()) { return false; }
+
+            const HeightmapRegion &area = handle.getRegion();
+            const u32 beginX = std::max(area.x, region.x), endX = std::min(area.getEndX(), region.getEndX());
+            const u32 beginZ = std::max(area.z, region.z), endZ = std::min(area.getEndZ(), region.getEndZ());
+            copy(handle, HeightmapRegion{ beginX, beginZ, endX - beginX, endZ - beginZ });
+        }
+    }
+    return true;
+}
+
+bool PagedHeightmap::readRegion(const HeightmapRegion &region, std::span<f32> heights) {
+    expect(heights.size() == static_cast<size_t>(region.width) * region.depth, "The size of the region is invalid");
+    return _forEachTile(region, false, [&](const TileHandle &handle, const HeightmapRegion &cells) {
+        const HeightmapRegion &area = handle.getRegion();
+        for (u32 z = cells.z; z < cells.getEndZ(); z++) {
+            std::memcpy(
+                heights.data() + static_cast<size_t>(z - region.z) * region.width + (cells.x - region.x),
+                handle.getHeights().data() + static_cast<size_t>(z - area.z) * handle.getStride() + (cells.x - area.x),
+                cells.width * sizeof(f32)
+            );
+        }
+    });
+}
+
+bool PagedHeightmap::writeRegion(const HeightmapRegion &region, std::span<const f32> heights) {
+    expect(heights.size() == static_cast<size_t>(region.width) * region.depth, "The size of the region is invalid");
+    return _forEachTile(region, true, [&](TileHandle &handle, const HeightmapRegion &cells) {
+        const HeightmapRegion &area = handle.getRegion();
+        for (u32 z = cells.z; z < cells.getEndZ(); z++) {
+            std::memcpy(
+                handle.getMutableHeights().data() + static_cast<size_t>(z - area.z) * handle.getStride() + (cells.x - area.x),
+                heights.data() + static_cast<size_t>(z - region.z) * region.width + (cells.x - region.x),
+                cells.width * sizeof(f32)
+            );
+        }
+    });
+}
+
+bool PagedHeightmap::readOverview(u32 stride, std::span<f32> heights) {
+    expect(stride > 0, "The stride can't be 0");
+    const u32 overviewWidth = (_width + stride - 1) / stride;
+    const u32 overviewDepth = (_depth + stride - 1) / stride;
+    expect(heights.size() == static_cast<size_t>(overviewWidth) * overviewDepth, "The size of the overview is invalid");
+
+    // the first multiple of the stride at or after `begin`
+    auto firstSample = [stride](u32 begin) { return (begin + stride - 1) / stride * stride; };
+    return _forEachTile({ 0, 0, _width, _depth }, false, [&](const TileHandle &handle, const HeightmapRegion &cells) {
+        const std::span<const f32> tile = handle.getHeights();
+        const HeightmapRegion &area = handle.getRegion();
+        for (u32 z = firstSample(cells.z); z < cells.getEndZ(); z += stride) {
+            for (u32 x = firstSample(cells.x); x < cells.getEndX(); x += stride) {
+                heights[static_cast<size_t>(z / stride) * overviewWidth + x / stride] =
+                    tile[static_cast<size_t>(z - area.z) * handle.getStride() + (x - area.x)];
+            }
+        }
+    });
+}
+
+bool PagedHeightmap::flush() {
+    std::lock_guard lock(_mutex);
+    bool isSuccess = true;
+    for (auto &page : _pages) {
+        if (page.isDirty && page.pinCount == 0) {
+            isSuccess &= _writePage(page);
+        }
+    }
+    _file.flush();
+    return isSuccess && !_file.fail();
+}
+
+PagedHeightmap::Stats PagedHeightmap::getStats() const {
+    std::lock_guard lock(_mutex);
+    Stats stats = _stats;
+    stats.residentTiles = _pages.size();
+    return stats;
+}
+
+}
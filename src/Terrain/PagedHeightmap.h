@@ -0,0 +1,247 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include <Common.h>
+
+#include "HeightmapRegion.h"
+
+namespace Geophagia {
+/**
+ * @brief Heightmap stored on disk in square tiles, of which only a working set is kept in memory
+ *
+ * The heights are accessed tile by tile through `TileHandle`, which keeps its tile
+ * resident while it lives. The tiles not used for the longest time are evicted once
+ * the memory budget is reached, and written back to the file if they were modified.
+ * This allows working on heightmaps larger than the memory, a region at a time.
+ *
+ * The file starts with a header, followed by the tiles row by row. Every tile has
+ * the full size, the tiles on the borders are padded, so any tile is a single read.
+ * All the values are little endian.
+ *
+ * The functions can be called from several threads, the reads and writes of the
+ * file are done one at a time. The file can't be swapped while it's busy, see `isBusy`.
+ */
+class PagedHeightmap {
+    struct Page;
+
+public:
+    static constexpr u32 DEFAULT_TILE_SIZE = 512; ///< @brief 1 MiB per tile
+    static constexpr u32 MAX_TILE_SIZE = 4096; ///< @brief 64 MiB per tile, a larger size in a file is rejected
+    static constexpr size_t DEFAULT_RESIDENT_BYTES = 512ull * 1024 * 1024;
+
+    /**
+     * @brief Accesses of the cache since the file was opened
+     */
+    struct Stats {
+        u64 hits = 0;
+        u64 misses = 0;
+        u64 evictions = 0;
+        u64 writeBacks = 0; ///< @brief Modified tiles written to the file
+        size_t residentTiles = 0;
+    };
+
+    /**
+     * @brief Keeps a tile in memory while it lives
+     *
+     * The heights are stored row by row with a stride of the tile size,
+     * the part outside of the heightmap on the borders is only padding.
+     */
+    class TileHandle {
+    public:
+        TileHandle() = default;
+        ~TileHandle();
+
+        TileHandle(const TileHandle&) = delete;
+        TileHandle& operator=(const TileHandle&) = delete;
+        TileHandle(TileHandle &&other) noexcept;
+        TileHandle& operator=(TileHandle &&other) noexcept;
+
+        bool isValid() const { return _page != nullptr; }
+        std::span<const f32> getHeights() const;
+        /**
+         * @brief Heights of a tile acquired as writable, written back to the file when evicted
+         */
+        std::span<f32> getMutableHeights();
+        /**
+         * @brief Cells of the heightmap covered by the tile
+         */
+        const HeightmapRegion& getRegion() const { return _region; }
+        u32 getStride() const { return _stride; }
+
+    private:
+        friend class PagedHeightmap;
+
+        PagedHeightmap *_owner = nullptr;
+        Page *_page = nullptr;
+        HeightmapRegion _region;
+        u32 _stride = 0;
+        bool _isWritable = false;
+
+        void _release();
+    };
+
+    /**
+     * @brief Keeps the heightmap busy while it lives, for a job working on it in the background
+     */
+    class JobGuard {
+    public:
+        JobGuard() = default;
+        ~JobGuard();
+
+        JobGuard(const JobGuard&) = delete;
+        JobGuard& operator=(const JobGuard&) = delete;
+        JobGuard(JobGuard &&other) noexcept;
+        JobGuard& operator=(JobGuard &&other) noexcept;
+
+    private:
+        friend class PagedHeightmap;
+
+        PagedHeightmap *_owner = nullptr;
+
+        void _release();
+    };
+
+    PagedHeightmap() = default;
+    ~PagedHeightmap();
+
+    PagedHeightmap(const PagedHeightmap&) = delete;
+    PagedHeightmap& operator=(const PagedHeightmap&) = delete;
+
+    /**
+     * @brief Creates a file of flat heights, after closing the current one. The file is sparse
+     * where the OS allows it, so the disk space is only used by the tiles written
+     *
+     * @param residentBytes Memory budget of the tiles kept in memory
+     * @return true on success and false on failure, if the current file is busy,
+     * or if the heightmap has more than 2^32 tiles
+     */
+    bool create(const std::filesystem::path &path, u32 width, u32 depth, u32 tileSize = DEFAULT_TILE_SIZE,
+                size_t residentBytes = DEFAULT_RESIDENT_BYTES);
+    /**
+     * @brief Opens a file made by `create`, after closing the current one
+     * @return true on success and false on failure, or if the current file is busy
+     */
+    bool open(const std::filesystem::path &path, size_t residentBytes = DEFAULT_RESIDENT_BYTES);
+    /**
+     * @brief Creates a paged heightmap at `path` from a raw heightmap file, a band of tiles at a time.
+     * The raw file is mapped, so it can be larger than the memory too
+     *
+     * @return true on success and false on failure, or if the current file is busy
+     */
+    bool importRaw(const std::filesystem::path &rawPath, const std::filesystem::path &path,
+                   u32 tileSize = DEFAULT_TILE_SIZE, size_t residentBytes = DEFAULT_RESIDENT_BYTES);
+    /**
+     * @brief Writes the modified tiles back and closes the file
+     * @return false if the file is busy or a modified tile couldn't be written, it stays open
+     */
+    bool close();
+    bool isOpen() const { return _file.is_open(); }
+    /**
+     * @brief A tile is in use or a job holds a `JobGuard`, the file can't be closed or replaced
+     */
+    bool isBusy() const;
+    /**
+     * @brief Marks the heightmap as busy until the guard is destroyed. To be taken before
+     * starting a job that acquires tiles, so the layout can't change between two of them
+     */
+    [[nodiscard]]
+    JobGuard beginJob();
+
+    /**
+     * @brief Loads the tile if it isn't resident and keeps it in memory while the handle lives.
+     * The memory budget can be exceeded if every resident tile is in use
+     *
+     * @param isWritable The tile is marked as modified, allowing `TileHandle::getMutableHeights`
+     * @return the handle, invalid if the tile couldn't be read
+     */
+    TileHandle acquireTile(u32 tileX, u32 tileZ, bool isWritable = false);
+
+    /**
+     * @brief Copies the heights of `region`, row by row, into `heights`
+     * @return true on success and false on a read failure
+     */
+    bool readRegion(const HeightmapRegion &region, std::span<f32> heights);
+    /**
+     * @brief Copies `heights`, row by row, into the cells of `region`
+     * @return true on success and false on a read failure
+     */
+    bool writeRegion(const HeightmapRegion &region, std::span<const f32> heights);
+    /**
+     * @brief Reads one height every `stride` cells in both directions, tile by tile
+     *
+     * @param heights Of size `ceil(width / stride) * ceil(depth / stride)`
+     * @return true on success and false on a read failure
+     */
+    bool readOverview(u32 stride, std::span<f32> heights);
+    /**
+     * @brief Writes the modified tiles that aren't in use back to the file
+     * @return true on success and false on a write failure
+     */
+    bool flush();
+
+    u32 getWidth() const { return _width; }
+    u32 getDepth() const { return _depth; }
+    u32 getTileSize() const { return _tileSize; }
+    u32 getTilesX() const { return _tilesX; }
+    u32 getTilesZ() const { return _tilesZ; }
+    size_t getResidentBytes() const { return _maxResidentTiles * _getTileBytes(); }
+    const std::filesystem::path& getPath() const { return _path; }
+    Stats getStats() const;
+
+private:
+    struct Page {
+        std::vector<f32> heights;
+        u32 tile = 0;
+        u32 pinCount = 0;
+        bool isDirty = false;
+    };
+
+    std::filesystem::path _path;
+    std::fstream _file;
+    u32 _width = 0;
+    u32 _depth = 0;
+    u32 _tileSize = 0;
+    u32 _tilesX = 0;
+    u32 _tilesZ = 0;
+    size_t _maxResidentTiles = 0;
+
+    mutable std::mutex _mutex;
+    u32 _numPinnedTiles = 0; ///< @brief Handles alive
+    u32 _numJobs = 0; ///< @brief Job guards alive
+    std::list<Page> _pages; ///< @brief Resident tiles, from the most to the least recently used
+    std::unordered_map<u32, std::list<Page>::iterator> _residentPages; ///< @brief Pages by tile index
+    Stats _stats;
+
+    size_t _getTileBytes() const { return static_cast<size_t>(_tileSize) * _tileSize * sizeof(f32); }
+    u64 _getTileOffset(u64 tile) const;
+    /**
+     * @return false if the tile size is out of range or there are more than 2^32 tiles, nothing is changed
+     */
+    bool _setLayout(u32 width, u32 depth, u32 tileSize, size_t residentBytes);
+    /**
+     * @brief Closes the file unless it's busy or a modified tile can't be written. Called with `_mutex` held
+     */
+    bool _close();
+    bool _readPage(Page &page);
+    bool _writePage(Page &page);
+    /**
+     * @brief Evicts the least recently used tiles not in use until there is room for a new one
+     * @return buffer of an evicted tile to reuse, or an empty one
+     */
+    std::vector<f32> _makeRoom();
+    void _release(Page *page);
+
+    /**
+     * @brief Calls `copy(handle, intersection)` for every tile overlapping `region`
+     */
+    template <typename Copy>
+    bool _forEachTile(const HeightmapRegion &region, bool isWritable, Copy &&copy);
+};
+}
@@ -1,6 +1,11 @@
 #include "Terrain.h"
 
+#include <chrono>
+#include <cstring>
 #include <fstream>
+#include <limits>
+#include <numeric>
+#include <utility>
 #include <glm/gtc/type_ptr.hpp>
 
 #include <stb/stb_image.h>
@@ -9,13 +14,24 @@
 #include <Necrosis/renderer/Texture.h>
 #include <Necrosis/Window.h>
 
+#include "HeightmapFormats.h"
 #include "../UiComponents/Dialogs.h"
 
+#if defined(_WIN64) || defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 namespace Geophagia {
 
-Terrain::Terrain() : _width(256), _depth(256), _scale(1.f, 0.25f, 1.f), _mapScale(100.f)
+Terrain::Terrain(Necrosis::TaskScheduler &taskScheduler)
+    : _taskScheduler(taskScheduler), _width(256), _depth(256), _scale(1.f, 0.25f, 1.f), _mapScale(100.f)
     , _sampler(Necrosis::TextureSampler(Necrosis::FilterType::LinearMipmap, Necrosis::WrapMode::Repeat, 16.f, "Terrain sampler"))
-    , _textureScale(10.f), _renderer(std::make_unique<TerrainRenderer>()) {
+    , _textureScale(10.f), _renderer(std::make_unique<TerrainRenderer>(taskScheduler)) {
 
     _heights.resize(_width * _depth, 0.f);
 
@@ -31,10 +47,10 @@ Terrain::Terrain() : _width(256), _depth(256), _scale(1.f, 0.25f, 1.f), _mapScal
     _imageView = Necrosis::TextureManager::makeTextureFromMemory(image.data(), _width, _depth, Necrosis::PixelFormat::Luminance);
 }
 
-Terrain::Terrain(const u32 width, const u32 depth)
-    : _width(width), _depth(depth), _scale(1.f, 0.25f, 1.f), _mapScale(100.f)
+Terrain::Terrain(Necrosis::TaskScheduler &taskScheduler, const u32 width, const u32 depth)
+    : _taskScheduler(taskScheduler), _width(width), _depth(depth), _scale(1.f, 0.25f, 1.f), _mapScale(100.f)
     , _sampler(Necrosis::TextureSampler(Necrosis::FilterType::LinearMipmap, Necrosis::WrapMode::Repeat, 16.f, "Terrain sampler"))
-    , _textureScale(10.f), _renderer(std::make_unique<TerrainRenderer>()) {
+    , _textureScale(10.f), _renderer(std::make_unique<TerrainRenderer>(taskScheduler)) {
 
     _heights.resize(_width * _depth);
 
@@ -63,13 +79,17 @@ Terrain::~Terrain() {
 }
 
 void Terrain::render() const {
+    render(glm::mat4(0.f));
+}
+
+TerrainRenderer::CullingStats Terrain::render(const glm::mat4 &clipFromModel) const {
     for (int i = 0; auto& texture : _textures) {
         if (i > 10) break;
         Necrosis::TextureManager::bind(texture, i);
         _sampler.bind(i);
         i++;
     }
-    _renderer->render();
+    return _renderer->render(clipFromModel);
 }
 
 glm::mat4 Terrain::getModelMatrix() const {
@@ -80,54 +100,183 @@ glm::mat4 Terrain::getModelMatrix() const {
 }
 
 
-bool Terrain::loadRawFromMemory(const std::vector<f32> &heights, const u32 width, const u32 depth) {
+/**
+ * @brief Checks the size of heights passed to the terrain
+ */
+bool isValidHeightmapSize(size_t size, const u32 width, const u32 depth) {
     if (width == 0 || depth == 0) {
         slog::warning("The heightmap width and depth has to be greater than 0");
         return false;
     }
-    if (width * depth != heights.size()) {
+    if (static_cast<size_t>(width) * depth != size) {
         slog::warning("the size of the heightmap provided is invalid");
         return false;
     }
+    return true;
+}
+
+bool Terrain::loadRawFromMemory(std::span<const f32> heights, const u32 width, const u32 depth) {
+    if (!isValidHeightmapSize(heights.size(), width, depth)) {
+        return false;
+    }
+
+    if (width == _width && depth == _depth && getHeights().size() == heights.size()) {
+        _markChangedRegions(heights);
+
+        // only the changed rows are copied
+        std::vector<f32> &current = _getMutableHeights();
+        for (const auto &region : _dirtyRegions) {
+            for (u32 z = region.z; z < region.getEndZ(); z++) {
+                const size_t begin = static_cast<size_t>(z) * _width + region.x;
+                std::copy_n(heights.begin() + begin, region.width, current.begin() + begin);
+            }
+        }
+        uploadChanges();
+        return true;
+    }
+
+    return loadRawFromMemory(std::vector<f32>(heights.begin(), heights.end()), width, depth);
+}
+
+bool Terrain::loadRawFromMemory(std::vector<f32> &&heights, const u32 width, const u32 depth) {
+    if (!isValidHeightmapSize(heights.size(), width, depth)) {
+        return false;
+    }
+
+    // the previous heights are compared to find the regions to upload, but never copied
+    const bool isSameSize = width == _width && depth == _depth && getHeights().size() == heights.size();
+    if (isSameSize) {
+        _markChangedRegions(heights);
+    }
+    _mappedFile.close();
+    _heights = std::move(heights);
+    if (isSameSize) {
+        uploadChanges();
+        return true;
+    }
 
-    _heights = heights; // NOTE: might use std::move but heights should be &&
     _width = width;
     _depth = depth;
+    _dirtyRegions.clear();
+    _loadedPagedRegion = {};
 
     _renderer->updateBuffers(_heights, _width, _depth, _textureScale, _mapScale);
     _updateImageView();
     return true;
 }
 
+Terrain::EditHandle Terrain::editHeights(const HeightmapRegion &region) {
+    expect(region.getEndX() <= _width && region.getEndZ() <= _depth, "The edited region is out of the terrain");
+    return EditHandle(*this, _getMutableHeights(), region);
+}
+
+Terrain::EditHandle::~EditHandle() {
+    if (_terrain) {
+        _terrain->markDirty(_region);
+        _terrain->uploadChanges();
+    }
+}
+
+std::span<const f32> Terrain::getHeights() const {
+    if (_mappedFile.isOpen()) {
+        // the heights follow the 2 u32 of the header
+        const auto data = _mappedFile.getData().subspan(2 * sizeof(u32));
+        return { reinterpret_cast<const f32*>(data.data()), data.size() / sizeof(f32) };
+    }
+    return _heights;
+}
+
+std::vector<f32>& Terrain::_getMutableHeights() {
+    if (_mappedFile.isOpen()) {
+        const auto mapped = getHeights();
+        _heights.assign(mapped.begin(), mapped.end());
+        _mappedFile.close();
+        slog::info("Copied the mapped heightmap in memory ({:.1f} MiB) before its first modification", _heights.size() * sizeof(f32) / (1024.f * 1024.f));
+    }
+    return _heights;
+}
+
+void Terrain::markDirty(const HeightmapRegion &region) {
+    if (region.isEmpty()) { return; }
+    expect(region.getEndX() <= _width && region.getEndZ() <= _depth, "The dirty region is out of the terrain");
+
+    // merge with the regions it overlaps or touches, which can then overlap others
+    HeightmapRegion merged = region;
+    for (bool hasMerged = true; hasMerged;) {
+        hasMerged = false;
+        for (size_t i = 0; i < _dirtyRegions.size(); i++) {
+            const auto &other = _dirtyRegions[i];
+            if (   merged.x <= other.getEndX() && other.x <= merged.getEndX()
+                && merged.z <= other.getEndZ() && other.z <= merged.getEndZ()) {
+                merged = merged.merge(other);
+                _dirtyRegions[i] = _dirtyRegions.back();
+                _dirtyRegions.pop_back();
+                hasMerged = true;
+                break;
+            }
+        }
+    }
+    _dirtyRegions.push_back(merged);
+}
+
+void Terrain::uploadChanges() {
+    if (_dirtyRegions.empty()) { return; }
+
+    for (const auto &region : _dirtyRegions) {
+        _renderer->updateRegion(getHeights(), _width, _depth, _textureScale, _mapScale, region);
+        _updateImageView(region);
+    }
+    _dirtyRegions.clear();
+}
+
+void Terrain::_markChangedRegions(std::span<const f32> heights) {
+    const std::span<const f32> currentHeights = getHeights();
+    HeightmapRegion rows;
+    for (u32 z = 0; z < _depth; z++) {
+        const f32 *current = currentHeights.data() + z * _width;
+        const f32 *next = heights.data() + z * _width;
+
+        // first and last changed cells of the row
+        u32 begin = 0;
+        while (begin < _width && current[begin] == next[begin]) { begin++; }
+        if (begin == _width) {
+            // unchanged row, close the current region
+            markDirty(rows);
+            rows = {};
+            continue;
+        }
+        u32 end = _width;
+        while (current[end - 1] == next[end - 1]) { end--; }
+
+        rows = rows.merge({ begin, z, end - begin, 1 });
+    }
+    markDirty(rows);
+}
+
 bool Terrain::loadRawFromFile(const std::filesystem::path &path) {
-    std::fstream file(path, std::ios::binary | std::ios::in);
-    if (!file.is_open()) {
+    const auto start = std::chrono::steady_clock::now();
+
+    MappedFile file;
+    if (!file.open(path)) {
         slog::warning("Failed to open raw heightmap file '{}'", path.string());
         return false;
     }
 
-    file.seekg(0, std::ios::end);
-    auto size = file.tellg();
-    file.seekg(0, std::ios::beg);
-    size -= 2 * sizeof(u32); // the 2 first ints are for the width and depth
-    if (size <= 0) {
+    const auto data = file.getData();
+    if (data.size() <= 2 * sizeof(u32)) { // the 2 first ints are for the width and depth
         slog::warning("The file size is invalid for heightmap file '{}'", path.string());
         return false;
     }
-    if (size% sizeof(f32) != 0) {
+    const size_t size = data.size() - 2 * sizeof(u32);
+    if (size % sizeof(f32) != 0) {
         slog::warning("The heightmap file '{}' is invalid", path.string());
         return false;
     }
 
-    if (!file.read(reinterpret_cast<char *>(&_width), sizeof(_width))) {
-        slog::warning("Failed to read from heightmap file '{}'", path.string());
-        return false;
-    }
-    if (!file.read(reinterpret_cast<char *>(&_depth), sizeof(_depth))) {
-        slog::warning("Failed to read from heightmap file '{}'", path.string());
-        return false;
-    }
-    if (_width <= 0 || _depth <= 0) {
+    u32 width, depth;
+    std::memcpy(&width, data.data(), sizeof(width));
+    std::memcpy(&depth, data.data() + sizeof(width), sizeof(depth));
+    if (width <= 0 || depth <= 0) {
         slog::warning(
             "Error loading heightmap '{}'\n"
             "The width and depth sizes of the map must be greater than 0",
@@ -135,83 +284,553 @@ bool Terrain::loadRawFromFile(const std::filesystem::path &path) {
         );
         return false;
     }
-    if (_width * _depth * sizeof(f32) != static_cast<u64>(size)) {
+    if (static_cast<u64>(width) * depth * sizeof(f32) != size) {
         slog::warning(
             "Error loading heightmap '{}'\n"
             "the dimensions of the map don't match the file size",
             path.string()
         );
+        return false;
     }
 
-    _heights.resize(_width * _depth);
-    if (!file.read(reinterpret_cast<char *>(_heights.data()), size)) {
-        slog::warning("Failed to read from heightmap file '{}'", path.string());
+    // the heights are read in place, the previous ones are not needed anymore
+    _mappedFile = std::move(file);
+    _heights = {};
+    _width = width;
+    _depth = depth;
+    _dirtyRegions.clear();
+    _loadedPagedRegion = {};
+
+    _renderer->updateBuffers(getHeights(), _width, _depth, _textureScale, _mapScale);
+    _updateImageView();
+
+    const std::chrono::duration<f32, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    slog::info("Loaded the raw heightmap '{}' ({}x{}) in {:.1f} ms", path.string(), _width, _depth, elapsed.count());
+    return true;
+}
+
+void Terrain::runRawLoadingBenchmark(const std::filesystem::path &path) {
+    const u32 ITERATIONS = 3;
+    auto best = [&](auto &&load) {
+        f32 bestSeconds = std::numeric_limits<f32>::max();
+        for (u32 i = 0; i < ITERATIONS; i++) {
+            const auto start = std::chrono::steady_clock::now();
+            if (!load()) { return -1.f; }
+            const std::chrono::duration<f32> elapsed = std::chrono::steady_clock::now() - start;
+            bestSeconds = std::min(bestSeconds, elapsed.count());
+        }
+        return bestSeconds;
+    };
+    // both ways read every height, like the meshing does after a load
+    f32 checksum = 0.f;
+    auto sum = [&](std::span<const f32> heights) {
+        checksum = std::accumulate(heights.begin(), heights.end(), 0.f);
+    };
+
+    RawLoadingBenchmark benchmark;
+    benchmark.streamSeconds = best([&] {
+        std::ifstream file(path, std::ios::binary);
+        u32 size[2];
+        if (!file.read(reinterpret_cast<char*>(size), sizeof(size))) { return false; }
+        std::vector<f32> heights(static_cast<size_t>(size[0]) * size[1]);
+        if (!file.read(reinterpret_cast<char*>(heights.data()), heights.size() * sizeof(f32))) { return false; }
+        sum(heights);
+        benchmark.streamHeapBytes = heights.size() * sizeof(f32);
+        return true;
+    });
+    benchmark.mappedSeconds = best([&] {
+        MappedFile file;
+        if (!file.open(path) || file.getData().size() <= 2 * sizeof(u32)) { return false; }
+        const auto data = file.getData().subspan(2 * sizeof(u32));
+        sum({ reinterpret_cast<const f32*>(data.data()), data.size() / sizeof(f32) });
+        benchmark.fileSize = file.getData().size();
+        // the pages belong to the page cache, nothing is allocated
+        benchmark.mappedHeapBytes = 0;
+        return true;
+    });
+
+    if (benchmark.streamSeconds < 0.f || benchmark.mappedSeconds < 0.f) {
+        slog::warning("Failed to read the raw heightmap file '{}' for the benchmark", path.string());
+        return;
+    }
+    _rawLoadingBenchmark = benchmark;
+    slog::info(
+        "Raw loading benchmark on '{}' ({:.1f} MiB): stream {:.1f} ms with {:.1f} MiB on the heap, mapped {:.1f} ms with {:.1f} MiB (checksum {})",
+        path.string(), benchmark.fileSize / (1024.f * 1024.f),
+        benchmark.streamSeconds * 1000.f, benchmark.streamHeapBytes / (1024.f * 1024.f),
+        benchmark.mappedSeconds * 1000.f, benchmark.mappedHeapBytes / (1024.f * 1024.f), checksum
+    );
+}
+
+bool Terrain::loadTiledFromFile(const std::filesystem::path &path, const HeightmapRegion &region) {
+    const auto start = std::chrono::steady_clock::now();
+
+    TiledHeightmap file;
+    if (!file.open(path)) {
+        slog::warning("Failed to open tiled heightmap file '{}'", path.string());
         return false;
     }
 
+    HeightmapRegion area = region;
+    if (area.isEmpty()) {
+        area = { 0, 0, file.getWidth(), file.getDepth() };
+    }
+    if (area.x >= file.getWidth() || area.width > file.getWidth() - area.x
+     || area.z >= file.getDepth() || area.depth > file.getDepth() - area.z) {
+        slog::warning(
+            "Error loading heightmap '{}'\n"
+            "The region is out of the map of size {}x{}",
+            path.string(), file.getWidth(), file.getDepth()
+        );
+        return false;
+    }
+
+    std::vector<f32> heights(static_cast<size_t>(area.width) * area.depth);
+    if (!file.read(area, heights, _taskScheduler)) {
+        slog::warning("The tiled heightmap '{}' is corrupted", path.string());
+        return false;
+    }
+
+    _width = area.width;
+    _depth = area.depth;
+    _mappedFile.close();
+    _heights = std::move(heights);
+    _dirtyRegions.clear();
+    _loadedPagedRegion = {};
+
     _renderer->updateBuffers(_heights, _width, _depth, _textureScale, _mapScale);
     _updateImageView();
+
+    const std::chrono::duration<f32, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    slog::info(
+        "Loaded the region ({}, {}) {}x{} of the tiled heightmap '{}' ({:.1f} MiB) in {:.1f} ms",
+        area.x, area.z, _width, _depth, path.string(), file.getFileSize() / (1024.f * 1024.f), elapsed.count()
+    );
     return true;
 }
 
-bool Terrain::loadImageFromFile(const std::filesystem::path &path) {
-    int width, height, channels;
+bool Terrain::openPaged(const std::filesystem::path &path) {
+    const auto start = std::chrono::steady_clock::now();
+
+    // the raw files are converted next to them
+    bool isOpen = false;
+    if (path.extension() == ".raw") {
+        std::filesystem::path pagedPath = path;
+        pagedPath.replace_extension(".gphm");
+
+        // a conversion made earlier may hold regions written back since, it isn't overwritten silently
+        std::error_code error;
+        bool isConverted = std::filesystem::exists(pagedPath, error);
+        if (isConverted) {
+            std::error_code rawError;
+            const auto pagedTime = std::filesystem::last_write_time(pagedPath, error);
+            const auto rawTime = std::filesystem::last_write_time(path, rawError);
+            const bool isNewer = !error && !rawError && pagedTime >= rawTime;
+            isConverted = isNewer || !Necrosis::Window::showConfirmMessageBox(std::format(
+                "'{}' is older than '{}'. Convert the raw heightmap again and overwrite it?\n"
+                "The changes made in it would be lost, answer no to open it as it is.",
+                pagedPath.filename().string(), path.filename().string()
+            ));
+        }
+        if (isConverted) {
+            slog::info("Opening '{}', converted from '{}' earlier", pagedPath.string(), path.string());
+            isOpen = _pagedHeightmap.open(pagedPath);
+        }
+        else {
+            isOpen = _pagedHeightmap.importRaw(path, pagedPath);
+        }
+    }
+    else {
+        isOpen = _pagedHeightmap.open(path);
+    }
+    if (!isOpen) {
+        slog::warning("Failed to open the paged heightmap '{}'", path.string());
+        return false;
+    }
 
-    stbi_set_flip_vertically_on_load(false);
-    u8 *imageBuffer = stbi_load(path.c_str(), &width, &height, &channels, 1);
+    const std::chrono::duration<f32, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    slog::info(
+        "Opened the paged heightmap '{}' ({}x{}) in {:.1f} ms",
+        _pagedHeightmap.getPath().string(), _pagedHeightmap.getWidth(), _pagedHeightmap.getDepth(), elapsed.count()
+    );
+    return loadPagedOverview(2048);
+}
 
-    if (!imageBuffer) {
-        slog::warning("Failed to load heightmap '{}'", path.string());
+bool Terrain::createPaged(const std::filesystem::path &path, u32 width, u32 depth) {
+    if (width == 0 || depth == 0) {
+        slog::warning("The width and depth sizes of the map must be greater than 0");
+        return false;
+    }
+    if (!_pagedHeightmap.create(path, width, depth)) {
+        slog::warning("Failed to create the paged heightmap '{}'", path.string());
         return false;
     }
+    slog::info("Created the paged heightmap '{}' ({}x{})", path.string(), width, depth);
+    return loadPagedOverview(2048);
+}
+
+bool Terrain::loadPagedRegion(const HeightmapRegion &region) {
+    expect(_pagedHeightmap.isOpen(), "No paged heightmap is open");
+    const auto start = std::chrono::steady_clock::now();
 
-    if (width <= 0 || height <= 0) {
+    if (region.isEmpty()
+     || region.x >= _pagedHeightmap.getWidth() || region.width > _pagedHeightmap.getWidth() - region.x
+     || region.z >= _pagedHeightmap.getDepth() || region.depth > _pagedHeightmap.getDepth() - region.z) {
         slog::warning(
-            "Error loading heightmap '{}'\n"
-            "The width and depth sizes of the map must be greater than 0",
-            path.string()
+            "The region is out of the paged heightmap of size {}x{}",
+            _pagedHeightmap.getWidth(), _pagedHeightmap.getDepth()
         );
         return false;
     }
 
+    std::vector<f32> heights(static_cast<size_t>(region.width) * region.depth);
+    if (!_pagedHeightmap.readRegion(region, heights)) {
+        return false;
+    }
+
+    _width = region.width;
+    _depth = region.depth;
+    _mappedFile.close();
+    _heights = std::move(heights);
+    _dirtyRegions.clear();
+    _loadedPagedRegion = region;
+
+    _renderer->updateBuffers(_heights, _width, _depth, _textureScale, _mapScale);
+    _updateImageView();
+
+    const std::chrono::duration<f32, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    slog::info("Loaded the region ({}, {}) {}x{} of the paged heightmap in {:.1f} ms", region.x, region.z, _width, _depth, elapsed.count());
+    return true;
+}
+
+bool Terrain::loadPagedOverview(u32 maxSize) {
+    expect(_pagedHeightmap.isOpen(), "No paged heightmap is open");
+    expect(maxSize > 0, "The overview can't be empty");
+
+    const u32 largestSide = std::max(_pagedHeightmap.getWidth(), _pagedHeightmap.getDepth());
+    const u32 stride = (largestSide + maxSize - 1) / maxSize;
+    const u32 width = (_pagedHeightmap.getWidth() + stride - 1) / stride;
+    const u32 depth = (_pagedHeightmap.getDepth() + stride - 1) / stride;
+
+    std::vector<f32> heights(static_cast<size_t>(width) * depth);
+    if (!_pagedHeightmap.readOverview(stride, heights)) {
+        return false;
+    }
+
     _width = width;
-    _depth = height;
+    _depth = depth;
+    _mappedFile.close();
+    _heights = std::move(heights);
+    _dirtyRegions.clear();
+    _loadedPagedRegion = {};
 
-    _heights.resize(_width * _depth);
-    for (u32 i = 0; i < _width * _depth; ++i) {
-        _heights[i] = imageBuffer[i];
+    _renderer->updateBuffers(_heights, _width, _depth, _textureScale, _mapScale);
+    _updateImageView();
+    return true;
+}
+
+bool Terrain::writeBackPagedRegion() {
+    expect(_pagedHeightmap.isOpen(), "No paged heightmap is open");
+    const std::span<const f32> heights = getHeights();
+    if (_loadedPagedRegion.isEmpty()
+     || _loadedPagedRegion.width != _width || _loadedPagedRegion.depth != _depth
+     || heights.size() != static_cast<size_t>(_width) * _depth) {
+        slog::warning("The terrain doesn't hold a region of the paged heightmap anymore");
+        return false;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    if (!_pagedHeightmap.writeRegion(_loadedPagedRegion, heights) || !_pagedHeightmap.flush()) {
+        slog::warning("Failed to write the region in the paged heightmap '{}'", _pagedHeightmap.getPath().string());
+        return false;
+    }
+
+    const std::chrono::duration<f32, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    slog::info("Wrote back the region of the paged heightmap in {:.1f} ms", elapsed.count());
+    return true;
+}
+
+bool Terrain::loadImageFromFile(const std::filesystem::path &path) {
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<f32> heights;
+    u32 width = 0, depth = 0;
+    const char *bitDepth = "32 bit float";
+
+    if (path.extension() == ".pfm") {
+        if (!HeightmapFormats::readPfm(path, heights, width, depth)) {
+            slog::warning("Failed to load heightmap '{}'", path.string());
+            return false;
+        }
     }
+    else {
+        int imageWidth, imageHeight, channels;
+        stbi_set_flip_vertically_on_load(false);
+
+        // the 16 bit images are kept in 16 bit instead of being reduced to 8
+        const bool is16Bit = stbi_is_16_bit(path.c_str());
+        void *imageBuffer = is16Bit
+            ? static_cast<void*>(stbi_load_16(path.c_str(), &imageWidth, &imageHeight, &channels, 1))
+            : static_cast<void*>(stbi_load(path.c_str(), &imageWidth, &imageHeight, &channels, 1));
+
+        if (!imageBuffer) {
+            slog::warning("Failed to load heightmap '{}'", path.string());
+            return false;
+        }
+
+        if (imageWidth <= 0 || imageHeight <= 0) {
+            slog::warning(
+                "Error loading heightmap '{}'\n"
+                "The width and depth sizes of the map must be greater than 0",
+                path.string()
+            );
+            stbi_image_free(imageBuffer);
+            return false;
+        }
+
+        width = imageWidth;
+        depth = imageHeight;
+        heights.resize(static_cast<size_t>(width) * depth);
+        if (is16Bit) {
+            HeightmapFormats::toHeights(std::span(static_cast<const u16*>(imageBuffer), heights.size()), heights);
+            bitDepth = "16 bit";
+        }
+        else {
+            HeightmapFormats::toHeights(std::span(static_cast<const u8*>(imageBuffer), heights.size()), heights);
+            bitDepth = "8 bit";
+        }
+        stbi_image_free(imageBuffer);
+    }
+
+    _width = width;
+    _depth = depth;
+    _mappedFile.close();
+    _heights = std::move(heights);
+    _dirtyRegions.clear();
+    _loadedPagedRegion = {};
 
-    stbi_image_free(imageBuffer);
     _renderer->updateBuffers(_heights, _width, _depth, _textureScale, _mapScale);
     _updateImageView();
+
+    const std::chrono::duration<f32, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    slog::info("Loaded the {} heightmap '{}' ({}x{}) in {:.1f} ms", bitDepth, path.string(), _width, _depth, elapsed.count());
     return true;
 }
 
 void Terrain::_updateImageView() const {
     std::vector<u8> image(_width * _depth);
+    HeightmapFormats::toPixels(getHeights(), image);
 
-    for (size_t i = 0; i < image.size(); i++) {
-        image[i] = static_cast<u8>(_heights[i]);
+    auto texture = Necrosis::TextureManager::getTextureFromID(_imageView);
+    texture.updateTexture(image.data(), _width, _depth, Necrosis::PixelFormat::Luminance);
+}
+
+void Terrain::_updateImageView(const HeightmapRegion &region) const {
+    std::vector<u8> image(static_cast<size_t>(region.width) * region.depth);
+    for (u32 z = 0; z < region.depth; z++) {
+        HeightmapFormats::toPixels(
+            getRow(region.z + z).subspan(region.x, region.width),
+            std::span(image).subspan(static_cast<size_t>(z) * region.width, region.width)
+        );
     }
 
     auto texture = Necrosis::TextureManager::getTextureFromID(_imageView);
-    texture.updateTexture(image.data(), _width, _depth, Necrosis::PixelFormat::Luminance);
+    texture.updateRegion(
+        image.data(), static_cast<int>(region.x), static_cast<int>(region.z),
+        static_cast<int>(region.width), static_cast<int>(region.depth), Necrosis::PixelFormat::Luminance
+    );
 }
 
 void Terrain::uiRender() {
     const int step = 1;
     const int fastStep = 10;
+
+    // the files are loaded here as the dialogs can call back from another thread
+    std::filesystem::path rawFileToLoad, imageFileToLoad, tiledFileToLoad, tiledFileToSave, rawFileToBenchmark;
+    std::filesystem::path pagedFileToOpen, pagedFileToCreate;
+    {
+        std::lock_guard lock(_dialogMutex);
+        rawFileToLoad = std::exchange(_rawFileToLoad, {});
+        imageFileToLoad = std::exchange(_imageFileToLoad, {});
+        tiledFileToLoad = std::exchange(_tiledFileToLoad, {});
+        tiledFileToSave = std::exchange(_tiledFileToSave, {});
+        pagedFileToOpen = std::exchange(_pagedFileToOpen, {});
+        pagedFileToCreate = std::exchange(_pagedFileToCreate, {});
+        rawFileToBenchmark = std::exchange(_rawFileToBenchmark, {});
+    }
+    if (!rawFileToLoad.empty() && !loadRawFromFile(rawFileToLoad)) {
+        Necrosis::Window::showWarningMessageBox(std::format("Failed to load '{}'", rawFileToLoad.string()));
+    }
+    if (!imageFileToLoad.empty() && !loadImageFromFile(imageFileToLoad)) {
+        Necrosis::Window::showWarningMessageBox(std::format("Failed to load '{}'", imageFileToLoad.string()));
+    }
+    if (!tiledFileToLoad.empty() && !loadTiledFromFile(tiledFileToLoad, _isTiledRegionEnabled ? _tiledRegion : HeightmapRegion{})) {
+        Necrosis::Window::showWarningMessageBox(std::format("Failed to load '{}'", tiledFileToLoad.string()));
+    }
+    if (!tiledFileToSave.empty() && !saveAsTiled(tiledFileToSave)) {
+        Necrosis::Window::showWarningMessageBox(std::format("Failed to write to file '{}'", tiledFileToSave.string()));
+    }
+    if (!pagedFileToOpen.empty() && !openPaged(pagedFileToOpen)) {
+        Necrosis::Window::showWarningMessageBox(std::format("Failed to open '{}'", pagedFileToOpen.string()));
+    }
+    if (!pagedFileToCreate.empty() && !createPaged(pagedFileToCreate, _newPagedSize[0], _newPagedSize[1])) {
+        Necrosis::Window::showWarningMessageBox(std::format("Failed to create '{}'", pagedFileToCreate.string()));
+    }
+    if (!rawFileToBenchmark.empty()) {
+        runRawLoadingBenchmark(rawFileToBenchmark);
+    }
+    _updateRawSave();
+
     ImGui::Begin("Terrain");
         ImGui::InputScalar("Width", ImGuiDataType_U32, &_width, &step, &fastStep);
         ImGui::InputScalar("Depth", ImGuiDataType_U32, &_depth, &step, &fastStep);
         ImGui::SliderFloat("Texture scale", &_textureScale, 0.1f, 20.f);
         ImGui::SliderFloat3("Scale", glm::value_ptr(_scale), 0.f, 2.f);
         ImGui::InputFloat("Map scale", &_mapScale);
+
+        // the dimensions above can be edited without changing the heights
+        const std::span<const f32> heights = getHeights();
+        const bool isMeshValid = heights.size() == static_cast<size_t>(_width) * _depth;
+        const char *renderModes[] = { "Mesh", "Heightfield (gpu)", "Quadtree LOD (gpu)" };
+        int renderMode = static_cast<int>(_renderer->getRenderMode());
+        if (ImGui::Combo("Render mode", &renderMode, renderModes, IM_ARRAYSIZE(renderModes))) {
+            _renderer->setRenderMode(static_cast<TerrainRenderer::RenderMode>(renderMode));
+            if (isMeshValid) {
+                _renderer->updateBuffers(heights, _width, _depth, _textureScale, _mapScale);
+            }
+        }
+        if (_renderer->getRenderMode() == TerrainRenderer::RenderMode::Quadtree) {
+            f32 triangleSize = _renderer->getLodTriangleSize();
+            if (ImGui::SliderFloat("LOD triangle size (px)", &triangleSize, 0.5f, 32.f)) {
+                _renderer->setLodTriangleSize(triangleSize);
+            }
+            ImGui::Text("LOD levels: %u", _renderer->getLodLevelCount());
+        }
+        ImGui::Text("GPU memory: %.1f MiB", static_cast<f32>(_renderer->getGpuMemoryUsage()) / (1024.f * 1024.f));
+
+        const char *normalModes[] = { "6 neighbours", "Central difference" };
+        int normalMode = static_cast<int>(_renderer->getNormalMode());
+        if (ImGui::Combo("Normals", &normalMode, normalModes, IM_ARRAYSIZE(normalModes))) {
+            _renderer->setNormalMode(static_cast<TerrainRenderer::NormalMode>(normalMode));
+            if (isMeshValid) {
+                _renderer->updateBuffers(heights, _width, _depth, _textureScale, _mapScale);
+            }
+        }
+        if (ImGui::Button("Benchmark meshing") && isMeshValid) {
+            _renderer->updateBuffers(heights, _width, _depth, _textureScale, _mapScale);
+            _renderer->runBenchmark(heights);
+        }
+        const auto &benchmark = _renderer->getBenchmark();
+        if (benchmark.threadCount > 0) {
+            ImGui::Text(
+                "6 neighbours: %.1fM vertices/s | central difference: %.1fM vertices/s (%u threads)",
+                benchmark.sixNeighbours * 1e-6f, benchmark.centralDifference * 1e-6f, benchmark.threadCount
+            );
+        }
+
+        ImGui::Separator();
+        if (ImGui::Button("Load raw")) {
+            Necrosis::Window::openFileDialog([this](std::string path) {
+                if (path == "") { return; }
+                std::lock_guard lock(_dialogMutex);
+                _rawFileToLoad = path;
+            }, {{"Raw Heightmap", ".raw"}});
+        } ImGui::SameLine();
+        if (ImGui::Button("Load image")) {
+            Necrosis::Window::openFileDialog([this](std::string path) {
+                if (path == "") { return; }
+                std::lock_guard lock(_dialogMutex);
+                _imageFileToLoad = path;
+            }, {{"Heightmap image", ".png;.jpg;.pfm"}});
+        } ImGui::SameLine();
+        if (ImGui::Button("Load tiled")) {
+            Necrosis::Window::openFileDialog([this](std::string path) {
+                if (path == "") { return; }
+                std::lock_guard lock(_dialogMutex);
+                _tiledFileToLoad = path;
+            }, {{"Tiled Heightmap", ".gthm"}});
+        } ImGui::SameLine();
+        if (ImGui::Button("Benchmark raw loading")) {
+            Necrosis::Window::openFileDialog([this](std::string path) {
+                if (path == "") { return; }
+                std::lock_guard lock(_dialogMutex);
+                _rawFileToBenchmark = path;
+            }, {{"Raw Heightmap", ".raw"}});
+        }
+        ImGui::Text("Heights: %s", isMapped() ? "mapped from the file" : "in memory");
+        ImGui::InputFloat("Tiled precision (0 = lossless)", &_tiledPrecision, 0.f, 0.f, "%g");
+        _tiledPrecision = std::max(_tiledPrecision, 0.f);
+        ImGui::Checkbox("Load a region of the tiled heightmaps", &_isTiledRegionEnabled);
+        if (_isTiledRegionEnabled) {
+            ImGui::InputScalarN("Region x, z, width, depth", ImGuiDataType_U32, &_tiledRegion, 4);
+        }
+        ImGui::Checkbox("Save raw in the background", &_isAsyncSaveEnabled);
+        if (_saveTask.valid()) {
+            ImGui::SameLine();
+            ImGui::Text("saving '%s'...", _savingPath.filename().string().c_str());
+        }
+
+        ImGui::Separator();
+        ImGui::Text("Paged heightmap");
+        // a job is working on the current file
+        const bool isPagedBusy = _pagedHeightmap.isBusy();
+        ImGui::BeginDisabled(isPagedBusy);
+        if (ImGui::Button("Open paged")) {
+            Necrosis::Window::openFileDialog([this](std::string path) {
+                if (path == "") { return; }
+                std::lock_guard lock(_dialogMutex);
+                _pagedFileToOpen = path;
+            }, {{"Paged or Raw Heightmap", ".gphm;.raw"}});
+        } ImGui::SameLine();
+        if (ImGui::Button("New paged")) {
+            Necrosis::Window::saveFileDialog([this](std::string path) {
+                if (path == "") { return; }
+                std::lock_guard lock(_dialogMutex);
+                _pagedFileToCreate = path;
+            }, {{"Paged Heightmap", ".gphm"}});
+        }
+        ImGui::EndDisabled();
+        if (isPagedBusy && ImGui::IsItemHovered(ImGuiHoveredFlags_AllowWhenDisabled)) {
+            ImGui::SetTooltip("A job is working on the paged heightmap");
+        }
+        ImGui::SameLine();
+        ImGui::SetNextItemWidth(200.f);
+        ImGui::InputScalarN("Size of new paged", ImGuiDataType_U32, _newPagedSize, 2);
+        if (_pagedHeightmap.isOpen()) {
+            const auto stats = _pagedHeightmap.getStats();
+            ImGui::Text(
+                "%s: %ux%u, %zu/%zu MiB resident | hits: %llu, misses: %llu, evictions: %llu, write backs: %llu",
+                _pagedHeightmap.getPath().filename().string().c_str(), _pagedHeightmap.getWidth(), _pagedHeightmap.getDepth(),
+                stats.residentTiles * _pagedHeightmap.getTileSize() * _pagedHeightmap.getTileSize() * sizeof(f32) / (1024 * 1024),
+                _pagedHeightmap.getResidentBytes() / (1024 * 1024), static_cast<unsigned long long>(stats.hits),
+                static_cast<unsigned long long>(stats.misses), static_cast<unsigned long long>(stats.evictions),
+                static_cast<unsigned long long>(stats.writeBacks)
+            );
+            ImGui::InputScalarN("Paged region x, z, width, depth", ImGuiDataType_U32, &_pagedRegion, 4);
+            if (ImGui::Button("Load region") && !loadPagedRegion(_pagedRegion)) {
+                Necrosis::Window::showWarningMessageBox("Failed to load the region of the paged heightmap");
+            } ImGui::SameLine();
+            if (ImGui::Button("Load overview") && !loadPagedOverview(2048)) {
+                Necrosis::Window::showWarningMessageBox("Failed to load the overview of the paged heightmap");
+            } ImGui::SameLine();
+            ImGui::BeginDisabled(_loadedPagedRegion.isEmpty());
+            if (ImGui::Button("Write back region") && !writeBackPagedRegion()) {
+                Necrosis::Window::showWarningMessageBox("Failed to write the region in the paged heightmap");
+            }
+            ImGui::EndDisabled();
+        }
+
+        const auto &rawBenchmark = _rawLoadingBenchmark;
+        if (rawBenchmark.fileSize > 0) {
+            ImGui::Text(
+                "stream: %.1f ms, %.1f MiB heap | mapped: %.1f ms, %.1f MiB heap",
+                rawBenchmark.streamSeconds * 1000.f, rawBenchmark.streamHeapBytes / (1024.f * 1024.f),
+                rawBenchmark.mappedSeconds * 1000.f, rawBenchmark.mappedHeapBytes / (1024.f * 1024.f)
+            );
+        }
     ImGui::End();
 }
 
-void Terrain::uiDrawHeightmapTexture() const {
+void Terrain::uiDrawHeightmapTexture() {
     ImGui::Begin("Heightmap");
 
         ImGui::Text("Resolution: %dx%d", _width, _depth);
@@ -223,35 +842,63 @@ void Terrain::uiDrawHeightmapTexture() const {
         if (ImGui::Button("Save as raw")) {
             Necrosis::Window::saveFileDialog([this](std::string path) {
                 if (path == "") { return; }
-                if (!saveAsRaw(path)) {
+                requestRawSave(path);
+            }, {{"Raw Heightmap", ".raw"}});
+        } ImGui::SameLine();
+        if (ImGui::Button("Save as png")) {
+            Necrosis::Window::saveFileDialog([this](std::string path) {
+                if (path == "") { return; }
+                if (!saveAsPng(path)) {
                     std::string msg = std::format("Failed to write to file '{}'", path);
                     slog::warning(msg);
                     Necrosis::Window::showWarningMessageBox(msg);
                 }
-            }, {{"Raw Heightmap", ".raw"}});
+            }, {{"PNG Image", ".png"}});
         } ImGui::SameLine();
-        if (ImGui::Button("Save as png")) {
+        if (ImGui::Button("Save as 8 bit png")) {
             Necrosis::Window::saveFileDialog([this](std::string path) {
                 if (path == "") { return; }
-                if (!saveAsPng(path)) {
+                if (!saveAsPng(path, 8)) {
                     std::string msg = std::format("Failed to write to file '{}'", path);
                     slog::warning(msg);
                     Necrosis::Window::showWarningMessageBox(msg);
                 }
             }, {{"PNG Image", ".png"}});
+        } ImGui::SameLine();
+        if (ImGui::Button("Save as tiled")) {
+            Necrosis::Window::saveFileDialog([this](std::string path) {
+                if (path == "") { return; }
+                requestTiledSave(path);
+            }, {{"Tiled Heightmap", ".gthm"}});
+        } ImGui::SameLine();
+        if (ImGui::Button("Save as pfm")) {
+            Necrosis::Window::saveFileDialog([this](std::string path) {
+                if (path == "") { return; }
+                if (!saveAsPfm(path)) {
+                    std::string msg = std::format("Failed to write to file '{}'", path);
+                    slog::warning(msg);
+                    Necrosis::Window::showWarningMessageBox(msg);
+                }
+            }, {{"Portable Float Map", ".pfm"}});
         }
 
     ImGui::End();
 }
 
-bool Terrain::saveAsPng(const std::filesystem::path &path) const {
-    assert(_width * _depth == _heights.size() && "The heightmap size is invalid");
-    std::vector<u8> image(_width * _depth);
+bool Terrain::saveAsPng(const std::filesystem::path &path, u32 bitDepth) const {
+    const std::span<const f32> heights = getHeights();
+    assert(_width * _depth == heights.size() && "The heightmap size is invalid");
+    expect(bitDepth == 8 || bitDepth == 16, "The png images are saved in 8 or 16 bit");
 
-    for (size_t i = 0; i < image.size(); i++) {
-        image[i] = static_cast<u8>(_heights[i]);
+    if (bitDepth == 16) {
+        std::vector<u16> image(_width * _depth);
+        HeightmapFormats::toPixels(heights, image);
+        return HeightmapFormats::writePng16(path, image, _width, _depth);
     }
 
+    std::vector<u8> image(_width * _depth);
+    HeightmapFormats::toPixels(heights, image);
+
     if (!stbi_write_png(path.c_str(), _width, _depth, 1, image.data(), _width)) {
         return false;
     }
@@ -259,23 +906,178 @@ bool Terrain::saveAsPng(const std::filesystem::path &path) const {
     return true;
 }
 
+bool Terrain::saveAsPfm(const std::filesystem::path &path) const {
+    const std::span<const f32> heights = getHeights();
+    assert(_width * _depth == heights.size() && "The heightmap size is invalid");
+
+    return HeightmapFormats::writePfm(path, heights, _width, _depth);
+}
+
+bool Terrain::saveAsTiled(const std::filesystem::path &path) {
+    const std::span<const f32> heights = getHeights();
+    assert(_width * _depth == heights.size() && "The heightmap size is invalid");
+
+    const auto start = std::chrono::steady_clock::now();
+    if (!TiledHeightmap::write(path, heights, _width, _depth, TiledHeightmap::DEFAULT_TILE_SIZE, _tiledPrecision, _taskScheduler)) {
+        slog::warning("Failed to save tiled heightmap file '{}'", path.string());
+        return false;
+    }
+
+    const std::chrono::duration<f32, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    std::error_code error;
+    const u64 fileSize = std::filesystem::file_size(path, error);
+    slog::info(
+        "Saved the tiled heightmap '{}' in {:.1f} ms: {:.1f} MiB, {:.1f}% of the raw size",
+        path.string(), elapsed.count(), fileSize / (1024.f * 1024.f), 100.f * fileSize / heights.size_bytes()
+    );
+    return true;
+}
+
+void Terrain::requestTiledSave(const std::filesystem::path &path) {
+    std::lock_guard lock(_dialogMutex);
+    _tiledFileToSave = path;
+}
+
+/**
+ * @brief Waits until the content of a closed file is written to the disk
+ * @return true on success and false on failure
+ */
+bool syncFile(const std::filesystem::path &path) {
+#if defined(_WIN64) || defined(_WIN32)
+    HANDLE file = CreateFileW(
+        path.c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr
+    );
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    const bool isSynced = FlushFileBuffers(file);
+    CloseHandle(file);
+#else
+    const int file = ::open(path.c_str(), O_WRONLY);
+    if (file == -1) {
+        return false;
+    }
+    const bool isSynced = fsync(file) == 0;
+    ::close(file);
+#endif
+    return isSynced;
+}
+
+/**
+ * @brief Writes a raw heightmap file in a temporary file and renames it to `path` once complete.
+ * The temporary file is synced to the disk before the rename, so a crash leaves either the
+ * previous file or the new one, never a partial file
+ */
+bool writeRawFile(const std::filesystem::path &path, std::span<const f32> heights, u32 width, u32 depth) {
+    std::filesystem::path temporaryPath = path;
+    temporaryPath += ".tmp";
+
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            slog::warning("Failed to create the file '{}'", temporaryPath.string());
+            return false;
+        }
+
+        // large writes skip the buffer of the stream and go straight to the file
+        const u32 header[2] = { width, depth };
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(heights.data()), static_cast<std::streamsize>(heights.size_bytes()));
+        file.close();
+
+        if (file.fail() || !syncFile(temporaryPath)) {
+            slog::warning("Failed to write the file '{}'", temporaryPath.string());
+            std::error_code error;
+            std::filesystem::remove(temporaryPath, error);
+            return false;
+        }
+    }
+
+    // replaces the previous file at once. on Windows, it can't be mapped by a terrain anymore
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error) {
+        slog::warning("Failed to replace the file '{}': {}", path.string(), error.message());
+        std::filesystem::remove(temporaryPath, error);
+        return false;
+    }
+    return true;
+}
+
 bool Terrain::saveAsRaw(const std::filesystem::path &path) const {
-    assert(_width * _depth == _heights.size() && "The heightmap size is invalid");
+    const std::span<const f32> heights = getHeights();
+    assert(_width * _depth == heights.size() && "The heightmap size is invalid");
 
-    std::fstream file(path, std::ios::binary | std::ios::out);
-    if (!file.is_open()) {
+    const auto start = std::chrono::steady_clock::now();
+    if (!writeRawFile(path, heights, _width, _depth)) {
         slog::warning("Failed to save raw heightmap file '{}'", path.string());
         return false;
     }
 
-    file.write(reinterpret_cast<const char*>(&_width), sizeof(_width));
-    file.write(reinterpret_cast<const char*>(&_depth), sizeof(_depth));
+    const std::chrono::duration<f32, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    slog::info("Saved the raw heightmap '{}' in {:.1f} ms", path.string(), elapsed.count());
+    return true;
+}
+
+std::future<bool> Terrain::saveAsRawAsync(const std::filesystem::path &path) const {
+    assert(_width * _depth == getHeights().size() && "The heightmap size is invalid");
 
-    for (size_t i = 0; i < _heights.size(); i++) {
-        file.write(reinterpret_cast<const char*>(&_heights[i]), sizeof(f32));
+    return _taskScheduler.submit([path, heights = std::vector<f32>(getHeights().begin(), getHeights().end()), width = _width, depth = _depth]() {
+        const auto start = std::chrono::steady_clock::now();
+        if (!writeRawFile(path, heights, width, depth)) {
+            return false;
+        }
+
+        const std::chrono::duration<f32, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        slog::info("Saved the raw heightmap '{}' in the background in {:.1f} ms", path.string(), elapsed.count());
+        return true;
+    });
+}
+
+void Terrain::requestRawSave(const std::filesystem::path &path) {
+    std::lock_guard lock(_dialogMutex);
+    _rawFileToSave = path;
+}
+
+void Terrain::_updateRawSave() {
+    using namespace std::chrono_literals;
+
+    auto reportFailure = [](const std::filesystem::path &path) {
+        std::string msg = std::format("Failed to write to file '{}'", path.string());
+        slog::warning(msg);
+        Necrosis::Window::showWarningMessageBox(msg);
+    };
+
+    if (_saveTask.valid() && _saveTask.wait_for(0s) == std::future_status::ready) {
+        if (!_saveTask.get()) {
+            reportFailure(_savingPath);
+        }
     }
 
-    return true;
+    std::filesystem::path path;
+    {
+        std::lock_guard lock(_dialogMutex);
+        // a request made while saving waits for the end of the save
+        if (_saveTask.valid()) { return; }
+        path = std::exchange(_rawFileToSave, {});
+    }
+    if (path.empty()) { return; }
+
+#if defined(_WIN64) || defined(_WIN32)
+    // a mapped file can't be replaced, the heights are copied in memory to save over the loaded file
+    std::error_code error;
+    if (_mappedFile.isOpen() && std::filesystem::equivalent(path, _mappedFile.getPath(), error)) {
+        _getMutableHeights();
+    }
+#endif
+
+    if (_isAsyncSaveEnabled) {
+        _savingPath = path;
+        _saveTask = saveAsRawAsync(path);
+    }
+    else if (!saveAsRaw(path)) {
+        reportFailure(path);
+    }
 }
 
 
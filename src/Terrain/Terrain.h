@@ -1,14 +1,24 @@
 #pragma once
 
+#include <cassert>
 #include <vector>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <span>
+#include <utility>
 #include <filesystem>
 
 #include <Common.h>
 #include <Necrosis/renderer/Renderer.h>
 #include <Necrosis/renderer/Texture.h>
+#include <Necrosis/tasks/TaskScheduler.h>
 
+#include "HeightmapRegion.h"
+#include "PagedHeightmap.h"
 #include "TerrainRenderer.h"
+#include "TiledHeightmap.h"
+#include "../Utils/MappedFile.h"
 
 namespace Geophagia {
 /**
@@ -20,23 +30,113 @@ namespace Geophagia {
  */
 class Terrain : public Necrosis::Renderable {
 public:
-    Terrain();
-    Terrain(const u32 width, const u32 depth);
+    /**
+     * @brief Scoped write access to the heights of the terrain, see `Terrain::editHeights`
+     *
+     * The region it was created for is marked dirty and uploaded to the GPU
+     * when it is destroyed, so the terrain must not be modified otherwise meanwhile.
+     */
+    class EditHandle {
+    public:
+        EditHandle(const EditHandle&) = delete;
+        EditHandle& operator=(const EditHandle&) = delete;
+        EditHandle(EditHandle &&other) noexcept
+            : _terrain(std::exchange(other._terrain, nullptr)), _heights(other._heights), _region(other._region) {}
+        EditHandle& operator=(EditHandle&&) = delete;
+        ~EditHandle();
+
+        /**
+         * @brief Heights of the whole terrain row by row. Only the cells of the region may be modified
+         */
+        std::span<f32> getHeights() const { return _heights; }
+        f32& at(u32 x, u32 z) const {
+            assert(x - _region.x < _region.width && z - _region.z < _region.depth && "The cell is out of the edited region");
+            return _heights[static_cast<size_t>(z) * _terrain->_width + x];
+        }
+        const HeightmapRegion& getRegion() const { return _region; }
+
+    private:
+        friend class Terrain;
+        EditHandle(Terrain &terrain, std::span<f32> heights, const HeightmapRegion &region)
+            : _terrain(&terrain), _heights(heights), _region(region) {}
+
+        Terrain *_terrain;
+        std::span<f32> _heights;
+        HeightmapRegion _region;
+    };
+
+    /**
+     * @brief Time to read all the heights of a raw file with a stream and through a mapping,
+     * and the heap memory each way keeps for them
+     */
+    struct RawLoadingBenchmark {
+        u64 fileSize = 0;
+        f32 streamSeconds = 0.f;
+        f32 mappedSeconds = 0.f;
+        size_t streamHeapBytes = 0;
+        size_t mappedHeapBytes = 0;
+    };
+
+    /**
+     * @param taskScheduler Runs the parallel and background work of the terrain and its renderer
+     */
+    Terrain(Necrosis::TaskScheduler &taskScheduler);
+    Terrain(Necrosis::TaskScheduler &taskScheduler, const u32 width, const u32 depth);
     virtual ~Terrain();
 
     void render() const override; ///< @brief renders the terrain
+    /**
+     * @brief Renders the chunks of the terrain inside the frustum of `clipFromModel`
+     * @param clipFromModel projection * view * model matrix of the pass
+     */
+    TerrainRenderer::CullingStats render(const glm::mat4 &clipFromModel) const;
+    /**
+     * @brief Sets the camera the detail levels of the quadtree render mode are chosen from
+     * @param position position of the camera in world space
+     * @param pixelsPerUnit size in pixels of 1 unit seen from a distance of 1
+     */
+    void setLodCamera(const glm::vec3 &position, f32 pixelsPerUnit) { _renderer->setLodCamera({ getModelMatrix(), position, pixelsPerUnit }); }
+    /**
+     * @brief Sets the uniforms the terrain shaders need to render the terrain,
+     * must be called after binding the shader and before `render`
+     */
+    void setShaderUniforms(Necrosis::Shader &shader) const { _renderer->setShaderUniforms(shader); }
     /**
      * @brief Loads a new terrain from the passed values
      *
      * This function performs a validity check on the size of the terrain before
-     * updating the heightmap and then resets the GPU buffers for rendering.
+     * updating the heightmap and then updates the GPU buffers for rendering.
+     * When the dimensions don't change, only the regions where the heights
+     * differ are updated.
      *
      * @param heights vector of the elevation values of the heightmap
      * @param width width of the terrain
      * @param depth depth of the terrain
      * @return true on success and false on failure
      */
-    bool loadRawFromMemory(const std::vector<f32> &heights, const u32 width, const u32 depth);
+    bool loadRawFromMemory(std::span<const f32> heights, const u32 width, const u32 depth);
+    /**
+     * @brief Same as above, but the terrain takes the heights instead of copying them
+     */
+    bool loadRawFromMemory(std::vector<f32> &&heights, const u32 width, const u32 depth);
+
+    /**
+     * @brief Gives write access to the heights in place, see `EditHandle`.
+     * Mapped heights are copied in memory first
+     *
+     * @param region cells that will be modified
+     */
+    EditHandle editHeights(const HeightmapRegion &region);
+
+    /**
+     * @brief Records that the heights of `region` changed.
+     * The GPU buffers are updated by the next call to `uploadChanges`
+     */
+    void markDirty(const HeightmapRegion &region);
+    /**
+     * @brief Updates the GPU buffers of the regions marked dirty since the last upload
+     */
+    void uploadChanges();
 
     /**
      * @brief Loads the heightmap from a raw file
@@ -46,45 +146,139 @@ public:
      * as 32bit floats. The number of elevation values must be width * depth.
      * The data *MUST* be in little endian.
      *
+     * The file is mapped in memory and the heights are used in place, without copy.
+     * They are copied in memory owned by the terrain the first time they are modified.
+     *
      * @param path path of the input file
      * @return true on success and false on failure
      */
     bool loadRawFromFile(const std::filesystem::path &path);
+    /**
+     * @brief Reads the raw file `path` with a stream and through a mapping, see `RawLoadingBenchmark`.
+     * The terrain is not modified
+     */
+    void runRawLoadingBenchmark(const std::filesystem::path &path);
+    const RawLoadingBenchmark& getRawLoadingBenchmark() const { return _rawLoadingBenchmark; }
 
     /**
      * @brief Loads the heightmap from an image
      *
-     * The supported file formats are png and jpeg.
+     * The supported file formats are png, jpeg and pfm (float).
      * Others formats are supported but not advised.
-     * Ideally, use 1 channel per pixel.
+     * Ideally, use 1 channel per pixel. The 16 bit pngs keep their precision,
+     * see `HeightmapFormats` for the conversion of the values.
      *
      * @param path path of the input file
      * @return true on success and false on failure
      */
     bool loadImageFromFile(const std::filesystem::path &path);
+    /**
+     * @brief Loads the heightmap, or a region of it, from a tiled heightmap file
+     *
+     * Only the tiles overlapping the region are read, see `TiledHeightmap`.
+     *
+     * @param path path of the input file
+     * @param region cells to load, the whole heightmap if empty
+     * @return true on success and false on failure
+     */
+    bool loadTiledFromFile(const std::filesystem::path &path, const HeightmapRegion &region = {});
+
+    /**
+     * @brief Opens a paged heightmap, see `PagedHeightmap`, to work on it a region at a time.
+     * The terrain shows an overview of it until a region is loaded
+     *
+     * @param path path of a paged heightmap, or of a raw file to convert first
+     * @return true on success and false on failure
+     */
+    bool openPaged(const std::filesystem::path &path);
+    /**
+     * @brief Creates and opens a flat paged heightmap
+     * @return true on success and false on failure
+     */
+    bool createPaged(const std::filesystem::path &path, u32 width, u32 depth);
+    /**
+     * @brief Replaces the terrain by a region of the paged heightmap. The generators
+     * and the renderer work on it as on any terrain, `writeBackPagedRegion` saves it
+     *
+     * @return true on success and false on failure
+     */
+    bool loadPagedRegion(const HeightmapRegion &region);
+    /**
+     * @brief Replaces the terrain by one height every few cells of the paged heightmap,
+     * so its largest side is at most `maxSize` cells. Nothing can be written back from it
+     *
+     * @return true on success and false on failure
+     */
+    bool loadPagedOverview(u32 maxSize);
+    /**
+     * @brief Writes the heights of the terrain in the paged heightmap, at the region they were loaded from
+     * @return true on success and false on failure
+     */
+    bool writeBackPagedRegion();
 
     /**
-     * @brief Saves the heightmap as a png image
+     * @brief Saves the heightmap as a grayscale png image
      *
      * @param path Name of the file
+     * @param bitDepth 16 keeps 257 steps between each integer height, 8 rounds the heights
      * @return true on success, false on failure
      */
-    bool saveAsPng(const std::filesystem::path &path) const;
+    bool saveAsPng(const std::filesystem::path &path, u32 bitDepth = 16) const;
+    /**
+     * @brief Saves the heightmap as a Portable Float Map, without loss
+     *
+     * @param path Name of the file
+     * @return true on success, false on failure
+     */
+    bool saveAsPfm(const std::filesystem::path &path) const;
+    /**
+     * @brief Saves the heightmap as a compressed tiled heightmap, with the precision set in the UI
+     *
+     * @param path Name of the file
+     * @return true on success, false on failure
+     *
+     * @see TiledHeightmap
+     */
+    bool saveAsTiled(const std::filesystem::path &path);
+    /**
+     * @brief Saves the heightmap as a tiled heightmap on the next `uiRender`.
+     * Can be called from any thread, like the callbacks of the file dialogs
+     */
+    void requestTiledSave(const std::filesystem::path &path);
     /**
      * @brief Saves the heightmap in a file. The details of the file format
      * are described in `loadRawFromFile`.
      *
+     * The file is written in a temporary file next to it, which replaces it
+     * once complete, so an existing file is never left half written. On Windows,
+     * the file the heights are mapped from can't be replaced, a save requested with
+     * `requestRawSave` copies them in memory first.
+     *
      * @param path Name of the file
      * @return true on success, false on failure
      *
      * @see loadRawFromFile
      */
     bool saveAsRaw(const std::filesystem::path &path) const;
+    /**
+     * @brief Same as `saveAsRaw`, but the file is written on a background thread
+     * from a copy of the heights, so the terrain can be modified meanwhile
+     *
+     * @param path Name of the file
+     * @return result of the save
+     */
+    std::future<bool> saveAsRawAsync(const std::filesystem::path &path) const;
+    /**
+     * @brief Saves the heightmap as raw on the next `uiRender`, in the background
+     * if enabled in the UI. Can be called from any thread, like the callbacks of the file dialogs.
+     * Failures are reported to the user
+     */
+    void requestRawSave(const std::filesystem::path &path);
 
     /**
      * @brief Draws the view of the heightmap as an image
      */
-    void uiDrawHeightmapTexture() const;
+    void uiDrawHeightmapTexture();
 
     void uiRender();
 
@@ -92,12 +286,29 @@ public:
 
     u32 getWidth() const { return _width; }
     u32 getDepth() const { return _depth; }
-    std::vector<f32> getHeights() const { return _heights; }
+    /**
+     * @brief Heights of the terrain row by row, without copy. Valid until the terrain is modified
+     */
+    std::span<const f32> getHeights() const;
+    /**
+     * @brief Heights of the row `z`, without copy. Valid until the terrain is modified
+     */
+    std::span<const f32> getRow(u32 z) const {
+        assert(z < _depth && "The row is out of the terrain");
+        return getHeights().subspan(static_cast<size_t>(z) * _width, _width);
+    }
+    bool isMapped() const { return _mappedFile.isOpen(); }
+    /**
+     * @brief Paged heightmap opened in the UI, see `openPaged`. It can be written from other threads
+     */
+    PagedHeightmap& getPagedHeightmap() { return _pagedHeightmap; }
     glm::mat4 getModelMatrix() const;
     float getVerticalScale() const { return _scale.y; }
     // const u32* getHeightMap() const { return _heights; }
 
 private:
+    Necrosis::TaskScheduler &_taskScheduler;
+
     u32 _width;
     u32 _depth;
     /**
@@ -114,7 +325,8 @@ private:
      */
     float _mapScale;
 
-    std::vector<f32> _heights;
+    std::vector<f32> _heights; ///< @brief Empty while the heights are read from `_mappedFile`
+    MappedFile _mappedFile; ///< @brief Raw file the heights are read from, if any
     Necrosis::TextureID _imageView;
 
     std::vector<Necrosis::TextureID> _textures;
@@ -122,11 +334,61 @@ private:
     float _textureScale;
 
     std::unique_ptr<TerrainRenderer> _renderer = nullptr;
+    /**
+     * @brief Regions changed since the last upload. Overlapping or touching
+     * regions are merged, so this stays small
+     */
+    std::vector<HeightmapRegion> _dirtyRegions;
+
+    /**
+     * @brief Marks the rows of `heights` that differ from the current heightmap
+     * as dirty. Consecutive changed rows are grouped in a single region
+     */
+    void _markChangedRegions(std::span<const f32> heights);
+    /**
+     * @brief Heights to modify. If they are read from a mapped file, they are
+     * first copied in `_heights` and the file is unmapped (copy on write)
+     */
+    std::vector<f32>& _getMutableHeights();
+
+    // files chosen in the dialogs, whose callbacks can be called from another thread
+    std::mutex _dialogMutex;
+    std::filesystem::path _rawFileToLoad;
+    std::filesystem::path _imageFileToLoad;
+    std::filesystem::path _tiledFileToLoad;
+    std::filesystem::path _tiledFileToSave;
+    std::filesystem::path _pagedFileToOpen;
+    std::filesystem::path _pagedFileToCreate;
+    std::filesystem::path _rawFileToBenchmark;
+    std::filesystem::path _rawFileToSave;
+    RawLoadingBenchmark _rawLoadingBenchmark;
+
+    f32 _tiledPrecision = 1.f / 1024.f; ///< @brief 0 saves the tiled heightmaps without loss
+    bool _isTiledRegionEnabled = false;
+    HeightmapRegion _tiledRegion = { 0, 0, 1024, 1024 }; ///< @brief Region loaded from the tiled heightmaps, if enabled
+
+    PagedHeightmap _pagedHeightmap;
+    HeightmapRegion _pagedRegion = { 0, 0, 2048, 2048 }; ///< @brief Region of the paged heightmap to load, edited in the UI
+    HeightmapRegion _loadedPagedRegion; ///< @brief Region the terrain holds, empty for the overview
+    u32 _newPagedSize[2] = { 32768, 32768 };
+
+    bool _isAsyncSaveEnabled = true;
+    std::future<bool> _saveTask;
+    std::filesystem::path _savingPath; ///< @brief File written by `_saveTask`
+
+    /**
+     * @brief Starts or runs the requested save and reports the result of the background one
+     */
+    void _updateRawSave();
 
     /**
      * @brief updates the content of `_texture` on the gpu side with the new
      * height values
      */
     void _updateImageView() const;
+    /**
+     * @brief Same as `_updateImageView` for the pixels of `region` only
+     */
+    void _updateImageView(const HeightmapRegion &region) const;
 };
 }
@@ -1,14 +1,20 @@
 #include "TerrainRenderer.h"
 
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <cmath>
 #include <iostream>
 
 #include <glad/glad.h>
 
+#include <Necrosis/renderer/Shader.h>
 #include <Necrosis/scene/Mesh.h>
 
 namespace Geophagia {
 
-TerrainRenderer::TerrainRenderer() {
+TerrainRenderer::TerrainRenderer(Necrosis::TaskScheduler &taskScheduler) : _taskScheduler(taskScheduler) {
     _vao = std::make_unique<Necrosis::VertexArray>();
     _vao->bind();
     _vbo = std::make_unique<Necrosis::VertexBuffer>(nullptr, 0, GL_FLOAT);
@@ -37,30 +43,255 @@ TerrainRenderer::TerrainRenderer() {
     // _normalVao->addBuffer(*_normalVbo, normalLayout);
     //
     // _normalVao->unbind();
+
+    // shared grid patch of the heightfield mode. The vertices have no attribute,
+    // the shader finds their coordinates in the patch from their index
+    _patchVao = std::make_unique<Necrosis::VertexArray>();
+    _patchVao->bind();
+    _patchIbo = std::make_unique<Necrosis::IndexBuffer>(nullptr, 0);
+
+    const u32 patchWidth = CHUNK_SIZE + 1;
+    std::vector<u32> patchIndices;
+    patchIndices.reserve(CHUNK_SIZE * CHUNK_SIZE * 6);
+    for (u32 z = 0; z < CHUNK_SIZE; z++) {
+        for (u32 x = 0; x < CHUNK_SIZE; x++) {
+            // same triangles as the mesh
+            patchIndices.insert(patchIndices.end(), {
+                z * patchWidth + x, (z + 1) * patchWidth + x + 1, (z + 1) * patchWidth + x,
+                z * patchWidth + x + 1, (z + 1) * patchWidth + x + 1, z * patchWidth + x
+            });
+        }
+    }
+    _patchIbo->setData(patchIndices.data(), static_cast<u32>(patchIndices.size()));
+
+    // per instance attributes giving the cells covered by the patch
+    glGenBuffers(1, &_patchInstanceBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, _patchInstanceBuffer);
+    glEnableVertexAttribArray(4);
+    glVertexAttribIPointer(4, 3, GL_UNSIGNED_INT, sizeof(PatchInstance), reinterpret_cast<const void*>(offsetof(PatchInstance, x)));
+    glVertexAttribDivisor(4, 1);
+    glEnableVertexAttribArray(5);
+    glVertexAttribPointer(5, 2, GL_FLOAT, GL_FALSE, sizeof(PatchInstance), reinterpret_cast<const void*>(offsetof(PatchInstance, morphStart)));
+    glVertexAttribDivisor(5, 1);
+    _patchVao->unbind();
 }
 
 TerrainRenderer::~TerrainRenderer() {
+    if (_heightTexture) {
+        glDeleteTextures(1, &_heightTexture);
+    }
+    glDeleteBuffers(1, &_patchInstanceBuffer);
 }
 
 
 
 void TerrainRenderer::render() const {
-    _vao->bind();
-    // _vbo->bind();
-    // _ibo->bind();
+    // the planes of a null matrix are null too and reject nothing
+    render(glm::mat4(0.f));
+}
+
+/**
+ * @brief Whether the box is at least partly on the positive side of the 6 planes of the frustum
+ */
+bool isBoxInFrustum(const std::array<glm::vec4, 6> &planes, glm::vec3 min, glm::vec3 max) {
+    for (const auto &plane : planes) {
+        // corner of the box the furthest along the normal of the plane
+        const glm::vec3 corner(
+            plane.x > 0.f ? max.x : min.x,
+            plane.y > 0.f ? max.y : min.y,
+            plane.z > 0.f ? max.z : min.z
+        );
+        if (plane.x * corner.x + plane.y * corner.y + plane.z * corner.z + plane.w < 0.f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Distance from `point` to the box transformed by `transform`, 0 if it is inside
+ */
+f32 getBoxDistance(const glm::mat4 &transform, glm::vec3 min, glm::vec3 max, glm::vec3 point) {
+    // bounding box of the transformed box, from its center and half extent
+    const glm::vec3 center = glm::vec3(transform * glm::vec4((min + max) * 0.5f, 1.f));
+    const glm::vec3 extent = (max - min) * 0.5f;
+    glm::vec3 transformedExtent(0.f);
+    for (int axis = 0; axis < 3; axis++) {
+        transformedExtent += glm::abs(glm::vec3(transform[axis])) * extent[axis];
+    }
+
+    return glm::length(glm::max(glm::abs(point - center) - transformedExtent, glm::vec3(0.f)));
+}
+
+std::pair<glm::vec3, glm::vec3> TerrainRenderer::_getBoundingBox(u32 x, u32 z, u32 size, glm::vec2 heightRange) const {
+    // same transformation as the vertices
+    auto toModelX = [&](u32 x) { return ((f32)x / (f32)_width * 2.f - 1.f) * _mapScale; };
+    auto toModelZ = [&](u32 z) { return ((f32)z / (f32)_depth * 2.f - 1.f) * _mapScale; };
+
+    const glm::vec3 min(toModelX(x), heightRange.x, toModelZ(z));
+    const glm::vec3 max(toModelX(std::min(x + size, _width - 1)), heightRange.y, toModelZ(std::min(z + size, _depth - 1)));
+    // the ranges of the scale can be reversed
+    return { glm::min(min, max), glm::max(min, max) };
+}
+
+TerrainRenderer::CullingStats TerrainRenderer::render(const glm::mat4 &clipFromModel) const {
+    if (_chunks.empty()) { return {}; }
+
+    // planes of the frustum in model space (Gribb & Hartmann), as (normal, distance).
+    // The rows of the matrix are its columns in glm
+    const glm::mat4 rows = glm::transpose(clipFromModel);
+    const std::array<glm::vec4, 6> planes = {
+        rows[3] + rows[0], rows[3] - rows[0],
+        rows[3] + rows[1], rows[3] - rows[1],
+        rows[3] + rows[2], rows[3] - rows[2]
+    };
+
+    CullingStats stats;
+    _visibleChunks.clear();
+    _patchInstances.clear();
+
+    if (_renderMode == RenderMode::Quadtree) {
+        const f32 cellSize = glm::length(glm::vec3(_lodCamera.worldFromModel[0])) * 2.f * _mapScale / static_cast<f32>(_width);
+        // a coarse patch must not touch a patch 2 levels finer, or the morphing can't close the gap.
+        // It can't when the range of the first level is a few times the size of a chunk
+        f32 maxChunkHeight = 0.f;
+        for (const glm::vec2 &range : _lodLevels.front().heightRanges) {
+            maxChunkHeight = std::max(maxChunkHeight, range.y - range.x);
+        }
+        const auto [chunkMin, chunkMax] = _getBoundingBox(0, 0, CHUNK_SIZE, { 0.f, maxChunkHeight });
+        const f32 minRange = 3.f * glm::length(glm::vec3(_lodCamera.worldFromModel * glm::vec4(chunkMax - chunkMin, 0.f)));
+
+        // the triangles of a level are 2x larger than the ones of the previous one, so they keep
+        // the same size on the screen over a range 2x longer
+        std::vector<f32> ranges(_lodLevels.size());
+        for (u32 level = 0; level < ranges.size(); level++) {
+            const f32 spacing = cellSize * static_cast<f32>(1u << level);
+            ranges[level] = std::max(spacing * _lodCamera.pixelsPerUnit / _lodTriangleSize, minRange * static_cast<f32>(1u << level));
+        }
+
+        const LodLevel &root = _lodLevels.back();
+        for (u32 z = 0; z < root.nodesZ; z++) {
+            for (u32 x = 0; x < root.nodesX; x++) {
+                _selectLodNodes(static_cast<u32>(_lodLevels.size()) - 1, x, z, planes, ranges, stats);
+            }
+        }
+    }
+    else {
+        const u32 chunksX = _getChunksX();
+        for (u32 i = 0; i < _chunks.size(); i++) {
+            const auto [min, max] = _getBoundingBox(
+                (i % chunksX) * CHUNK_SIZE, (i / chunksX) * CHUNK_SIZE, CHUNK_SIZE,
+                { _chunks[i].minHeight, _chunks[i].maxHeight }
+            );
+            if (!isBoxInFrustum(planes, min, max)) {
+                stats.culled++;
+                continue;
+            }
+
+            stats.drawn++;
+            _visibleChunks.push_back(i);
+            if (_renderMode == RenderMode::Heightfield) {
+                // full detail everywhere, the vertices never morph
+                _patchInstances.push_back({
+                    (i % chunksX) * CHUNK_SIZE, (i / chunksX) * CHUNK_SIZE, 0,
+                    std::numeric_limits<f32>::max(), std::numeric_limits<f32>::max()
+                });
+                stats.triangles += CHUNK_SIZE * CHUNK_SIZE * 2;
+            }
+            else {
+                stats.triangles += _chunks[i].indexCount / 3;
+            }
+        }
+    }
+
+    if (stats.drawn == 0) { return stats; }
+
+    if (_isHeightfieldMode()) {
+        if (!_heightTexture) { return stats; }
+
+        glActiveTexture(GL_TEXTURE0 + HEIGHTMAP_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, _heightTexture);
 
-    // glDrawArrays(GL_POINTS, 0, _vbo->count());
-    glDrawElements(GL_TRIANGLES, _ibo->getCount(), GL_UNSIGNED_INT, 0);
+        // orphan the buffer, it can still be used by the previous pass
+        glBindBuffer(GL_ARRAY_BUFFER, _patchInstanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, _patchInstances.size() * sizeof(PatchInstance), _patchInstances.data(), GL_STREAM_DRAW);
+
+        _patchVao->bind();
+        glDrawElementsInstanced(GL_TRIANGLES, _patchIbo->getCount(), GL_UNSIGNED_INT, 0, static_cast<i32>(_patchInstances.size()));
+        _patchVao->unbind();
+        return stats;
+    }
+
+    // the chunks are contiguous in the index buffer, so consecutive visible chunks are drawn as one range
+    _drawCounts.clear();
+    _drawOffsets.clear();
+    for (size_t i = 0; i < _visibleChunks.size(); i++) {
+        const Chunk &chunk = _chunks[_visibleChunks[i]];
+        if (i > 0 && _visibleChunks[i - 1] + 1 == _visibleChunks[i]) {
+            _drawCounts.back() += static_cast<i32>(chunk.indexCount);
+        }
+        else {
+            _drawCounts.push_back(static_cast<i32>(chunk.indexCount));
+            _drawOffsets.push_back(reinterpret_cast<const void*>(static_cast<uintptr_t>(chunk.firstIndex) * sizeof(u32)));
+        }
+    }
+
+    _vao->bind();
+    glMultiDrawElements(GL_TRIANGLES, _drawCounts.data(), GL_UNSIGNED_INT, _drawOffsets.data(), static_cast<i32>(_drawCounts.size()));
     _vao->unbind();
 
      // glLineWidth(2.f);
      // _normalVao->bind();
      // glDrawArrays(GL_LINES, 0, _normalVbo->count());
      // glLineWidth(1.f);
+    return stats;
+}
+
+void TerrainRenderer::_selectLodNodes(
+    u32 level, u32 nodeX, u32 nodeZ, const std::array<glm::vec4, 6> &planes,
+    const std::vector<f32> &ranges, CullingStats &stats
+) const {
+    const LodLevel &lodLevel = _lodLevels[level];
+    const u32 nodeSize = CHUNK_SIZE << level;
+    const auto [min, max] = _getBoundingBox(
+        nodeX * nodeSize, nodeZ * nodeSize, nodeSize, lodLevel.heightRanges[nodeZ * lodLevel.nodesX + nodeX]
+    );
+    if (!isBoxInFrustum(planes, min, max)) {
+        stats.culled++;
+        return;
+    }
+
+    // the node is drawn with this level when no part of it is close enough for the previous one
+    if (level == 0 || getBoxDistance(_lodCamera.worldFromModel, min, max, _lodCamera.position) > ranges[level - 1]) {
+        const f32 previousRange = level > 0 ? ranges[level - 1] : 0.f;
+        // the last level has no coarser level to morph into
+        const bool isLastLevel = level + 1 == _lodLevels.size();
+        _patchInstances.push_back({
+            nodeX * nodeSize, nodeZ * nodeSize, level,
+            isLastLevel ? std::numeric_limits<f32>::max() : previousRange + (ranges[level] - previousRange) * LOD_MORPH_START,
+            isLastLevel ? std::numeric_limits<f32>::max() : ranges[level]
+        });
+        stats.drawn++;
+        stats.triangles += CHUNK_SIZE * CHUNK_SIZE * 2;
+        return;
+    }
+
+    const LodLevel &children = _lodLevels[level - 1];
+    for (u32 z = nodeZ * 2; z < std::min(nodeZ * 2 + 2, children.nodesZ); z++) {
+        for (u32 x = nodeX * 2; x < std::min(nodeX * 2 + 2, children.nodesX); x++) {
+            _selectLodNodes(level - 1, x, z, planes, ranges, stats);
+        }
+    }
 }
 
+// The normal of a vertex is the sum of the cross products of the vectors going to its
+// 6 neighbours R (x+1, z), UR (x+1, z+1), U (x, z-1), L (x-1, z), DL (x-1, z-1), D (x, z+1),
+// taken in this order. Expanding the cross products gives
+// (hDL + hD - hUR - hU, 2, hUR - hR + 2hU + hL - hDL - 2hD), which doesn't depend on the
+// height of the vertex itself. On the borders the missing heights are clamped to the edge.
+
 [[nodiscard]]
-glm::vec3 generateNormal(u32 x, u32 z, const std::vector<f32> &heights, u32 width, u32 depth) {
+glm::vec3 generateNormal(u32 x, u32 z, std::span<const f32> heights, u32 width, u32 depth) {
     expect((x < width) && (z < depth), "Invalid coordinate for normal generation");
     auto getHeight = [&](i32 x, i32 z) {
         x = std::clamp(x, 0, static_cast<i32>(width) - 1);
@@ -68,29 +299,20 @@ glm::vec3 generateNormal(u32 x, u32 z, const std::vector<f32> &heights, u32 widt
         return heights[z * width + x];
     };
 
-    std::array<glm::vec3, 6> neighbours = {
-        glm::vec3(static_cast<i32>(x) + 1, getHeight(static_cast<i32>(x) + 1, static_cast<i32>(z)), static_cast<i32>(z)), // R
-        glm::vec3(static_cast<i32>(x) + 1, getHeight(static_cast<i32>(x) + 1, static_cast<i32>(z) + 1), static_cast<i32>(z) + 1), // UR
-        glm::vec3(static_cast<i32>(x), getHeight(static_cast<i32>(x), static_cast<i32>(z) - 1),  static_cast<i32>(z) - 1), // U
-        glm::vec3(static_cast<i32>(x) - 1, getHeight(static_cast<i32>(x) - 1, static_cast<i32>(z)), static_cast<i32>(z)), // L
-        glm::vec3(static_cast<i32>(x) - 1, getHeight(static_cast<i32>(x) - 1, static_cast<i32>(z) - 1), static_cast<i32>(z) - 1), // DL
-        glm::vec3(static_cast<i32>(x), getHeight(static_cast<i32>(x), static_cast<i32>(z) + 1), static_cast<i32>(z) + 1) // D
-    };
-
-    glm::vec3 current(x, heights[z * width + x], z);
-    glm::vec3 normal(0.f);
-
-    for (int i = 0; i < 6; i++) {
-        glm::vec3 v1 = neighbours[i] - current;
-        glm::vec3 v2 = neighbours[(i + 1) % 6] - current;
-        normal += glm::cross(v1, v2);
-    }
+    const i32 ix = static_cast<i32>(x);
+    const i32 iz = static_cast<i32>(z);
+    const float hR = getHeight(ix + 1, iz);
+    const float hUR = getHeight(ix + 1, iz + 1);
+    const float hU = getHeight(ix, iz - 1);
+    const float hL = getHeight(ix - 1, iz);
+    const float hDL = getHeight(ix - 1, iz - 1);
+    const float hD = getHeight(ix, iz + 1);
 
-    return glm::normalize(normal);
+    return glm::normalize(glm::vec3(hDL + hD - hUR - hU, 2.f, hUR - hR + 2.f * hU + hL - hDL - 2.f * hD));
 }
 
 [[nodiscard]]
-glm::vec3 generateNormalFast(u32 x, u32 z, const std::vector<f32> &heights, u32 width, u32 depth) {
+glm::vec3 generateNormalFast(u32 x, u32 z, std::span<const f32> heights, u32 width, u32 depth) {
     expect((x < width) && (z < depth), "Invalid coordinate for normal generation");
     auto getHeight = [&](i32 x, i32 z) {
         x = std::clamp(x, 0, static_cast<i32>(width) - 1);
@@ -106,90 +328,389 @@ glm::vec3 generateNormalFast(u32 x, u32 z, const std::vector<f32> &heights, u32
     return glm::normalize(glm::vec3(hL - hR, 2.f, hU - hD));
 }
 
-void TerrainRenderer::updateBuffers(const std::vector<float> &heights, const u32 width, const u32 depth, const float textureScale, const float mapScale) const {
+/**
+ * @brief Normals of the cells [beginX, endX) of the inner row z, without the first and last columns.
+ * The components are written in separate arrays indexed by x
+ */
+void generateInnerRowNormals(
+    const f32 *heights, u32 width, u32 z, u32 beginX, u32 endX, TerrainRenderer::NormalMode mode,
+    f32 *__restrict normalX, f32 *__restrict normalY, f32 *__restrict normalZ
+) {
+    const f32 *__restrict up = heights + (z - 1) * width;
+    const f32 *__restrict row = heights + z * width;
+    const f32 *__restrict down = heights + (z + 1) * width;
+
+    if (mode == TerrainRenderer::NormalMode::SixNeighbours) {
+        for (u32 x = beginX; x < endX; x++) {
+            const f32 nx = up[x - 1] + down[x] - down[x + 1] - up[x];
+            const f32 nz = down[x + 1] - row[x + 1] + 2.f * up[x] + row[x - 1] - up[x - 1] - 2.f * down[x];
+            const f32 inverseLength = 1.f / std::sqrt(nx * nx + 4.f + nz * nz);
+            normalX[x] = nx * inverseLength;
+            normalY[x] = 2.f * inverseLength;
+            normalZ[x] = nz * inverseLength;
+        }
+    }
+    else {
+        for (u32 x = beginX; x < endX; x++) {
+            const f32 nx = row[x - 1] - row[x + 1];
+            const f32 nz = up[x] - down[x];
+            const f32 inverseLength = 1.f / std::sqrt(nx * nx + 4.f + nz * nz);
+            normalX[x] = nx * inverseLength;
+            normalY[x] = 2.f * inverseLength;
+            normalZ[x] = nz * inverseLength;
+        }
+    }
+}
+
+void TerrainRenderer::setShaderUniforms(Necrosis::Shader &shader) const {
+    shader.setUniform("u_isHeightfield", _isHeightfieldMode());
+    shader.setUniform("u_heightmap", static_cast<int>(HEIGHTMAP_TEXTURE_UNIT));
+    shader.setUniform("u_mapWidth", static_cast<int>(_width));
+    shader.setUniform("u_mapDepth", static_cast<int>(_depth));
+    shader.setUniform("u_patchSize", static_cast<int>(CHUNK_SIZE));
+    shader.setUniform("u_mapScale", _mapScale);
+    shader.setUniform("u_textureScale", _textureScale);
+    shader.setUniform("u_normalMode", static_cast<int>(_normalMode));
+    shader.setUniform("u_lodCameraPosition", _lodCamera.position);
+}
+
+size_t TerrainRenderer::getGpuMemoryUsage() const {
+    if (_isHeightfieldMode()) {
+        return static_cast<size_t>(_width) * _depth * sizeof(f32) + _patchIbo->getCount() * sizeof(u32);
+    }
+    return _vertices.size() * sizeof(Necrosis::Vertex) + _ibo->getCount() * sizeof(u32);
+}
+
+void TerrainRenderer::updateBuffers(std::span<const f32> heights, const u32 width, const u32 depth, const float textureScale, const float mapScale) {
     if (width == 0 || depth == 0) { return; }
 
+    const bool dimensionsChanged = width != _width || depth != _depth;
+    _width = width;
+    _depth = depth;
+    _textureScale = textureScale;
+    _mapScale = mapScale;
+
+    _chunks.resize(_getChunksX() * _getChunksZ());
+    _updateChunkBounds(heights, { 0, 0, width, depth });
+    _updateLodLevels();
+
+    if (_isHeightfieldMode()) {
+        _updateHeightTexture(heights, dimensionsChanged);
+        return;
+    }
+
     // create the buffers that will be uploaded to the GPU
-    std::vector<Necrosis::Vertex> vertices;
-    std::vector<u32> indices;
+    _vertices.resize(width * depth);
+    _generateVertices(heights, 0, width, 0, depth);
 
-    vertices.resize(width * depth);
-    u32 numQuads = (width - 1) * (depth - 1);
-    indices.resize(numQuads * 6);
-
-    // std::vector<Necrosis::Vertex> normalLines;
-
-    // generate vertex data
-    size_t index = 0;
-    for (u32 z = 0; z < depth; z++) {
-        for (u32 x = 0; x < width; x++) {
-            float y = heights[z * width + x];
-
-            auto pos = glm::vec3((f32)x / (f32)width, y, (f32)z / (f32)depth);
-            pos = glm::vec3(pos.x * 2.f - 1.f, pos.y, pos.z * 2.f - 1.f);
-            pos *= glm::vec3((f32)mapScale, 1.f, (f32)mapScale);
-            auto normal = generateNormal(x, z, heights, width, depth);
-
-            vertices[index] = Necrosis::Vertex(
-                pos,
-                // {
-                //     (static_cast<f32>(x) - static_cast<f32>(width) / 2.f),
-                //     y,
-                //     (static_cast<f32>(z) - static_cast<f32>(depth) / 2.f)
-                // },
-                normal,
-                {
-                    textureScale * static_cast<f32>(x)/static_cast<f32>(width),
-                    textureScale * static_cast<f32>(z)/static_cast<f32>(depth)
-                },
-                {
-                    1.f,
-                    x >= width - 1 ? 0.f : heights[z * width + x + 1],
-                    0.f
+    // send data to the GPU
+    _vao->bind();
+    _vbo->setData(_vertices.data(), _vertices.size() * sizeof(Necrosis::Vertex));
+    if (dimensionsChanged || _ibo->getCount() == 0) {
+        _generateIndices();
+    }
+    _vao->unbind();
+}
+
+void TerrainRenderer::setRenderMode(RenderMode mode) {
+    if (mode == _renderMode) { return; }
+    _renderMode = mode;
+
+    // free the memory of the other mode
+    if (_isHeightfieldMode()) {
+        _vertices = {};
+        _vao->bind();
+        _vbo->setData(nullptr, 0);
+        _ibo->setData(nullptr, 0);
+        _vao->unbind();
+    }
+    else if (_heightTexture) {
+        glDeleteTextures(1, &_heightTexture);
+        _heightTexture = 0;
+    }
+}
+
+void TerrainRenderer::updateRegion(std::span<const f32> heights, const u32 width, const u32 depth, const float textureScale, const float mapScale, const HeightmapRegion &region) {
+    if (width != _width || depth != _depth) {
+        updateBuffers(heights, width, depth, textureScale, mapScale);
+        return;
+    }
+
+    _updateChunkBounds(heights, region);
+    _updateLodLevels();
+
+    if (_isHeightfieldMode()) {
+        // the scales are uniforms, so only the changed texels are uploaded
+        _textureScale = textureScale;
+        _mapScale = mapScale;
+        if (region.isEmpty()) { return; }
+
+        glBindTexture(GL_TEXTURE_2D, _heightTexture);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, static_cast<i32>(width));
+        glTexSubImage2D(
+            GL_TEXTURE_2D, 0, region.x, region.z, region.width, region.depth, GL_RED, GL_FLOAT,
+            heights.data() + region.z * width + region.x
+        );
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return;
+    }
+
+    if (textureScale != _textureScale || mapScale != _mapScale) {
+        updateBuffers(heights, width, depth, textureScale, mapScale);
+        return;
+    }
+    if (region.isEmpty()) { return; }
+
+    // the normals use the heights around the vertex and the tangent the height
+    // on its right, so the vertices around the region are affected too
+    const u32 beginX = region.x > 0 ? region.x - 1 : 0;
+    const u32 endX = std::min(width, region.getEndX() + 1);
+    const u32 beginZ = region.z > 0 ? region.z - 1 : 0;
+    const u32 endZ = std::min(depth, region.getEndZ() + 1);
+
+    _generateVertices(heights, beginX, endX, beginZ, endZ);
+
+    // the rows are contiguous in the buffer, so they are uploaded in one call
+    _vbo->updateData(
+        _vertices.data() + beginZ * width,
+        beginZ * width * sizeof(Necrosis::Vertex),
+        (endZ - beginZ) * width * sizeof(Necrosis::Vertex)
+    );
+    _vbo->unbind();
+}
+
+void TerrainRenderer::_generateVertices(std::span<const f32> heights, u32 beginX, u32 endX, u32 beginZ, u32 endZ) {
+    const u32 width = _width;
+    const u32 depth = _depth;
+    const f32 textureScale = _textureScale;
+    const f32 mapScale = _mapScale;
+    const NormalMode mode = _normalMode;
+
+    // enough rows per block to amortize the scheduling, and several blocks per thread to balance the load
+    const u32 ROWS_PER_BLOCK = 16;
+    const u32 numBlocks = (endZ - beginZ + ROWS_PER_BLOCK - 1) / ROWS_PER_BLOCK;
+
+    _taskScheduler.parallelFor(numBlocks, [&](u32 block) {
+        std::vector<f32> normalX(width);
+        std::vector<f32> normalY(width);
+        std::vector<f32> normalZ(width);
+
+        auto setBorderNormal = [&](u32 x, u32 z) {
+            const auto normal = mode == NormalMode::SixNeighbours
+                ? generateNormal(x, z, heights, width, depth)
+                : generateNormalFast(x, z, heights, width, depth);
+            normalX[x] = normal.x;
+            normalY[x] = normal.y;
+            normalZ[x] = normal.z;
+        };
+
+        const u32 blockEnd = std::min(endZ, beginZ + (block + 1) * ROWS_PER_BLOCK);
+        for (u32 z = beginZ + block * ROWS_PER_BLOCK; z < blockEnd; z++) {
+            // normals
+            if (z == 0 || z == depth - 1 || width < 3) {
+                for (u32 x = beginX; x < endX; x++) {
+                    setBorderNormal(x, z);
                 }
-            );
+            }
+            else {
+                const u32 innerBegin = std::max(beginX, 1u);
+                const u32 innerEnd = std::min(endX, width - 1);
+                if (innerBegin < innerEnd) {
+                    generateInnerRowNormals(
+                        heights.data(), width, z, innerBegin, innerEnd, mode,
+                        normalX.data(), normalY.data(), normalZ.data()
+                    );
+                }
+                if (beginX == 0) {
+                    setBorderNormal(0, z);
+                }
+                if (endX == width) {
+                    setBorderNormal(width - 1, z);
+                }
+            }
+
+            // vertices
+            const f32 posZ = ((f32)z / (f32)depth * 2.f - 1.f) * mapScale;
+            const f32 texCoordZ = textureScale * static_cast<f32>(z) / static_cast<f32>(depth);
+            const f32 *row = heights.data() + z * width;
+            Necrosis::Vertex *vertices = _vertices.data() + z * width;
+
+            for (u32 x = beginX; x < endX; x++) {
+                vertices[x] = Necrosis::Vertex(
+                    glm::vec3(((f32)x / (f32)width * 2.f - 1.f) * mapScale, row[x], posZ),
+                    glm::vec3(normalX[x], normalY[x], normalZ[x]),
+                    { textureScale * static_cast<f32>(x) / static_cast<f32>(width), texCoordZ },
+                    { 1.f, x >= width - 1 ? 0.f : row[x + 1], 0.f }
+                );
+            }
+        }
+    });
+}
+
+void TerrainRenderer::runBenchmark(std::span<const f32> heights) {
+    if (_vertices.empty() || heights.size() != _vertices.size()) {
+        slog::warning("The meshing benchmark needs a mesh with the dimensions of the heightmap");
+        return;
+    }
 
-            // normalLines.emplace_back(Necrosis::Vertex(vertices[index].position, {}, {}));
-            // normalLines.emplace_back(Necrosis::Vertex(vertices[index].position + normal, {}, {}));
+    const NormalMode savedMode = _normalMode;
+    auto measure = [&](NormalMode mode) {
+        const u32 ITERATIONS = 5;
+        _normalMode = mode;
 
-            index++;
+        const auto start = std::chrono::steady_clock::now();
+        for (u32 i = 0; i < ITERATIONS; i++) {
+            _generateVertices(heights, 0, _width, 0, _depth);
         }
+        const std::chrono::duration<f32> elapsed = std::chrono::steady_clock::now() - start;
+
+        return static_cast<f32>(ITERATIONS) * static_cast<f32>(_vertices.size()) / std::max(elapsed.count(), 1e-6f);
+    };
+
+    _benchmark.sixNeighbours = measure(NormalMode::SixNeighbours);
+    _benchmark.centralDifference = measure(NormalMode::CentralDifference);
+    _benchmark.threadCount = _taskScheduler.getThreadCount();
+
+    // put back the vertices that are on the gpu
+    _normalMode = savedMode;
+    _generateVertices(heights, 0, _width, 0, _depth);
+
+    slog::info(
+        "Meshing benchmark on {}x{}: 6 neighbours {:.1f}M vertices/s, central difference {:.1f}M vertices/s ({} threads)",
+        _width, _depth, _benchmark.sixNeighbours * 1e-6f, _benchmark.centralDifference * 1e-6f, _benchmark.threadCount
+    );
+}
+
+void TerrainRenderer::_updateHeightTexture(std::span<const f32> heights, bool dimensionsChanged) {
+    // immutable storage, recreated when the size changes
+    if (dimensionsChanged && _heightTexture) {
+        glDeleteTextures(1, &_heightTexture);
+        _heightTexture = 0;
+    }
+    if (!_heightTexture) {
+        glGenTextures(1, &_heightTexture);
+        glBindTexture(GL_TEXTURE_2D, _heightTexture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, _width, _depth);
+        // only read with texelFetch, but the texture must be complete without mipmaps
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    else {
+        glBindTexture(GL_TEXTURE_2D, _heightTexture);
     }
-    assert(index == vertices.size() && "error when populating the vertices buffer for the terrain");
 
-    // generate index data
-    index = 0;
-    for (u32 z = 0; z < depth - 1; z++) {
-        for (u32 x = 0; x < width - 1; x++) {
-            // here we are at the base of a quad and the following
-            // are the indices of the quad vertices
-            u32 bottomLeft = z * width + x;
-            u32 bottomRight = z * width + x + 1;
-            u32 topLeft = (z + 1) * width + x;
-            u32 topRight = (z + 1) * width + x + 1;
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _width, _depth, GL_RED, GL_FLOAT, heights.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
 
-            // top left triangle
-            indices[index++] = bottomLeft;
-            indices[index++] = topRight;
-            indices[index++] = topLeft;
+void TerrainRenderer::_updateChunkBounds(std::span<const f32> heights, const HeightmapRegion &region) {
+    if (region.isEmpty()) { return; }
+
+    const u32 chunksX = _getChunksX();
+    // a chunk covers the vertices [x, x + CHUNK_SIZE], so the vertices
+    // on its edges are shared with the next chunk
+    auto firstChunk = [](u32 cell) { return cell > 0 ? (cell - 1) / CHUNK_SIZE : 0; };
+    const u32 beginChunkX = firstChunk(region.x);
+    const u32 endChunkX = std::min(chunksX, (region.getEndX() - 1) / CHUNK_SIZE + 1);
+    const u32 beginChunkZ = firstChunk(region.z);
+    const u32 endChunkZ = std::min(_getChunksZ(), (region.getEndZ() - 1) / CHUNK_SIZE + 1);
+
+    for (u32 cz = beginChunkZ; cz < endChunkZ; cz++) {
+        for (u32 cx = beginChunkX; cx < endChunkX; cx++) {
+            f32 minHeight = std::numeric_limits<f32>::max();
+            f32 maxHeight = std::numeric_limits<f32>::lowest();
+
+            const u32 endX = std::min(_width, (cx + 1) * CHUNK_SIZE + 1);
+            const u32 endZ = std::min(_depth, (cz + 1) * CHUNK_SIZE + 1);
+            for (u32 z = cz * CHUNK_SIZE; z < endZ; z++) {
+                for (u32 x = cx * CHUNK_SIZE; x < endX; x++) {
+                    minHeight = std::min(minHeight, heights[z * _width + x]);
+                    maxHeight = std::max(maxHeight, heights[z * _width + x]);
+                }
+            }
 
-            // bottom right triangle
-            indices[index++] = bottomRight;
-            indices[index++] = topRight;
-            indices[index++] = bottomLeft;
+            _chunks[cz * chunksX + cx].minHeight = minHeight;
+            _chunks[cz * chunksX + cx].maxHeight = maxHeight;
         }
     }
-    assert(index == indices.size() && "error when populating the indices buffer for the terrain");
+}
 
-    // send data to the GPU
-    _vao->bind();
-    _vbo->setData(vertices.data(), vertices.size() * sizeof(Necrosis::Vertex));
-    _ibo->setData(indices.data(), indices.size());
-    _vao->unbind();
+void TerrainRenderer::_updateLodLevels() {
+    const u32 chunksX = _getChunksX();
+    const u32 chunksZ = _getChunksZ();
+    const u32 levelCount = static_cast<u32>(std::ceil(std::log2(static_cast<f32>(std::max(chunksX, chunksZ))))) + 1;
+    _lodLevels.resize(levelCount);
+
+    _lodLevels[0].nodesX = chunksX;
+    _lodLevels[0].nodesZ = chunksZ;
+    _lodLevels[0].heightRanges.resize(_chunks.size());
+    for (size_t i = 0; i < _chunks.size(); i++) {
+        _lodLevels[0].heightRanges[i] = { _chunks[i].minHeight, _chunks[i].maxHeight };
+    }
 
-    // _normalVao->bind();
-    // _normalVbo->setData(normalLines.data(), normalLines.size() * sizeof(Necrosis::Vertex));
-    // _normalVao->unbind();
+    for (u32 level = 1; level < levelCount; level++) {
+        const LodLevel &children = _lodLevels[level - 1];
+        LodLevel &lodLevel = _lodLevels[level];
+        lodLevel.nodesX = (children.nodesX + 1) / 2;
+        lodLevel.nodesZ = (children.nodesZ + 1) / 2;
+        lodLevel.heightRanges.assign(
+            lodLevel.nodesX * lodLevel.nodesZ,
+            { std::numeric_limits<f32>::max(), std::numeric_limits<f32>::lowest() }
+        );
+
+        for (u32 z = 0; z < children.nodesZ; z++) {
+            for (u32 x = 0; x < children.nodesX; x++) {
+                const glm::vec2 &child = children.heightRanges[z * children.nodesX + x];
+                glm::vec2 &range = lodLevel.heightRanges[(z / 2) * lodLevel.nodesX + x / 2];
+                range = { std::min(range.x, child.x), std::max(range.y, child.y) };
+            }
+        }
+    }
+}
+
+void TerrainRenderer::_generateIndices() {
+    const u32 width = _width;
+    const u32 depth = _depth;
+
+    std::vector<u32> indices;
+    u32 numQuads = (width - 1) * (depth - 1);
+    indices.reserve(numQuads * 6);
+
+    // generate index data, chunk after chunk so each one is a contiguous range
+    const u32 chunksX = _getChunksX();
+    for (u32 chunk = 0; chunk < _chunks.size(); chunk++) {
+        const u32 beginX = (chunk % chunksX) * CHUNK_SIZE;
+        const u32 beginZ = (chunk / chunksX) * CHUNK_SIZE;
+        const u32 endX = std::min(width - 1, beginX + CHUNK_SIZE);
+        const u32 endZ = std::min(depth - 1, beginZ + CHUNK_SIZE);
+
+        _chunks[chunk].firstIndex = static_cast<u32>(indices.size());
+        for (u32 z = beginZ; z < endZ; z++) {
+            for (u32 x = beginX; x < endX; x++) {
+                // here we are at the base of a quad and the following
+                // are the indices of the quad vertices
+                u32 bottomLeft = z * width + x;
+                u32 bottomRight = z * width + x + 1;
+                u32 topLeft = (z + 1) * width + x;
+                u32 topRight = (z + 1) * width + x + 1;
+
+                // top left triangle
+                indices.push_back(bottomLeft);
+                indices.push_back(topRight);
+                indices.push_back(topLeft);
+
+                // bottom right triangle
+                indices.push_back(bottomRight);
+                indices.push_back(topRight);
+                indices.push_back(bottomLeft);
+            }
+        }
+        _chunks[chunk].indexCount = static_cast<u32>(indices.size()) - _chunks[chunk].firstIndex;
+    }
+    assert(indices.size() == numQuads * 6 && "error when populating the indices buffer for the terrain");
+
+    _ibo->setData(indices.data(), indices.size());
 }
 
 }
@@ -1,27 +1,244 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <memory>
+#include <span>
+#include <utility>
+#include <vector>
 
 #include <Common.h>
 #include <Necrosis/renderer/Renderer.h>
 #include <Necrosis/renderer/Buffer.h>
+#include <Necrosis/renderer/Shader.h>
+#include <Necrosis/scene/Mesh.h>
+#include <Necrosis/tasks/TaskScheduler.h>
+
+#include "HeightmapRegion.h"
 
 namespace Geophagia {
 class TerrainRenderer : public Necrosis::Renderable {
 public:
-    TerrainRenderer();
+    /**
+     * @brief How the vertex normals are computed from the heightmap
+     */
+    enum class NormalMode : int {
+        SixNeighbours,    ///< @brief Sum of the normals of the 6 triangles around the vertex
+        CentralDifference ///< @brief Gradient from the 4 direct neighbours. Cheaper and smoother
+    };
+    /**
+     * @brief How the terrain is sent to the gpu
+     */
+    enum class RenderMode : int {
+        Mesh,       ///< @brief Full vertex and index buffers built on the cpu
+        Heightfield, ///< @brief Heights in a R32F texture, the vertices are built by the shader from a shared grid patch
+        Quadtree     ///< @brief Heightfield drawn with patches from a quadtree, coarser far from the camera (CDLOD)
+    };
+    /**
+     * @brief Vertices generated per second by the meshing of the last benchmark
+     */
+    struct MeshingBenchmark {
+        f32 sixNeighbours = 0.f;
+        f32 centralDifference = 0.f;
+        u32 threadCount = 0;
+    };
+    /**
+     * @brief Chunks kept and rejected by the frustum culling of a render
+     */
+    struct CullingStats {
+        u32 drawn = 0;
+        u32 culled = 0;
+        u32 triangles = 0; ///< @brief Triangles of the drawn chunks
+    };
+    /**
+     * @brief Point of view the detail levels of the quadtree mode are chosen from
+     */
+    struct LodCamera {
+        glm::mat4 worldFromModel = glm::mat4(1.f);
+        glm::vec3 position = glm::vec3(0.f); ///< @brief In world space
+        f32 pixelsPerUnit = 0.f; ///< @brief Size in pixels of 1 unit seen from a distance of 1, viewport height / (2 tan(fov / 2))
+    };
+
+    /**
+     * @param taskScheduler Builds the vertices of the mesh in parallel
+     */
+    explicit TerrainRenderer(Necrosis::TaskScheduler &taskScheduler);
     // TerrainRenderer();
     ~TerrainRenderer();
 
-    void render() const override;
+    void render() const override; ///< @brief Renders all the chunks
+    /**
+     * @brief Renders the chunks whose bounding box intersects the frustum of `clipFromModel`.
+     * In quadtree mode, the chunks are the nodes of the quadtree selected for the LOD camera
+     * @param clipFromModel projection * view * model matrix of the pass
+     */
+    CullingStats render(const glm::mat4 &clipFromModel) const;
+
+    /**
+     * @brief Regenerates the whole mesh. The index buffer is only rebuilt
+     * when the dimensions of the heightmap changed
+     */
+    void updateBuffers(std::span<const f32> heights, const u32 width, const u32 depth, const float textureScale, const float mapScale);
+    /**
+     * @brief Regenerates the vertices whose position, normal or tangent depend on
+     * the heights of `region` and uploads the rows containing them
+     *
+     * Falls back to `updateBuffers` when the dimensions or the scales changed since the last update.
+     */
+    void updateRegion(std::span<const f32> heights, const u32 width, const u32 depth, const float textureScale, const float mapScale, const HeightmapRegion &region);
+
+    /**
+     * @brief Changes how the normals are computed. Applied on the next `updateBuffers`
+     */
+    void setNormalMode(NormalMode mode) { _normalMode = mode; }
+    NormalMode getNormalMode() const { return _normalMode; }
 
-    void updateBuffers(const std::vector<float> &heights, const u32 width, const u32 depth, const float textureScale, const float mapScale) const;
+    /**
+     * @brief Changes how the terrain is rendered and frees the gpu data of the previous mode.
+     * `updateBuffers` must be called before the next render
+     */
+    void setRenderMode(RenderMode mode);
+    RenderMode getRenderMode() const { return _renderMode; }
+    /**
+     * @brief Sets the camera the detail levels are chosen from. It is the same for all the passes
+     * of a frame so that the shadows are cast by the geometry that is drawn
+     */
+    void setLodCamera(const LodCamera &camera) { _lodCamera = camera; }
+    /**
+     * @brief Sets the size in pixels the triangles of a patch should have on the screen before switching
+     * to a coarser level
+     */
+    void setLodTriangleSize(f32 pixels) { _lodTriangleSize = std::max(pixels, 0.1f); }
+    f32 getLodTriangleSize() const { return _lodTriangleSize; }
+    u32 getLodLevelCount() const { return static_cast<u32>(_lodLevels.size()); }
+    /**
+     * @brief Sets the uniforms the terrain shaders need to rebuild the vertices in heightfield mode
+     */
+    void setShaderUniforms(Necrosis::Shader &shader) const;
+    /**
+     * @brief Size in bytes of the terrain data on the gpu
+     */
+    size_t getGpuMemoryUsage() const;
+
+    /**
+     * @brief Times the generation of all the vertices of `heights` with both normal modes.
+     * Nothing is uploaded and the mesh is left as it was.
+     * The heightmap must have the dimensions of the last `updateBuffers`.
+     */
+    void runBenchmark(std::span<const f32> heights);
+    const MeshingBenchmark& getBenchmark() const { return _benchmark; }
 
 private:
+    Necrosis::TaskScheduler &_taskScheduler;
+
     std::unique_ptr<Necrosis::VertexArray> _vao;
     std::unique_ptr<Necrosis::VertexBuffer> _vbo;
     std::unique_ptr<Necrosis::IndexBuffer> _ibo;
 
+    // parameters of the mesh on the gpu
+    u32 _width = 0;
+    u32 _depth = 0;
+    float _textureScale = 0.f;
+    float _mapScale = 0.f;
+    std::vector<Necrosis::Vertex> _vertices; ///< @brief Copy of the vertex buffer used to upload whole rows
+    NormalMode _normalMode = NormalMode::SixNeighbours;
+    RenderMode _renderMode = RenderMode::Mesh;
+
+    bool _isHeightfieldMode() const { return _renderMode != RenderMode::Mesh; }
+
+    // chunks
+    static constexpr u32 CHUNK_SIZE = 64; ///< @brief Quads per side of a chunk, and of the grid patch of the heightfield mode
+    /**
+     * @brief Square of CHUNK_SIZE quads of the map, the chunks on the far edges can be smaller
+     */
+    struct Chunk {
+        // height range of its vertices, used for the bounding box
+        f32 minHeight = 0.f;
+        f32 maxHeight = 0.f;
+        // range of its triangles in the index buffer of the mesh mode
+        u32 firstIndex = 0;
+        u32 indexCount = 0;
+    };
+    std::vector<Chunk> _chunks; ///< @brief Row major
+    // reused by every render to collect the visible chunks
+    mutable std::vector<i32> _drawCounts;
+    mutable std::vector<const void*> _drawOffsets;
+    mutable std::vector<u32> _visibleChunks;
+
+    /**
+     * @brief Number of chunks needed to cover the (width - 1) x (depth - 1) quads of the map
+     */
+    u32 _getChunksX() const { return (std::max(_width, 2u) - 2) / CHUNK_SIZE + 1; }
+    u32 _getChunksZ() const { return (std::max(_depth, 2u) - 2) / CHUNK_SIZE + 1; }
+    /**
+     * @brief Updates the height range of the chunks containing vertices of `region`
+     */
+    void _updateChunkBounds(std::span<const f32> heights, const HeightmapRegion &region);
+    /**
+     * @brief Bounding box in model space of the vertices [x, x + size] x [z, z + size] of the map
+     * @param heightRange min and max heights of the vertices
+     */
+    std::pair<glm::vec3, glm::vec3> _getBoundingBox(u32 x, u32 z, u32 size, glm::vec2 heightRange) const;
+
+    // heightfield modes
+    static constexpr u32 HEIGHTMAP_TEXTURE_UNIT = 7; ///< @brief Units below are used by the terrain textures
+    u32 _heightTexture = 0;
+    std::unique_ptr<Necrosis::VertexArray> _patchVao;
+    std::unique_ptr<Necrosis::IndexBuffer> _patchIbo;
+    /**
+     * @brief Per instance attributes of the grid patch
+     */
+    struct PatchInstance {
+        u32 x, z;  ///< @brief Cell of the first vertex
+        u32 level; ///< @brief The vertices are 2^level cells apart
+        // distances to the camera over which the vertices morph into the ones of the next level
+        f32 morphStart, morphEnd;
+    };
+    u32 _patchInstanceBuffer = 0;
+    mutable std::vector<PatchInstance> _patchInstances;
+
+    void _updateHeightTexture(std::span<const f32> heights, bool dimensionsChanged);
+
+    // quadtree mode
+    /**
+     * @brief Nodes of a level of the quadtree. A node of level L covers 2^L x 2^L chunks
+     */
+    struct LodLevel {
+        u32 nodesX = 0;
+        u32 nodesZ = 0;
+        std::vector<glm::vec2> heightRanges; ///< @brief Min and max heights of the nodes, row major
+    };
+    std::vector<LodLevel> _lodLevels; ///< @brief The first level are the chunks, the last has a single node
+    LodCamera _lodCamera;
+    f32 _lodTriangleSize = 4.f;
+    static constexpr f32 LOD_MORPH_START = 0.66f; ///< @brief Part of the range of a level after which its vertices start to morph
+
+    /**
+     * @brief Rebuilds the height ranges of the quadtree from the ones of the chunks
+     */
+    void _updateLodLevels();
+    /**
+     * @brief Adds to `_patchInstances` the patches of the node and of its children at the detail
+     * required by their distance to the camera, skipping the ones outside the frustum
+     * @param ranges distance to the camera up to which each level is used
+     */
+    void _selectLodNodes(
+        u32 level, u32 nodeX, u32 nodeZ, const std::array<glm::vec4, 6> &planes,
+        const std::vector<f32> &ranges, CullingStats &stats
+    ) const;
+
+    MeshingBenchmark _benchmark;
+
+    /**
+     * @brief Generates the vertices of [beginX, endX) x [beginZ, endZ) in `_vertices`
+     *
+     * The rows are processed in blocks across the task scheduler. The normals of a row are first
+     * computed in separate component arrays so the inner cells are done by a branch free,
+     * vectorized loop, and the cells on the border of the map by a slower path clamping the coordinates.
+     */
+    void _generateVertices(std::span<const f32> heights, u32 beginX, u32 endX, u32 beginZ, u32 endZ);
+    void _generateIndices();
+
     // std::unique_ptr<Necrosis::VertexArray> _normalVao;
     // std::unique_ptr<Necrosis::VertexBuffer> _normalVbo;
 };
@@ -0,0 +1,366 @@
+#include "TiledHeightmap.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+#include <slog/slog.h>
+#include <stb/stb_image.h>
+
+// defined with the implementation of stb_image_write, but not declared by its header
+extern "C" unsigned char* stbi_zlib_compress(unsigned char *data, int data_len, int *out_len, int quality);
+
+namespace Geophagia {
+
+constexpr char TILED_MAGIC[4] = { 'G', 'T', 'H', 'M' };
+constexpr u32 TILED_VERSION = 1;
+constexpr size_t TILED_HEADER_SIZE = sizeof(TILED_MAGIC) + 4 * sizeof(u32) + sizeof(f32);
+constexpr size_t TILED_INDEX_ENTRY_SIZE = sizeof(u64) + 2 * sizeof(u32) + 2 * sizeof(f32);
+// lower levels of stb's deflate are faster and barely larger on the predicted residuals
+constexpr int TILED_COMPRESSION_QUALITY = 5;
+// the planes of a tile are passed to stb as an int
+static_assert(static_cast<u64>(TiledHeightmap::MAX_TILE_SIZE) * TiledHeightmap::MAX_TILE_SIZE * sizeof(u32) <= INT_MAX);
+
+template <typename T>
+void appendValue(std::vector<u8> &bytes, T value) {
+    const size_t offset = bytes.size();
+    bytes.resize(offset + sizeof(T));
+    std::memcpy(bytes.data() + offset, &value, sizeof(T));
+}
+
+template <typename T>
+T readValue(const std::byte *bytes) {
+    T value;
+    std::memcpy(&value, bytes, sizeof(T));
+    return value;
+}
+
+/**
+ * @brief Maps the bits of a float to an integer in the same order as the floats,
+ * so the differences between close heights stay small
+ */
+u32 toOrderedBits(f32 height) {
+    const u32 bits = std::bit_cast<u32>(height);
+    return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+}
+
+f32 fromOrderedBits(u32 value) {
+    return std::bit_cast<f32>((value & 0x80000000u) ? value & 0x7FFFFFFFu : ~value);
+}
+
+/**
+ * @brief Median predictor: the gradient left + up - upLeft, clamped to the range of left and up
+ */
+u32 predict(u32 left, u32 up, u32 upLeft) {
+    const u32 low = std::min(left, up);
+    const u32 high = std::max(left, up);
+    if (upLeft >= high) { return low; }
+    if (upLeft <= low) { return high; }
+    return left + up - upLeft;
+}
+
+u32 predictAt(const u32 *values, u32 width, u32 x, u32 z) {
+    if (z == 0) { return x == 0 ? 0 : values[x - 1]; }
+    const u32 *row = values + static_cast<size_t>(z) * width;
+    const u32 *upRow = row - width;
+    if (x == 0) { return upRow[0]; }
+    return predict(row[x - 1], upRow[x], upRow[x - 1]);
+}
+
+std::vector<u8> encodeTile(
+    std::span<const f32> heights, u32 heightmapWidth, const HeightmapRegion &area, f32 precision, TiledHeightmap::Tile &tile
+) {
+    const size_t count = static_cast<size_t>(area.width) * area.depth;
+    auto heightAt = [&](u32 x, u32 z) {
+        return heights[static_cast<size_t>(area.z + z) * heightmapWidth + area.x + x];
+    };
+
+    f32 minHeight = heightAt(0, 0), maxHeight = heightAt(0, 0);
+    bool isFinite = true;
+    for (u32 z = 0; z < area.depth; z++) {
+        for (u32 x = 0; x < area.width; x++) {
+            const f32 height = heightAt(x, z);
+            minHeight = std::min(minHeight, height);
+            maxHeight = std::max(maxHeight, height);
+            isFinite &= std::isfinite(height);
+        }
+    }
+    tile.minHeight = minHeight;
+    tile.maxHeight = maxHeight;
+
+    // beyond 2^24 steps, a step is smaller than the rounding of the floats and the error
+    // would exceed half of the precision. the steps are computed in doubles to round only once
+    std::vector<u32> values(count);
+    const bool isQuantized = precision > 0.f && isFinite
+        && (static_cast<f64>(maxHeight) - minHeight) / precision < 16777216.0;
+    tile.encoding = isQuantized ? TiledHeightmap::Encoding::Quantized : TiledHeightmap::Encoding::Lossless;
+    for (u32 z = 0; z < area.depth; z++) {
+        for (u32 x = 0; x < area.width; x++) {
+            const f32 height = heightAt(x, z);
+            values[static_cast<size_t>(z) * area.width + x] = isQuantized
+                ? static_cast<u32>(std::llround((static_cast<f64>(height) - minHeight) / precision))
+                : toOrderedBits(height);
+        }
+    }
+
+    // the zigzag encoded residuals, split in byte planes
+    std::vector<u8> planes(count * sizeof(u32));
+    for (u32 z = 0; z < area.depth; z++) {
+        for (u32 x = 0; x < area.width; x++) {
+            const size_t i = static_cast<size_t>(z) * area.width + x;
+            const i32 residual = static_cast<i32>(values[i] - predictAt(values.data(), area.width, x, z));
+            const u32 zigzag = (static_cast<u32>(residual) << 1) ^ static_cast<u32>(residual >> 31);
+            for (size_t byte = 0; byte < sizeof(u32); byte++) {
+                planes[byte * count + i] = static_cast<u8>(zigzag >> (8 * byte));
+            }
+        }
+    }
+
+    int compressedSize = 0;
+    u8 *compressed = stbi_zlib_compress(planes.data(), static_cast<int>(planes.size()), &compressedSize, TILED_COMPRESSION_QUALITY);
+    if (compressed && static_cast<size_t>(compressedSize) < count * sizeof(f32)) {
+        std::vector<u8> bytes(compressed, compressed + compressedSize);
+        std::free(compressed);
+        return bytes;
+    }
+    std::free(compressed);
+
+    tile.encoding = TiledHeightmap::Encoding::Stored;
+    std::vector<u8> bytes;
+    bytes.reserve(count * sizeof(f32));
+    for (u32 z = 0; z < area.depth; z++) {
+        for (u32 x = 0; x < area.width; x++) {
+            appendValue(bytes, heightAt(x, z));
+        }
+    }
+    return bytes;
+}
+
+/**
+ * @brief Decodes the heights of a tile of `area` size, row by row
+ */
+bool decodeTile(std::span<const std::byte> data, const TiledHeightmap::Tile &tile, f32 precision, const HeightmapRegion &area, std::span<f32> heights) {
+    const size_t count = heights.size();
+    if (tile.encoding == TiledHeightmap::Encoding::Stored) {
+        if (data.size() != count * sizeof(f32)) { return false; }
+        std::memcpy(heights.data(), data.data(), data.size());
+        return true;
+    }
+    if (data.size() > INT_MAX) { return false; }
+
+    std::vector<u8> planes(count * sizeof(u32));
+    const int decodedSize = stbi_zlib_decode_buffer(
+        reinterpret_cast<char*>(planes.data()), static_cast<int>(planes.size()),
+        reinterpret_cast<const char*>(data.data()), static_cast<int>(data.size())
+    );
+    if (decodedSize != static_cast<int>(planes.size())) { return false; }
+
+    std::vector<u32> values(count);
+    for (u32 z = 0; z < area.depth; z++) {
+        for (u32 x = 0; x < area.width; x++) {
+            const size_t i = static_cast<size_t>(z) * area.width + x;
+            u32 zigzag = 0;
+            for (size_t byte = 0; byte < sizeof(u32); byte++) {
+                zigzag |= static_cast<u32>(planes[byte * count + i]) << (8 * byte);
+            }
+            const u32 residual = (zigzag >> 1) ^ (0u - (zigzag & 1));
+            values[i] = predictAt(values.data(), area.width, x, z) + residual;
+        }
+    }
+
+    if (tile.encoding == TiledHeightmap::Encoding::Quantized) {
+        for (size_t i = 0; i < count; i++) {
+            heights[i] = static_cast<f32>(tile.minHeight + static_cast<f64>(values[i]) * precision);
+        }
+    }
+    else {
+        for (size_t i = 0; i < count; i++) {
+            heights[i] = fromOrderedBits(values[i]);
+        }
+    }
+    return true;
+}
+
+bool TiledHeightmap::write(
+    const std::filesystem::path &path, std::span<const f32> heights, u32 width, u32 depth,
+    u32 tileSize, f32 precision, Necrosis::TaskScheduler &taskScheduler
+) {
+    expect(heights.size() == static_cast<size_t>(width) * depth, "The size of the heightmap is invalid");
+    expect(tileSize > 0 && tileSize <= MAX_TILE_SIZE, "The tile size is out of range");
+
+    const u32 tilesX = (width + tileSize - 1) / tileSize;
+    const u32 tilesZ = (depth + tileSize - 1) / tileSize;
+    std::vector<Tile> tiles(static_cast<size_t>(tilesX) * tilesZ);
+    std::vector<std::vector<u8>> tileData(tiles.size());
+
+    taskScheduler.parallelFor(static_cast<u32>(tiles.size()), [&](u32 i) {
+        const u32 x = (i % tilesX) * tileSize;
+        const u32 z = (i / tilesX) * tileSize;
+        const HeightmapRegion area = { x, z, std::min(tileSize, width - x), std::min(tileSize, depth - z) };
+        tileData[i] = encodeTile(heights, width, area, precision, tiles[i]);
+    });
+
+    std::vector<u8> header;
+    header.reserve(TILED_HEADER_SIZE + tiles.size() * TILED_INDEX_ENTRY_SIZE);
+    header.insert(header.end(), std::begin(TILED_MAGIC), std::end(TILED_MAGIC));
+    appendValue(header, TILED_VERSION);
+    appendValue(header, width);
+    appendValue(header, depth);
+    appendValue(header, tileSize);
+    appendValue(header, precision);
+
+    u64 offset = TILED_HEADER_SIZE + tiles.size() * TILED_INDEX_ENTRY_SIZE;
+    for (size_t i = 0; i < tiles.size(); i++) {
+        tiles[i].offset = offset;
+        tiles[i].size = static_cast<u32>(tileData[i].size());
+        offset += tiles[i].size;
+
+        appendValue(header, tiles[i].offset);
+        appendValue(header, tiles[i].size);
+        appendValue(header, static_cast<u32>(tiles[i].encoding));
+        appendValue(header, tiles[i].minHeight);
+        appendValue(header, tiles[i].maxHeight);
+    }
+
+    std::filesystem::path temporaryPath = path;
+    temporaryPath += ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            slog::warning("Failed to create the file '{}'", temporaryPath.string());
+            return false;
+        }
+
+        file.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+        for (const auto &data : tileData) {
+            file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        }
+        file.close();
+
+        if (file.fail()) {
+            slog::warning("Failed to write the file '{}'", temporaryPath.string());
+            std::error_code error;
+            std::filesystem::remove(temporaryPath, error);
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error) {
+        slog::warning("Failed to replace the file '{}': {}", path.string(), error.message());
+        std::filesystem::remove(temporaryPath, error);
+        return false;
+    }
+    return true;
+}
+
+bool TiledHeightmap::open(const std::filesystem::path &path) {
+    close();
+    if (!_file.open(path)) {
+        return false;
+    }
+
+    auto fail = [&](const char *reason) {
+        slog::warning("The tiled heightmap '{}' is invalid: {}", path.string(), reason);
+        close();
+        return false;
+    };
+
+    const auto data = _file.getData();
+    if (data.size() < TILED_HEADER_SIZE || std::memcmp(data.data(), TILED_MAGIC, sizeof(TILED_MAGIC)) != 0) {
+        return fail("wrong header");
+    }
+    const std::byte *header = data.data() + sizeof(TILED_MAGIC);
+    if (readValue<u32>(header) != TILED_VERSION) {
+        return fail("unsupported version");
+    }
+    _width = readValue<u32>(header + 4);
+    _depth = readValue<u32>(header + 8);
+    _tileSize = readValue<u32>(header + 12);
+    _precision = readValue<f32>(header + 16);
+    if (_width == 0 || _depth == 0 || _tileSize == 0 || _tileSize > MAX_TILE_SIZE || !(_precision >= 0.f)) {
+        return fail("invalid dimensions");
+    }
+
+    // in 64 bits, the dimensions come from the file
+    const u64 tilesX = (static_cast<u64>(_width) + _tileSize - 1) / _tileSize;
+    const u64 tilesZ = (static_cast<u64>(_depth) + _tileSize - 1) / _tileSize;
+    const u64 tileCount = tilesX * tilesZ;
+    if (tileCount > std::numeric_limits<u32>::max()) {
+        return fail("too many tiles");
+    }
+    if (tileCount > (data.size() - TILED_HEADER_SIZE) / TILED_INDEX_ENTRY_SIZE) {
+        return fail("truncated index");
+    }
+
+    _tilesX = static_cast<u32>(tilesX);
+    _tiles.resize(tileCount);
+    const std::byte *entry = data.data() + TILED_HEADER_SIZE;
+    for (auto &tile : _tiles) {
+        tile.offset = readValue<u64>(entry);
+        tile.size = readValue<u32>(entry + 8);
+        tile.encoding = static_cast<Encoding>(readValue<u32>(entry + 12));
+        tile.minHeight = readValue<f32>(entry + 16);
+        tile.maxHeight = readValue<f32>(entry + 20);
+        entry += TILED_INDEX_ENTRY_SIZE;
+
+        if (tile.offset > data.size() || tile.size > data.size() - tile.offset || tile.encoding > Encoding::Stored) {
+            return fail("invalid tile");
+        }
+    }
+    return true;
+}
+
+void TiledHeightmap::close() {
+    _file.close();
+    _tiles.clear();
+    _width = _depth = _tileSize = _tilesX = 0;
+    _precision = 0.f;
+}
+
+bool TiledHeightmap::read(const HeightmapRegion &region, std::span<f32> heights, Necrosis::TaskScheduler &taskScheduler) const {
+    expect(isOpen(), "The tiled heightmap must be opened before reading it");
+    expect(region.getEndX() <= _width && region.getEndZ() <= _depth, "The region is out of the heightmap");
+    expect(heights.size() == static_cast<size_t>(region.width) * region.depth, "The size of the region is invalid");
+    if (region.isEmpty()) { return true; }
+
+    // tiles overlapping the region
+    const u32 firstX = region.x / _tileSize, firstZ = region.z / _tileSize;
+    const u32 countX = (region.getEndX() - 1) / _tileSize - firstX + 1;
+    const u32 countZ = (region.getEndZ() - 1) / _tileSize - firstZ + 1;
+
+    std::atomic<bool> isValid = true;
+    taskScheduler.parallelFor(countX * countZ, [&](u32 i) {
+        const u32 tileX = firstX + i % countX, tileZ = firstZ + i / countX;
+        const Tile &tile = _tiles[static_cast<size_t>(tileZ) * _tilesX + tileX];
+        const u32 x = tileX * _tileSize, z = tileZ * _tileSize;
+        const HeightmapRegion area = { x, z, std::min(_tileSize, _width - x), std::min(_tileSize, _depth - z) };
+
+        std::vector<f32> tileHeights(static_cast<size_t>(area.width) * area.depth);
+        if (!decodeTile(_file.getData().subspan(tile.offset, tile.size), tile, _precision, area, tileHeights)) {
+            isValid.store(false, std::memory_order_relaxed);
+            return;
+        }
+
+        // copy the part inside the region
+        const u32 beginX = std::max(area.x, region.x), endX = std::min(area.getEndX(), region.getEndX());
+        const u32 beginZ = std::max(area.z, region.z), endZ = std::min(area.getEndZ(), region.getEndZ());
+        for (u32 cellZ = beginZ; cellZ < endZ; cellZ++) {
+            std::memcpy(
+                heights.data() + static_cast<size_t>(cellZ - region.z) * region.width + (beginX - region.x),
+                tileHeights.data() + static_cast<size_t>(cellZ - area.z) * area.width + (beginX - area.x),
+                (endX - beginX) * sizeof(f32)
+            );
+        }
+    });
+    return isValid;
+}
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <filesystem>
+#include <span>
+#include <vector>
+
+#include <Common.h>
+#include <Necrosis/tasks/TaskScheduler.h>
+
+#include "HeightmapRegion.h"
+#include "../Utils/MappedFile.h"
+
+namespace Geophagia {
+/**
+ * @brief Heightmap file split in square tiles compressed independently
+ *
+ * The file starts with a header and an index giving the position and the height
+ * range of every tile, so any region can be read by decompressing only the tiles
+ * it overlaps, in parallel. All the values are little endian.
+ *
+ * A tile is encoded in 3 steps:
+ * - the heights are turned into integers, either quantized with the precision of
+ *   the file from the lowest height of the tile, or as their float bits (lossless)
+ * - each integer is replaced by its difference with the prediction made from its
+ *   left, upper and upper left neighbours (the median predictor of LOCO-I)
+ * - the bytes of the differences are split in 4 planes, mostly zeros for the high
+ *   ones, and compressed with deflate
+ */
+class TiledHeightmap {
+public:
+    static constexpr u32 DEFAULT_TILE_SIZE = 256;
+    /**
+     * @brief Bounds the memory a tile takes to decode, a larger size in a file is rejected
+     */
+    static constexpr u32 MAX_TILE_SIZE = 4096;
+
+    /**
+     * @brief Encoding of the heights of a tile
+     */
+    enum class Encoding : u32 {
+        Quantized,
+        Lossless,
+        Stored, ///< @brief Uncompressed floats, when the compression doesn't pay off
+    };
+
+    /**
+     * @brief Entry of the index of the tiles
+     */
+    struct Tile {
+        u64 offset = 0; ///< @brief From the start of the file
+        u32 size = 0; ///< @brief Compressed size in bytes
+        Encoding encoding = Encoding::Stored;
+        f32 minHeight = 0.f;
+        f32 maxHeight = 0.f;
+    };
+
+    TiledHeightmap() = default;
+
+    /**
+     * @brief Compresses the tiles in parallel and writes them in a temporary file
+     * renamed to `path` once complete
+     *
+     * @param precision Size of the quantization steps, the error is about half of it at most.
+     * 0 compresses without loss
+     * @return true on success and false on failure
+     */
+    static bool write(
+        const std::filesystem::path &path, std::span<const f32> heights, u32 width, u32 depth,
+        u32 tileSize, f32 precision, Necrosis::TaskScheduler &taskScheduler
+    );
+
+    /**
+     * @brief Maps the file and reads its index, the tiles are read by `read`
+     * @return true on success and false on failure
+     */
+    bool open(const std::filesystem::path &path);
+    void close();
+    bool isOpen() const { return _file.isOpen(); }
+
+    /**
+     * @brief Decompresses the tiles overlapping `region` in parallel
+     *
+     * @param heights Heights of the region, row by row, of size `region.width * region.depth`
+     * @return true on success and false if a tile is corrupted
+     */
+    bool read(const HeightmapRegion &region, std::span<f32> heights, Necrosis::TaskScheduler &taskScheduler) const;
+
+    u32 getWidth() const { return _width; }
+    u32 getDepth() const { return _depth; }
+    u32 getTileSize() const { return _tileSize; }
+    f32 getPrecision() const { return _precision; }
+    u64 getFileSize() const { return _file.getData().size(); }
+    const std::vector<Tile>& getTiles() const { return _tiles; }
+
+private:
+    MappedFile _file;
+    u32 _width = 0;
+    u32 _depth = 0;
+    u32 _tileSize = 0;
+    f32 _precision = 0.f;
+    u32 _tilesX = 0; ///< @brief Number of tiles in a row
+    std::vector<Tile> _tiles;
+};
+}
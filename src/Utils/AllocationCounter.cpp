@@ -0,0 +1,67 @@
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace Geophagia::AllocationCounter {
+namespace {
+// only counted, the allocations don't synchronize through it
+std::atomic<u64> s_allocations = 0;
+}
+
+u64 getAllocations() {
+    return s_allocations.load(std::memory_order_relaxed);
+}
+}
+
+#ifndef NDEBUG
+// Replacements of the global allocation functions.
+// The array and nothrow versions call these ones, so they are counted too.
+
+void* operator new(std::size_t size) {
+    Geophagia::AllocationCounter::s_allocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void *p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    Geophagia::AllocationCounter::s_allocations.fetch_add(1, std::memory_order_relaxed);
+
+    const std::size_t align = static_cast<std::size_t>(alignment);
+    const std::size_t bytes = size == 0 ? 1 : size;
+#if defined(_WIN64) || defined(_WIN32)
+    void *p = _aligned_malloc(bytes, align);
+#else
+    // aligned_alloc wants the size to be a multiple of the alignment
+    void *p = std::aligned_alloc(align, (bytes + align - 1) / align * align);
+#endif
+    if (p) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept {
+#if defined(_WIN64) || defined(_WIN32)
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t alignment) noexcept {
+    operator delete(p, alignment);
+}
+#endif // NDEBUG
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <Common.h>
+
+namespace Geophagia {
+/**
+ * @brief Counts the heap allocations made by the process
+ *
+ * In debug builds the global operator new is replaced to increment a process wide
+ * counter, which is used to check that hot loops don't allocate, including the parts
+ * run on the workers of the task scheduler. In release builds the counter is not
+ * maintained and always returns 0.
+ */
+namespace AllocationCounter {
+    /**
+     * @brief Whether the allocations are counted in this build
+     */
+    constexpr bool isEnabled() {
+#ifndef NDEBUG
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * @return Number of allocations made by all the threads since the process started
+     */
+    u64 getAllocations();
+}
+}
@@ -0,0 +1,126 @@
+#include "MappedFile.h"
+
+#include <utility>
+
+#include <slog/slog.h>
+
+#if defined(_WIN64) || defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Geophagia {
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+    : _data(std::exchange(other._data, nullptr)), _size(std::exchange(other._size, 0)), _path(std::exchange(other._path, {})) {}
+
+MappedFile& MappedFile::operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+        close();
+        _data = std::exchange(other._data, nullptr);
+        _size = std::exchange(other._size, 0);
+        _path = std::exchange(other._path, {});
+    }
+    return *this;
+}
+
+#if defined(_WIN64) || defined(_WIN32)
+bool MappedFile::open(const std::filesystem::path &path) {
+    close();
+
+    HANDLE file = CreateFileW(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr
+    );
+    if (file == INVALID_HANDLE_VALUE) {
+        slog::warning("Failed to open file '{}' for mapping", path.string());
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        slog::warning("Failed to map empty or unreadable file '{}'", path.string());
+        CloseHandle(file);
+        return false;
+    }
+
+    // the view keeps the mapping alive, the handles can be closed right away
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping) {
+        slog::warning("Failed to map file '{}'", path.string());
+        return false;
+    }
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!view) {
+        slog::warning("Failed to map file '{}'", path.string());
+        return false;
+    }
+
+    _data = static_cast<const std::byte*>(view);
+    _size = static_cast<size_t>(size.QuadPart);
+    _path = path;
+    return true;
+}
+
+void MappedFile::close() {
+    if (_data) {
+        UnmapViewOfFile(_data);
+    }
+    _data = nullptr;
+    _size = 0;
+    _path.clear();
+}
+#else
+bool MappedFile::open(const std::filesystem::path &path) {
+    close();
+
+    const int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        slog::warning("Failed to open file '{}' for mapping", path.string());
+        return false;
+    }
+
+    struct stat status;
+    if (fstat(file, &status) != 0 || status.st_size == 0) {
+        slog::warning("Failed to map empty or unreadable file '{}'", path.string());
+        ::close(file);
+        return false;
+    }
+
+    // the mapping stays valid after closing the file descriptor
+    void *view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    ::close(file);
+    if (view == MAP_FAILED) {
+        slog::warning("Failed to map file '{}'", path.string());
+        return false;
+    }
+    // the heightmaps are read from start to end, this makes the OS read ahead further
+    madvise(view, static_cast<size_t>(status.st_size), MADV_SEQUENTIAL);
+
+    _data = static_cast<const std::byte*>(view);
+    _size = static_cast<size_t>(status.st_size);
+    _path = path;
+    return true;
+}
+
+void MappedFile::close() {
+    if (_data) {
+        munmap(const_cast<std::byte*>(_data), _size);
+    }
+    _data = nullptr;
+    _size = 0;
+    _path.clear();
+}
+#endif
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+
+#include <Common.h>
+
+namespace Geophagia {
+/**
+ * @brief Read only view of a whole file mapped in memory
+ *
+ * The pages are loaded by the OS when they are first read and are backed by the file,
+ * so they don't count as private memory and can be dropped under memory pressure.
+ * The mapping is released by `close` or the destructor.
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile& operator=(MappedFile &&other) noexcept;
+
+    /**
+     * @brief Maps the file, after closing the previous one
+     * @param path path of the file
+     * @return true on success and false on failure
+     */
+    bool open(const std::filesystem::path &path);
+    void close();
+
+    bool isOpen() const { return _data != nullptr; }
+    std::span<const std::byte> getData() const { return { _data, _size }; }
+    const std::filesystem::path& getPath() const { return _path; }
+
+private:
+    const std::byte *_data = nullptr;
+    size_t _size = 0;
+    std::filesystem::path _path;
+};
+}
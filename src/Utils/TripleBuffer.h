@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+
+#include <Common.h>
+
+namespace Geophagia {
+/**
+ * @brief Lock free channel passing the latest value from one producer thread to one consumer thread
+ *
+ * The producer writes in its own back buffer and publishes it by swapping it with the middle one.
+ * The consumer takes the middle buffer when a new one was published by swapping it with its front buffer.
+ * Neither side ever waits for the other and a buffer is never read while being written.
+ * Values published faster than the consumer reads them are skipped, only the latest is kept.
+ */
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer() = default;
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    /**
+     * @brief Sets the 3 buffers to `value` and discards any published value.
+     * Must not be called while the producer or the consumer use the buffer.
+     */
+    void reset(const T &value) {
+        _buffers.fill(value);
+        _back = 0;
+        _middle.store(1, std::memory_order_relaxed);
+        _front = 2;
+    }
+
+    // producer side
+    /**
+     * @brief Buffer to write the next value into. Only the producer thread may use it
+     */
+    T& getWriteBuffer() { return _buffers[_back]; }
+    /**
+     * @brief Makes the write buffer available to the consumer and gets a new one to write into
+     */
+    void publish() {
+        _back = _middle.exchange(_back | FRESH_BIT, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // consumer side
+    /**
+     * @brief Takes the last published value if there is one
+     * @return Whether the read buffer changed
+     */
+    bool acquire() {
+        if (!(_middle.load(std::memory_order_relaxed) & FRESH_BIT)) {
+            return false;
+        }
+        _front = _middle.exchange(_front, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+    /**
+     * @brief Last value acquired. Only the consumer thread may use it
+     */
+    const T& getReadBuffer() const { return _buffers[_front]; }
+
+private:
+    static constexpr u8 INDEX_MASK = 0b011;
+    static constexpr u8 FRESH_BIT = 0b100; ///< @brief Set when the middle buffer hasn't been acquired yet
+
+    std::array<T, 3> _buffers;
+    u8 _back = 0; ///< @brief Owned by the producer
+    std::atomic<u8> _middle = 1; ///< @brief Index of the shared buffer and the fresh bit
+    u8 _front = 2; ///< @brief Owned by the consumer
+};
+}